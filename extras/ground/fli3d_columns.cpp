@@ -0,0 +1,346 @@
+/*
+ * Fli3d - Ground tools (columnar export, Linux)
+ *
+ * Turns the archive segments of a session into one table per packet type, with one column file per
+ * field of its packed struct in fli3d_packets.h. A column file is a contiguous little-endian array of
+ * the field's declared type (bit fields widened to it), so analysis code maps just the columns it
+ * needs (e.g. numpy.fromfile). Row i of every column of a table is the same packet, and millis.col is
+ * the shared time column: the 24-bit packet millis, unwrapped. The footer index, index.json, is written
+ * last and lists per table its rows, time range and column types.
+ *
+ * usage: fli3d_columns [-o directory] <segment|session directory>...
+ */
+
+#include "fli3d_reader.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define COLUMN_BUFFER_SIZE        65536  // stdio buffer per column file
+
+template <typename T> struct column_type { // integer and bool fields
+  static const char* name ();
+  static const uint16_t width = sizeof(T);
+  static void copy (T value, uint8_t* out) { memcpy (out, &value, sizeof(T)); }
+};
+template <> const char* column_type<bool>::name () { return "bool"; }
+template <> const char* column_type<uint8_t>::name () { return "u8"; }
+template <> const char* column_type<int8_t>::name () { return "i8"; }
+template <> const char* column_type<uint16_t>::name () { return "u16"; }
+template <> const char* column_type<int16_t>::name () { return "i16"; }
+template <> const char* column_type<uint32_t>::name () { return "u32"; }
+template <> const char* column_type<int32_t>::name () { return "i32"; }
+
+template <size_t N> struct column_type<char[N]> { // strings, as fixed-width zero-padded cells
+  static const char* name () { return "char"; }
+  static const uint16_t width = N;
+  static void copy (const char (&value)[N], uint8_t* out) { memcpy (out, value, N); }
+};
+
+struct column_t {
+  const char* name;
+  const char* type;
+  uint16_t    width;
+  void        (*copy) (const uint8_t* packet, uint8_t* value);
+};
+
+#define COLUMN(packet_t, field) { #field, column_type<decltype(((packet_t*)0)->field)>::name (), column_type<decltype(((packet_t*)0)->field)>::width, \
+                                  [] (const uint8_t* packet, uint8_t* value) { column_type<decltype(((packet_t*)0)->field)>::copy (((const packet_t*)packet)->field, value); } }
+
+// every field except the CCSDS header, millis (the shared time column) and the unassigned free_* bits
+
+const column_t sts_esp32_columns[] = {
+  COLUMN (sts_esp32_t, packet_ctr), COLUMN (sts_esp32_t, type), COLUMN (sts_esp32_t, subsystem), COLUMN (sts_esp32_t, message)
+};
+
+const column_t sts_esp32cam_columns[] = {
+  COLUMN (sts_esp32cam_t, packet_ctr), COLUMN (sts_esp32cam_t, type), COLUMN (sts_esp32cam_t, subsystem),
+  COLUMN (sts_esp32cam_t, message)
+};
+
+const column_t tm_esp32_columns[] = {
+  COLUMN (tm_esp32_t, packet_ctr), COLUMN (tm_esp32_t, opsmode), COLUMN (tm_esp32_t, state), COLUMN (tm_esp32_t, buffer_fs),
+  COLUMN (tm_esp32_t, ftp_fs), COLUMN (tm_esp32_t, error_ctr), COLUMN (tm_esp32_t, warning_ctr),
+  COLUMN (tm_esp32_t, tc_exec_ctr), COLUMN (tm_esp32_t, tc_fail_ctr), COLUMN (tm_esp32_t, radio_rate),
+  COLUMN (tm_esp32_t, pressure_rate), COLUMN (tm_esp32_t, motion_rate), COLUMN (tm_esp32_t, gps_rate),
+  COLUMN (tm_esp32_t, camera_rate), COLUMN (tm_esp32_t, udp_rate), COLUMN (tm_esp32_t, yamcs_rate),
+  COLUMN (tm_esp32_t, serial_in_rate), COLUMN (tm_esp32_t, serial_out_rate), COLUMN (tm_esp32_t, fs_rate),
+  COLUMN (tm_esp32_t, yamcs_buffer), COLUMN (tm_esp32_t, serial_out_buffer), COLUMN (tm_esp32_t, mem_free),
+  COLUMN (tm_esp32_t, fs_free), COLUMN (tm_esp32_t, temperature), COLUMN (tm_esp32_t, radio_enabled),
+  COLUMN (tm_esp32_t, pressure_enabled), COLUMN (tm_esp32_t, motion_enabled), COLUMN (tm_esp32_t, gps_enabled),
+  COLUMN (tm_esp32_t, camera_enabled), COLUMN (tm_esp32_t, wifi_enabled), COLUMN (tm_esp32_t, wifi_udp_enabled),
+  COLUMN (tm_esp32_t, wifi_yamcs_enabled), COLUMN (tm_esp32_t, fs_enabled), COLUMN (tm_esp32_t, ftp_enabled),
+  COLUMN (tm_esp32_t, ota_enabled), COLUMN (tm_esp32_t, temperature_enabled), COLUMN (tm_esp32_t, time_set),
+  COLUMN (tm_esp32_t, serial_connected), COLUMN (tm_esp32_t, wifi_connected), COLUMN (tm_esp32_t, warn_serial_connloss),
+  COLUMN (tm_esp32_t, warn_wifi_connloss), COLUMN (tm_esp32_t, err_serial_dataloss), COLUMN (tm_esp32_t, err_yamcs_dataloss),
+  COLUMN (tm_esp32_t, err_fs_dataloss), COLUMN (tm_esp32_t, separation_sts), COLUMN (tm_esp32_t, radio_active),
+  COLUMN (tm_esp32_t, pressure_active), COLUMN (tm_esp32_t, motion_active), COLUMN (tm_esp32_t, gps_active),
+  COLUMN (tm_esp32_t, camera_active), COLUMN (tm_esp32_t, fs_active), COLUMN (tm_esp32_t, ftp_active),
+  COLUMN (tm_esp32_t, buffer_active)
+};
+
+const column_t tm_esp32cam_columns[] = {
+  COLUMN (tm_esp32cam_t, packet_ctr), COLUMN (tm_esp32cam_t, opsmode), COLUMN (tm_esp32cam_t, buffer_fs),
+  COLUMN (tm_esp32cam_t, ftp_fs), COLUMN (tm_esp32cam_t, error_ctr), COLUMN (tm_esp32cam_t, warning_ctr),
+  COLUMN (tm_esp32cam_t, tc_exec_ctr), COLUMN (tm_esp32cam_t, tc_fail_ctr), COLUMN (tm_esp32cam_t, camera_rate),
+  COLUMN (tm_esp32cam_t, udp_rate), COLUMN (tm_esp32cam_t, yamcs_rate), COLUMN (tm_esp32cam_t, serial_in_rate),
+  COLUMN (tm_esp32cam_t, serial_out_rate), COLUMN (tm_esp32cam_t, fs_rate), COLUMN (tm_esp32cam_t, sd_json_rate),
+  COLUMN (tm_esp32cam_t, sd_ccsds_rate), COLUMN (tm_esp32cam_t, sd_image_rate), COLUMN (tm_esp32cam_t, yamcs_buffer),
+  COLUMN (tm_esp32cam_t, serial_out_buffer), COLUMN (tm_esp32cam_t, mem_free), COLUMN (tm_esp32cam_t, fs_free),
+  COLUMN (tm_esp32cam_t, sd_free), COLUMN (tm_esp32cam_t, camera_enabled), COLUMN (tm_esp32cam_t, wifi_enabled),
+  COLUMN (tm_esp32cam_t, wifi_udp_enabled), COLUMN (tm_esp32cam_t, wifi_yamcs_enabled),
+  COLUMN (tm_esp32cam_t, wifi_image_enabled), COLUMN (tm_esp32cam_t, time_set), COLUMN (tm_esp32cam_t, fs_enabled),
+  COLUMN (tm_esp32cam_t, sd_enabled), COLUMN (tm_esp32cam_t, ftp_enabled), COLUMN (tm_esp32cam_t, ota_enabled),
+  COLUMN (tm_esp32cam_t, sd_image_enabled), COLUMN (tm_esp32cam_t, sd_json_enabled), COLUMN (tm_esp32cam_t, sd_ccsds_enabled),
+  COLUMN (tm_esp32cam_t, http_enabled), COLUMN (tm_esp32cam_t, serial_connected), COLUMN (tm_esp32cam_t, wifi_connected),
+  COLUMN (tm_esp32cam_t, warn_serial_connloss), COLUMN (tm_esp32cam_t, warn_wifi_connloss),
+  COLUMN (tm_esp32cam_t, err_serial_dataloss), COLUMN (tm_esp32cam_t, err_yamcs_dataloss),
+  COLUMN (tm_esp32cam_t, err_fs_dataloss), COLUMN (tm_esp32cam_t, err_sd_dataloss), COLUMN (tm_esp32cam_t, camera_active),
+  COLUMN (tm_esp32cam_t, fs_active), COLUMN (tm_esp32cam_t, sd_active), COLUMN (tm_esp32cam_t, ftp_active),
+  COLUMN (tm_esp32cam_t, buffer_active), COLUMN (tm_esp32cam_t, http_active)
+};
+
+const column_t tm_camera_columns[] = {
+  COLUMN (tm_camera_t, packet_ctr), COLUMN (tm_camera_t, camera_mode), COLUMN (tm_camera_t, resolution),
+  COLUMN (tm_camera_t, auto_res), COLUMN (tm_camera_t, filesize), COLUMN (tm_camera_t, wifi_ms), COLUMN (tm_camera_t, sd_ms),
+  COLUMN (tm_camera_t, exposure_ms), COLUMN (tm_camera_t, filename)
+};
+
+const column_t tm_gps_columns[] = {
+  COLUMN (tm_gps_t, packet_ctr), COLUMN (tm_gps_t, status), COLUMN (tm_gps_t, satellites), COLUMN (tm_gps_t, hours),
+  COLUMN (tm_gps_t, minutes), COLUMN (tm_gps_t, seconds), COLUMN (tm_gps_t, centiseconds), COLUMN (tm_gps_t, latitude),
+  COLUMN (tm_gps_t, longitude), COLUMN (tm_gps_t, altitude), COLUMN (tm_gps_t, latitude_zero), COLUMN (tm_gps_t, longitude_zero),
+  COLUMN (tm_gps_t, altitude_zero), COLUMN (tm_gps_t, x), COLUMN (tm_gps_t, y), COLUMN (tm_gps_t, z), COLUMN (tm_gps_t, x_err),
+  COLUMN (tm_gps_t, y_err), COLUMN (tm_gps_t, z_err), COLUMN (tm_gps_t, v_north), COLUMN (tm_gps_t, v_east),
+  COLUMN (tm_gps_t, v_down), COLUMN (tm_gps_t, milli_hdop), COLUMN (tm_gps_t, milli_vdop), COLUMN (tm_gps_t, milli_pdop),
+  COLUMN (tm_gps_t, time_valid), COLUMN (tm_gps_t, location_valid), COLUMN (tm_gps_t, altitude_valid),
+  COLUMN (tm_gps_t, speed_valid), COLUMN (tm_gps_t, hdop_valid), COLUMN (tm_gps_t, vdop_valid), COLUMN (tm_gps_t, pdop_valid),
+  COLUMN (tm_gps_t, error_valid), COLUMN (tm_gps_t, offset_valid)
+};
+
+const column_t tm_motion_columns[] = {
+  COLUMN (tm_motion_t, packet_ctr), COLUMN (tm_motion_t, accel_x), COLUMN (tm_motion_t, accel_y), COLUMN (tm_motion_t, accel_z),
+  COLUMN (tm_motion_t, gyro_x), COLUMN (tm_motion_t, gyro_y), COLUMN (tm_motion_t, gyro_z), COLUMN (tm_motion_t, magn_x),
+  COLUMN (tm_motion_t, magn_y), COLUMN (tm_motion_t, magn_z), COLUMN (tm_motion_t, tilt), COLUMN (tm_motion_t, g),
+  COLUMN (tm_motion_t, a), COLUMN (tm_motion_t, rpm), COLUMN (tm_motion_t, accel_range), COLUMN (tm_motion_t, gyro_range),
+  COLUMN (tm_motion_t, accel_valid), COLUMN (tm_motion_t, gyro_valid)
+};
+
+const column_t tm_pressure_columns[] = {
+  COLUMN (tm_pressure_t, packet_ctr), COLUMN (tm_pressure_t, pressure), COLUMN (tm_pressure_t, zero_level_pressure),
+  COLUMN (tm_pressure_t, height), COLUMN (tm_pressure_t, velocity_v), COLUMN (tm_pressure_t, temperature),
+  COLUMN (tm_pressure_t, height_valid)
+};
+
+const column_t tm_radio_columns[] = {
+  COLUMN (tm_radio_t, packet_ctr), COLUMN (tm_radio_t, opsmode), COLUMN (tm_radio_t, state),
+  COLUMN (tm_radio_t, pressure_active), COLUMN (tm_radio_t, motion_active), COLUMN (tm_radio_t, gps_active),
+  COLUMN (tm_radio_t, camera_active), COLUMN (tm_radio_t, error_ctr), COLUMN (tm_radio_t, warning_ctr),
+  COLUMN (tm_radio_t, pressure_height), COLUMN (tm_radio_t, pressure_velocity_v), COLUMN (tm_radio_t, temperature),
+  COLUMN (tm_radio_t, motion_tilt), COLUMN (tm_radio_t, motion_g), COLUMN (tm_radio_t, motion_a),
+  COLUMN (tm_radio_t, motion_rpm), COLUMN (tm_radio_t, gps_satellites), COLUMN (tm_radio_t, esp32_buffer_active),
+  COLUMN (tm_radio_t, esp32cam_buffer_active), COLUMN (tm_radio_t, esp32cam_sd_image_enabled),
+  COLUMN (tm_radio_t, esp32cam_wifi_image_enabled), COLUMN (tm_radio_t, gps_velocity_v), COLUMN (tm_radio_t, gps_velocity),
+  COLUMN (tm_radio_t, gps_height), COLUMN (tm_radio_t, camera_image_ctr), COLUMN (tm_radio_t, esp32_serial_connected),
+  COLUMN (tm_radio_t, esp32_wifi_connected), COLUMN (tm_radio_t, esp32_warn_serial_connloss),
+  COLUMN (tm_radio_t, esp32_warn_wifi_connloss), COLUMN (tm_radio_t, esp32_err_serial_dataloss),
+  COLUMN (tm_radio_t, esp32_err_yamcs_dataloss), COLUMN (tm_radio_t, esp32_err_fs_dataloss), COLUMN (tm_radio_t, separation_sts),
+  COLUMN (tm_radio_t, esp32cam_serial_connected), COLUMN (tm_radio_t, esp32cam_wifi_connected),
+  COLUMN (tm_radio_t, esp32cam_warn_serial_connloss), COLUMN (tm_radio_t, esp32cam_warn_wifi_connloss),
+  COLUMN (tm_radio_t, esp32cam_err_serial_dataloss), COLUMN (tm_radio_t, esp32cam_err_yamcs_dataloss),
+  COLUMN (tm_radio_t, esp32cam_err_fs_dataloss), COLUMN (tm_radio_t, esp32cam_err_sd_dataloss)
+};
+
+const column_t timer_esp32_columns[] = {
+  COLUMN (timer_esp32_t, packet_ctr), COLUMN (timer_esp32_t, radio_duration), COLUMN (timer_esp32_t, pressure_duration),
+  COLUMN (timer_esp32_t, motion_duration), COLUMN (timer_esp32_t, gps_duration), COLUMN (timer_esp32_t, esp32cam_duration),
+  COLUMN (timer_esp32_t, serial_duration), COLUMN (timer_esp32_t, ota_duration), COLUMN (timer_esp32_t, ftp_duration),
+  COLUMN (timer_esp32_t, wifi_duration), COLUMN (timer_esp32_t, tc_duration), COLUMN (timer_esp32_t, idle_duration),
+  COLUMN (timer_esp32_t, publish_fs_duration), COLUMN (timer_esp32_t, publish_serial_duration),
+  COLUMN (timer_esp32_t, publish_yamcs_duration), COLUMN (timer_esp32_t, publish_udp_duration),
+  COLUMN (timer_esp32_t, archive_staged), COLUMN (timer_esp32_t, archive_flushed), COLUMN (timer_esp32_t, archive_writes),
+  COLUMN (timer_esp32_t, sync_policy), COLUMN (timer_esp32_t, sync_count), COLUMN (timer_esp32_t, sync_latency),
+  COLUMN (timer_esp32_t, drain_rate), COLUMN (timer_esp32_t, drain_eta), COLUMN (timer_esp32_t, tx_dropped),
+  COLUMN (timer_esp32_t, tx_failed), COLUMN (timer_esp32_t, tx_throttled), COLUMN (timer_esp32_t, tx_latency),
+  COLUMN (timer_esp32_t, tx_enqueue), COLUMN (timer_esp32_t, tc_queued), COLUMN (timer_esp32_t, tc_dropped),
+  COLUMN (timer_esp32_t, tc_latency), COLUMN (timer_esp32_t, shape_yamcs), COLUMN (timer_esp32_t, shape_serial),
+  COLUMN (timer_esp32_t, shape_udp), COLUMN (timer_esp32_t, shape_pid)
+};
+
+const column_t timer_esp32cam_columns[] = {
+  COLUMN (timer_esp32cam_t, packet_ctr), COLUMN (timer_esp32cam_t, camera_duration), COLUMN (timer_esp32cam_t, serial_duration),
+  COLUMN (timer_esp32cam_t, tc_duration), COLUMN (timer_esp32cam_t, sd_duration), COLUMN (timer_esp32cam_t, ftp_duration),
+  COLUMN (timer_esp32cam_t, wifi_duration), COLUMN (timer_esp32cam_t, idle_duration),
+  COLUMN (timer_esp32cam_t, publish_sd_duration), COLUMN (timer_esp32cam_t, publish_fs_duration),
+  COLUMN (timer_esp32cam_t, publish_serial_duration), COLUMN (timer_esp32cam_t, publish_yamcs_duration),
+  COLUMN (timer_esp32cam_t, publish_udp_duration), COLUMN (timer_esp32cam_t, ota_duration),
+  COLUMN (timer_esp32cam_t, archive_staged), COLUMN (timer_esp32cam_t, archive_flushed),
+  COLUMN (timer_esp32cam_t, archive_writes), COLUMN (timer_esp32cam_t, sync_policy), COLUMN (timer_esp32cam_t, sync_count),
+  COLUMN (timer_esp32cam_t, sync_latency), COLUMN (timer_esp32cam_t, drain_rate), COLUMN (timer_esp32cam_t, drain_eta),
+  COLUMN (timer_esp32cam_t, tx_dropped), COLUMN (timer_esp32cam_t, tx_failed), COLUMN (timer_esp32cam_t, tx_throttled),
+  COLUMN (timer_esp32cam_t, tx_latency), COLUMN (timer_esp32cam_t, tx_enqueue), COLUMN (timer_esp32cam_t, tc_queued),
+  COLUMN (timer_esp32cam_t, tc_dropped), COLUMN (timer_esp32cam_t, tc_latency),
+  COLUMN (timer_esp32cam_t, shape_yamcs), COLUMN (timer_esp32cam_t, shape_serial), COLUMN (timer_esp32cam_t, shape_udp),
+  COLUMN (timer_esp32cam_t, shape_pid)
+};
+struct table_t {
+  const column_t* columns;
+  uint16_t    count;
+  uint16_t    size;                    // sizeof the packet struct
+};
+
+#define TABLE(name) { name##_columns, sizeof(name##_columns)/sizeof(column_t), sizeof(name##_t) }
+
+const table_t tables[TC_ESP32] = { // by PID; TC packets are not exported
+  TABLE (sts_esp32), TABLE (sts_esp32cam), TABLE (tm_esp32), TABLE (tm_esp32cam), TABLE (tm_camera), TABLE (tm_gps),
+  TABLE (tm_motion), TABLE (tm_pressure), TABLE (tm_radio), TABLE (timer_esp32), TABLE (timer_esp32cam)
+};
+
+struct output_t {
+  std::vector<FILE*> files;            // millis, then the columns of the table
+  uint64_t    rows;
+  uint32_t    millis_first;
+  uint32_t    millis_last;
+  uint32_t    raw_last;                // last 24-bit packet millis
+  uint32_t    epoch;                   // added to the packet millis for the wraps so far
+};
+
+std::string out_dir = "columns";
+output_t outputs[TC_ESP32];
+
+FILE* column_open (uint16_t PID, const char* name) {
+  std::string path = out_dir + "/" + pidName[PID] + "/" + name + ".col";
+  FILE* file = fopen (path.c_str (), "w");
+  if (file) {
+    setvbuf (file, NULL, _IOFBF, COLUMN_BUFFER_SIZE);
+  }
+  else {
+    fprintf (stderr, "Cannot create %s\n", path.c_str ());
+    exit (1);
+  }
+  return file;
+}
+
+void table_add (uint16_t PID, const uint8_t* packet, uint16_t len) {
+  static uint8_t padded[sizeof(ccsds_t)];
+  const table_t* table = &tables[PID];
+  output_t* output = &outputs[PID];
+  uint8_t value[sizeof(ccsds_t)];
+  uint32_t raw = get_ccsds_millis ((ccsds_t*)packet);
+  uint32_t millis;
+  if (output->files.empty ()) {
+    mkdir ((out_dir + "/" + pidName[PID]).c_str (), 0755);
+    output->files.push_back (column_open (PID, "millis"));
+    for (uint16_t c = 0; c < table->count; c++) {
+      output->files.push_back (column_open (PID, table->columns[c].name));
+    }
+    output->raw_last = raw;
+    output->epoch = 0;
+  }
+  if (len < table->size) {
+    // sts packets end after their message: do not read beyond the packet
+    memset (padded, 0, sizeof(padded));
+    memcpy (padded, packet, len);
+    packet = padded;
+  }
+  if (raw + 0x800000 < output->raw_last) {
+    // millis wrapped at 24 bits
+    output->epoch += 0x1000000;
+  }
+  output->raw_last = raw;
+  millis = output->epoch + raw;
+  if (!output->rows) {
+    output->millis_first = millis;
+  }
+  output->millis_last = millis;
+  output->rows++;
+  fwrite (&millis, sizeof(millis), 1, output->files[0]);
+  for (uint16_t c = 0; c < table->count; c++) {
+    table->columns[c].copy (packet, value);
+    fwrite (value, table->columns[c].width, 1, output->files[c + 1]);
+  }
+}
+
+bool write_index () {
+  // footer index, written once all column data is complete
+  FILE* file = fopen ((out_dir + "/index.json").c_str (), "w");
+  bool first_table = true;
+  if (!file) {
+    return false;
+  }
+  fprintf (file, "{\"tables\":[");
+  for (uint16_t PID = 0; PID < TC_ESP32; PID++) {
+    if (!outputs[PID].rows) {
+      continue;
+    }
+    fprintf (file, "%s\n {\"name\":\"%s\",\"apid\":%u,\"rows\":%lu,\"millis\":[%u,%u],\"columns\":[{\"name\":\"millis\",\"type\":\"u32\",\"width\":4}",
+             first_table?"":",", pidName[PID], PID + 42, (unsigned long)outputs[PID].rows, outputs[PID].millis_first, outputs[PID].millis_last);
+    for (uint16_t c = 0; c < tables[PID].count; c++) {
+      fprintf (file, ",{\"name\":\"%s\",\"type\":\"%s\",\"width\":%u}", tables[PID].columns[c].name, tables[PID].columns[c].type, tables[PID].columns[c].width);
+    }
+    fprintf (file, "]}");
+    first_table = false;
+  }
+  fprintf (file, "\n]}\n");
+  return !fclose (file);
+}
+
+int main (int argc, char** argv) {
+  std::vector<std::string> paths;
+  archive_map_t map;
+  cursor_t* cursor = new cursor_t;
+  uint16_t PID;
+  uint64_t packets = 0;
+  size_t skipped = 0;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:")) != -1) {
+    switch (opt) {
+    case 'o': out_dir = optarg;
+              break;
+    default:  fprintf (stderr, "usage: %s [-o directory] <segment|session directory>...\n", argv[0]);
+              return 1;
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    add_input (argv[i], &paths);
+  }
+  if (paths.empty ()) {
+    fprintf (stderr, "usage: %s [-o directory] <segment|session directory>...\n", argv[0]);
+    return 1;
+  }
+  if (mkdir (out_dir.c_str (), 0755) and errno != EEXIST) {
+    fprintf (stderr, "Cannot create %s\n", out_dir.c_str ());
+    return 1;
+  }
+  for (size_t i = 0; i < paths.size (); i++) {
+    if (!archive_map_open (&map, paths[i].c_str ())) {
+      fprintf (stderr, "Skipping %s: not a readable archive segment\n", paths[i].c_str ());
+      continue;
+    }
+    cursor_init (cursor, &map, 0, map.size);
+    while (cursor_next (cursor)) {
+      PID = cursor_pid (cursor);
+      if (PID < TC_ESP32 and ((const ccsds_hdr_t*)cursor->packet)->type == PKT_TM) {
+        table_add (PID, cursor->packet, cursor_len (cursor));
+        packets++;
+      }
+    }
+    skipped += cursor->skipped;
+    archive_map_close (&map);
+  }
+  for (PID = 0; PID < TC_ESP32; PID++) {
+    for (size_t f = 0; f < outputs[PID].files.size (); f++) {
+      if (fclose (outputs[PID].files[f])) {
+        fprintf (stderr, "Failed to write %s\n", pidName[PID]);
+        return 1;
+      }
+    }
+  }
+  if (!write_index ()) {
+    fprintf (stderr, "Cannot write %s/index.json\n", out_dir.c_str ());
+    return 1;
+  }
+  delete cursor;
+  fprintf (stderr, "Exported %lu packets from %zu segments to %s, skipped %zu corrupt bytes\n", (unsigned long)packets, paths.size (), out_dir.c_str (), skipped);
+  return 0;
+}
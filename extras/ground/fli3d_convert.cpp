@@ -0,0 +1,346 @@
+/*
+ * Fli3d - Ground tools (bulk archive converter, Linux)
+ *
+ * Converts the CCSDS archive segments of one or more sessions to JSON lines, or to one CSV file
+ * per packet type. Every packet goes through the library's own build_json_str, so field names and
+ * units are those of the live JSON telemetry; CSV columns are that JSON flattened ("accel":[x,y,z]
+ * becomes accel_0, accel_1, accel_2). Segments are split into ranges that are converted in parallel
+ * and written out in archive order.
+ *
+ * usage: fli3d_convert [-f json|csv] [-j threads] [-o prefix] <segment|session directory>...
+ */
+
+#include "fli3d_reader.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define RANGE_SIZE                (4*1024*1024) // bytes of archive per unit of work
+#define UNITS_AHEAD               4      // units per thread converted ahead of the writer at most
+#define JSON_MAX_SIZE             1024   // longest line build_json_str produces
+
+struct unit_t {
+  size_t      map;                     // index in maps
+  size_t      begin;
+  size_t      end;
+  bool        done;
+  size_t      packets;
+  size_t      skipped;
+  std::string out[NUMBER_OF_PID];      // JSON: all in out[0]; CSV: rows per PID
+};
+
+struct field_t {
+  std::string key;                     // flattened JSON key
+  const char* value;
+  uint16_t    len;
+  bool        quoted;                  // JSON string
+};
+
+struct column_t {
+  std::vector<std::string> names;      // flattened JSON keys, in build_json_str order
+};
+
+std::vector<archive_map_t> maps;
+std::vector<unit_t> units;
+column_t columns[NUMBER_OF_PID];
+bool csv = false;
+std::mutex unit_mutex;
+std::condition_variable unit_done;
+std::condition_variable unit_written;
+size_t units_written = 0;
+
+uint16_t flatten_json (const char* json, std::vector<field_t>* fields) {
+  // flatten the (shallow) JSON of build_json_str: nested objects become key_sub, arrays key_0, key_1, ...
+  // entries of fields are reused from row to row; values point into json
+  std::string prefix[4];
+  int index[4] = { -1, -1, -1, -1 };
+  uint8_t depth = 0;
+  uint16_t count = 0;
+  const char* name = NULL;
+  uint16_t name_len = 0;
+  char number[12];
+  const char* p = json;
+  const char* start;
+  field_t* field;
+  while (*p) {
+    switch (*p) {
+    case '{':
+    case '[': if (depth < 3) {
+                prefix[depth + 1] = prefix[depth];
+                if (depth and name) {
+                  prefix[depth + 1].append (name, name_len).push_back ('_');
+                }
+                index[depth + 1] = (*p == '[')?0:-1;
+                depth++;
+              }
+              name = NULL;
+              p++;
+              break;
+    case '}':
+    case ']': if (depth) {
+                depth--;
+              }
+              p++;
+              break;
+    case ',':
+    case ':': p++;
+              break;
+    default:  if (*p == '"' and index[depth] < 0 and !name) {
+                // key
+                name = ++p;
+                while (*p and *p != '"') {
+                  p++;
+                }
+                name_len = p - name;
+                if (*p) {
+                  p++;
+                }
+                break;
+              }
+              if (index[depth] >= 0) {
+                name_len = sprintf (number, "%d", index[depth]++);
+                name = number;
+              }
+              if (count == fields->size ()) {
+                fields->push_back (field_t ());
+              }
+              field = &(*fields)[count++];
+              field->key.assign (prefix[depth]).append (name?name:"", name?name_len:0);
+              field->quoted = (*p == '"');
+              if (field->quoted) {
+                // string value: ends at a quote followed by a separator (messages are not escaped)
+                start = ++p;
+                while (*p and !(*p == '"' and (p[1] == ',' or p[1] == '}' or p[1] == ']' or !p[1]))) {
+                  p++;
+                }
+                field->value = start;
+                field->len = p - start;
+                if (*p) {
+                  p++;
+                }
+              }
+              else {
+                start = p;
+                while (*p and *p != ',' and *p != '}' and *p != ']') {
+                  p++;
+                }
+                field->value = start;
+                field->len = p - start;
+              }
+              name = NULL;
+              break;
+    }
+  }
+  return count;
+}
+
+void csv_append (std::string* row, const field_t* field) {
+  // JSON strings become quoted CSV fields, with embedded quotes doubled
+  if (!field->quoted) {
+    row->append (field->value, field->len);
+    return;
+  }
+  row->push_back ('"');
+  for (uint16_t i = 0; i < field->len; i++) {
+    if (field->value[i] == '"') {
+      row->push_back ('"');
+    }
+    row->push_back (field->value[i]);
+  }
+  row->push_back ('"');
+}
+
+void csv_columns () {
+  // the columns of a packet type are the keys of its JSON with every optional field present
+  static uint8_t packet[sizeof(ccsds_t) + 64];
+  char json[JSON_MAX_SIZE];
+  std::vector<field_t> fields;
+  uint16_t count;
+  for (uint16_t PID = 0; PID < TC_ESP32; PID++) {
+    memset (packet, 0, sizeof(packet));
+    ((ccsds_hdr_t*)packet)->apid_H = (PID + 42) >> 8;
+    ((ccsds_hdr_t*)packet)->apid_L = (PID + 42) & 0xFF;
+    if (PID == TM_GPS) {
+      memset (packet + offsetof (tm_gps_t, milli_pdop) + 2, 0xFF, 2); // all *_valid flags
+    }
+    build_json_str (json, (ccsds_t*)packet);
+    count = flatten_json (json, &fields);
+    columns[PID].names.clear ();
+    for (uint16_t i = 0; i < count; i++) {
+      columns[PID].names.push_back (fields[i].key);
+    }
+  }
+}
+
+void convert_unit (unit_t* unit) {
+  cursor_t* cursor = new cursor_t;
+  char json[JSON_MAX_SIZE];
+  std::vector<field_t> fields;
+  uint16_t count;
+  uint16_t field;
+  std::string* out;
+  uint16_t PID;
+  cursor_init (cursor, &maps[unit->map], unit->begin, unit->end);
+  while (cursor_next (cursor)) {
+    PID = cursor_pid (cursor);
+    if (PID >= TC_ESP32 or ((const ccsds_hdr_t*)cursor->packet)->type != PKT_TM) {
+      // telemetry only (TC packets are logged for reference but have no fields to convert)
+      continue;
+    }
+    build_json_str (json, (ccsds_t*)cursor->packet);
+    unit->packets++;
+    if (!csv) {
+      unit->out[0].append (json);
+      unit->out[0].push_back ('\n');
+      continue;
+    }
+    count = flatten_json (json, &fields);
+    out = &unit->out[PID];
+    field = 0;
+    for (size_t c = 0; c < columns[PID].names.size (); c++) {
+      // fields come in column order, optional ones may be missing: their cells stay empty
+      if (c) {
+        out->push_back (',');
+      }
+      if (field < count and fields[field].key == columns[PID].names[c]) {
+        csv_append (out, &fields[field++]);
+      }
+    }
+    out->push_back ('\n');
+  }
+  unit->skipped = cursor->skipped;
+  delete cursor;
+}
+
+void worker (std::atomic<size_t>* next, size_t threads) {
+  size_t i;
+  while ((i = (*next)++) < units.size ()) {
+    {
+      // do not run too far ahead of the writer, to bound memory use
+      std::unique_lock<std::mutex> lock (unit_mutex);
+      unit_written.wait (lock, [&] { return i < units_written + UNITS_AHEAD * threads; });
+    }
+    convert_unit (&units[i]);
+    {
+      std::lock_guard<std::mutex> lock (unit_mutex);
+      units[i].done = true;
+    }
+    unit_done.notify_all ();
+  }
+}
+
+int main (int argc, char** argv) {
+  std::vector<std::string> paths;
+  std::vector<size_t> cuts;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next (0);
+  std::string prefix;
+  FILE* file[NUMBER_OF_PID] = { NULL };
+  size_t threads = std::thread::hardware_concurrency ();
+  size_t packets = 0;
+  size_t skipped = 0;
+  int opt;
+  while ((opt = getopt (argc, argv, "f:j:o:")) != -1) {
+    switch (opt) {
+    case 'f': csv = !strcmp (optarg, "csv");
+              break;
+    case 'j': threads = atoi (optarg);
+              break;
+    case 'o': prefix = optarg;
+              break;
+    default:  fprintf (stderr, "usage: %s [-f json|csv] [-j threads] [-o prefix] <segment|session directory>...\n", argv[0]);
+              return 1;
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    add_input (argv[i], &paths);
+  }
+  if (paths.empty ()) {
+    fprintf (stderr, "usage: %s [-f json|csv] [-j threads] [-o prefix] <segment|session directory>...\n", argv[0]);
+    return 1;
+  }
+  if (!threads) {
+    threads = 1;
+  }
+  if (prefix.empty ()) {
+    prefix = paths[0].substr (paths[0].rfind ('/') + 1);
+    prefix = prefix.substr (0, prefix.rfind ('.'));
+  }
+  maps.resize (paths.size ());
+  for (size_t i = 0; i < paths.size (); i++) {
+    if (!archive_map_open (&maps[i], paths[i].c_str ())) {
+      fprintf (stderr, "Skipping %s: not a readable archive segment\n", paths[i].c_str ());
+      continue;
+    }
+    archive_ranges (&maps[i], RANGE_SIZE, &cuts);
+    for (size_t c = 0; c + 1 < cuts.size (); c++) {
+      units.push_back (unit_t ());
+      units.back ().map = i;
+      units.back ().begin = cuts[c];
+      units.back ().end = cuts[c + 1];
+      units.back ().done = false;
+      units.back ().packets = 0;
+      units.back ().skipped = 0;
+    }
+  }
+  if (csv) {
+    csv_columns ();
+  }
+  else {
+    file[0] = fopen ((prefix + ".json").c_str (), "w");
+  }
+  for (size_t t = 0; t < threads; t++) {
+    workers.push_back (std::thread (worker, &next, threads));
+  }
+  for (size_t i = 0; i < units.size (); i++) {
+    {
+      std::unique_lock<std::mutex> lock (unit_mutex);
+      unit_done.wait (lock, [&] { return units[i].done; });
+    }
+    for (uint16_t PID = 0; PID < NUMBER_OF_PID; PID++) {
+      if (units[i].out[PID].empty ()) {
+        continue;
+      }
+      if (!file[PID]) {
+        file[PID] = fopen ((prefix + "_" + pidName[PID] + ".csv").c_str (), "w");
+        for (size_t c = 0; file[PID] and c < columns[PID].names.size (); c++) {
+          fprintf (file[PID], c?",%s":"%s", columns[PID].names[c].c_str ());
+        }
+        if (file[PID]) {
+          fputc ('\n', file[PID]);
+        }
+      }
+      if (!file[PID]) {
+        fprintf (stderr, "Cannot write output for %s\n", pidName[PID]);
+        return 1;
+      }
+      fwrite (units[i].out[PID].data (), 1, units[i].out[PID].size (), file[PID]);
+      std::string ().swap (units[i].out[PID]);
+    }
+    packets += units[i].packets;
+    skipped += units[i].skipped;
+    {
+      std::lock_guard<std::mutex> lock (unit_mutex);
+      units_written = i + 1;
+    }
+    unit_written.notify_all ();
+  }
+  for (size_t t = 0; t < threads; t++) {
+    workers[t].join ();
+  }
+  for (uint16_t PID = 0; PID < NUMBER_OF_PID; PID++) {
+    if (file[PID]) {
+      fclose (file[PID]);
+    }
+  }
+  for (size_t i = 0; i < maps.size (); i++) {
+    archive_map_close (&maps[i]);
+  }
+  fprintf (stderr, "Converted %zu packets from %zu segments (%zu ranges, %zu threads), skipped %zu corrupt bytes\n",
+           packets, paths.size (), units.size (), threads, skipped);
+  return 0;
+}
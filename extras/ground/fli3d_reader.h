@@ -0,0 +1,241 @@
+/*
+ * Fli3d - Ground tools (memory-mapped archive reader, Linux)
+ *
+ * An archive segment (.ccsds, or .ccsdx with compression and/or framing) is mapped read-only and
+ * iterated packet by packet. Raw records are returned in place, so a packet is a typed view straight
+ * into the mapping (no copy); only delta-coded records are decoded into the cursor's own buffer.
+ * Segments can be cut into independent ranges (at .idx entries, or by hopping headers in raw
+ * archives), so that several threads can work on one large recording.
+ */
+
+#ifndef _FLI3D_READER_H_
+#define _FLI3D_READER_H_
+
+#include <fli3d_packets.h>
+#include <fli3d_archive.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct archive_map_t {
+  const uint8_t* data;
+  size_t      size;
+  size_t      body;                    // offset of the first record (after the archive header of a .ccsdx)
+  bool        compressed;
+  bool        framed;
+  std::string path;
+};
+
+struct cursor_t {
+  const archive_map_t* map;
+  size_t      offset;                  // offset of the next record
+  size_t      end;                     // offset where this range stops
+  size_t      skipped;                 // bytes skipped over corrupt or torn records
+  const uint8_t* packet;               // current packet: into the mapping, or into decoded
+  codec_t     codec;
+  uint8_t     decoded[ARCHIVE_PACKET_MAX_SIZE];
+};
+
+inline void archive_map_close (archive_map_t* map) {
+  if (map->data) {
+    munmap ((void*)map->data, map->size);
+  }
+  map->data = NULL;
+  map->size = 0;
+}
+
+inline bool archive_map_open (archive_map_t* map, const char* path) {
+  struct stat st;
+  const char* extension = strrchr (path, '.');
+  int fd = open (path, O_RDONLY);
+  map->data = NULL;
+  map->size = 0;
+  map->body = 0;
+  map->compressed = false;
+  map->framed = false;
+  map->path = path;
+  if (fd < 0 or fstat (fd, &st)) {
+    if (fd >= 0) {
+      close (fd);
+    }
+    return false;
+  }
+  map->size = st.st_size;
+  if (map->size) {
+    void* data = mmap (NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close (fd);
+      return false;
+    }
+    madvise (data, map->size, MADV_SEQUENTIAL);
+    map->data = (const uint8_t*)data;
+  }
+  close (fd);
+  if (extension and !strcmp (extension, ".ccsdx")) {
+    if (!archive_hdr_valid (map->data, map->size)) {
+      archive_map_close (map);
+      return false;
+    }
+    map->compressed = ((const archive_hdr_t*)map->data)->flags & ARCHIVE_FLAG_DELTA;
+    map->framed = ((const archive_hdr_t*)map->data)->flags & ARCHIVE_FLAG_FRAMED;
+    map->body = sizeof(archive_hdr_t);
+  }
+  return true;
+}
+
+inline std::string archive_index_path (const std::string& path) {
+  return path.substr (0, path.rfind ('.')) + ".idx";
+}
+
+inline void cursor_init (cursor_t* cursor, const archive_map_t* map, size_t begin, size_t end) {
+  // begin must be the start of a record at which delta coding restarts (segment start or .idx entry)
+  cursor->map = map;
+  cursor->offset = (begin < map->body)?map->body:begin;
+  cursor->end = (end > map->size)?map->size:end;
+  cursor->skipped = 0;
+  cursor->packet = NULL;
+  archive_codec_reset (&cursor->codec);
+}
+
+inline bool cursor_next (cursor_t* cursor) {
+  // advance to the next packet of the range; false when the range is done
+  const archive_map_t* map = cursor->map;
+  const uint8_t* record;
+  uint16_t len;
+  uint16_t record_len;
+  int16_t frame_len = 0;
+  int16_t consumed;
+  while (cursor->offset < cursor->end) {
+    record = map->data + cursor->offset;
+    len = (map->size - cursor->offset < ARCHIVE_FRAME_MAX_SIZE)?(map->size - cursor->offset):ARCHIVE_FRAME_MAX_SIZE;
+    if (map->framed) {
+      frame_len = archive_unframe (record, len, &record_len);
+      if (frame_len <= 0) {
+        // no (complete) frame here: resynchronise on the next sync marker; delta records cannot
+        // be decoded against a lost predecessor, so the codec waits for the next raw record
+        archive_codec_reset (&cursor->codec);
+        cursor->offset++;
+        cursor->skipped++;
+        continue;
+      }
+      cursor->offset += frame_len;
+      record += 4;
+      len = record_len;
+    }
+    if (map->compressed) {
+      consumed = archive_decode (&cursor->codec, record, len, cursor->decoded);
+      cursor->packet = (record[0] == ARCHIVE_TAG_RAW)?record + 1:cursor->decoded;
+    }
+    else if (len < 6 or archive_packet_len (record) > len) {
+      consumed = 0;
+    }
+    else {
+      consumed = archive_packet_len (record);
+      cursor->packet = record;
+    }
+    if (map->framed) {
+      if (consumed != record_len) {
+        archive_codec_reset (&cursor->codec);
+        cursor->skipped += frame_len;
+        continue;
+      }
+      return true;
+    }
+    if (consumed <= 0) {
+      // torn record at the end, or corruption that cannot be skipped without framing
+      cursor->skipped += cursor->end - cursor->offset;
+      cursor->offset = cursor->end;
+      return false;
+    }
+    cursor->offset += consumed;
+    return true;
+  }
+  return false;
+}
+
+inline uint16_t cursor_pid (const cursor_t* cursor) {
+  return get_ccsds_apid ((ccsds_t*)cursor->packet) - 42;
+}
+
+inline uint16_t cursor_len (const cursor_t* cursor) {
+  return get_ccsds_packet_len ((ccsds_t*)cursor->packet);
+}
+
+template <typename T> inline const T* cursor_view (const cursor_t* cursor, uint16_t PID) {
+  // typed view of the current packet, e.g. cursor_view<tm_motion_t> (&cursor, TM_MOTION); NULL if it is another packet
+  // (sts and tc packets are shorter than their struct: only use their fields up to cursor_len)
+  if (cursor_pid (cursor) != PID or (PID != STS_ESP32 and PID != STS_ESP32CAM and PID != TC_ESP32 and PID != TC_ESP32CAM and cursor_len (cursor) < sizeof(T))) {
+    return NULL;
+  }
+  return (const T*)cursor->packet;
+}
+
+inline void archive_ranges (const archive_map_t* map, size_t range_size, std::vector<size_t>* cuts) {
+  // cut a segment into ranges of about range_size bytes that can be read independently;
+  // cuts holds the range starts, followed by the end of the segment
+  archive_map_t index;
+  size_t offset;
+  uint16_t record_len;
+  int16_t frame_len;
+  cuts->clear ();
+  cuts->push_back (map->body);
+  if (archive_map_open (&index, archive_index_path (map->path).c_str ())) {
+    // delta coding restarts at every index entry
+    for (size_t i = 0; i + sizeof(index_entry_t) <= index.size; i += sizeof(index_entry_t)) {
+      offset = ((const index_entry_t*)(index.data + i))->offset;
+      if (offset > cuts->back () and offset < map->size and offset - cuts->back () >= range_size) {
+        cuts->push_back (offset);
+      }
+    }
+    archive_map_close (&index);
+  }
+  else if (!map->compressed) {
+    // hop over the headers to find record boundaries
+    offset = map->body;
+    while (offset + 6 <= map->size) {
+      if (map->framed) {
+        frame_len = archive_unframe (map->data + offset, (map->size - offset < ARCHIVE_FRAME_MAX_SIZE)?(map->size - offset):ARCHIVE_FRAME_MAX_SIZE, &record_len);
+        if (frame_len <= 0) {
+          break;
+        }
+        offset += frame_len;
+      }
+      else {
+        offset += archive_packet_len (map->data + offset);
+      }
+      if (offset < map->size and offset - cuts->back () >= range_size) {
+        cuts->push_back (offset);
+      }
+    }
+  }
+  cuts->push_back (map->size);
+}
+
+inline void add_input (const char* path, std::vector<std::string>* paths) {
+  // a segment, or a session directory (all its segments, in segment order)
+  DIR* dir = opendir (path);
+  struct dirent* entry;
+  std::vector<std::string> segments;
+  const char* extension;
+  if (!dir) {
+    paths->push_back (path);
+    return;
+  }
+  while ((entry = readdir (dir))) {
+    extension = strrchr (entry->d_name, '.');
+    if (extension and (!strcmp (extension, ".ccsds") or !strcmp (extension, ".ccsdx"))) {
+      segments.push_back (std::string (path) + "/" + entry->d_name);
+    }
+  }
+  closedir (dir);
+  std::sort (segments.begin (), segments.end ());
+  paths->insert (paths->end (), segments.begin (), segments.end ());
+}
+
+#endif // _FLI3D_READER_H_
@@ -0,0 +1,108 @@
+/*
+ * Fli3d - Ground tools (Yamcs datagram unpacker, Linux)
+ *
+ * With yamcs_mtu set, the library packs several CCSDS packets back to back into one UDP datagram.
+ * Yamcs' UDP TM link takes one packet per datagram, so this relay sits in between: it receives the
+ * packed datagrams and forwards every CCSDS packet in them as a datagram of its own. Unpacked
+ * (one-packet) datagrams pass through unchanged. Every interval, it reports datagrams and packets
+ * per second, i.e. the reduction in datagrams on the air.
+ *
+ * usage: fli3d_unpack [-l listen port] [-i report interval s] <yamcs host> <yamcs tm port>
+ */
+
+#include <fli3d_packets.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATAGRAM_MAX_SIZE         65536
+
+double now () {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main (int argc, char** argv) {
+  static uint8_t datagram[DATAGRAM_MAX_SIZE];
+  struct sockaddr_in listen_addr;
+  struct addrinfo hints;
+  struct addrinfo* yamcs;
+  uint16_t listen_port = 10015;
+  double interval = 10;
+  double report_time;
+  double elapsed;
+  size_t datagrams = 0;
+  size_t packets = 0;
+  size_t dropped = 0;
+  ssize_t size;
+  ssize_t offset;
+  uint16_t len;
+  int in;
+  int out;
+  int opt;
+  while ((opt = getopt (argc, argv, "l:i:")) != -1) {
+    switch (opt) {
+    case 'l': listen_port = atoi (optarg);
+              break;
+    case 'i': interval = atof (optarg);
+              break;
+    default:  fprintf (stderr, "usage: %s [-l listen port] [-i report interval s] <yamcs host> <yamcs tm port>\n", argv[0]);
+              return 1;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf (stderr, "usage: %s [-l listen port] [-i report interval s] <yamcs host> <yamcs tm port>\n", argv[0]);
+    return 1;
+  }
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo (argv[optind], argv[optind + 1], &hints, &yamcs)) {
+    fprintf (stderr, "Cannot resolve %s:%s\n", argv[optind], argv[optind + 1]);
+    return 1;
+  }
+  in = socket (AF_INET, SOCK_DGRAM, 0);
+  out = socket (AF_INET, SOCK_DGRAM, 0);
+  memset (&listen_addr, 0, sizeof(listen_addr));
+  listen_addr.sin_family = AF_INET;
+  listen_addr.sin_addr.s_addr = htonl (INADDR_ANY);
+  listen_addr.sin_port = htons (listen_port);
+  if (in < 0 or out < 0 or bind (in, (struct sockaddr*)&listen_addr, sizeof(listen_addr))) {
+    fprintf (stderr, "Cannot listen on UDP port %u\n", listen_port);
+    return 1;
+  }
+  fprintf (stderr, "Unpacking datagrams from UDP port %u to %s:%s\n", listen_port, argv[optind], argv[optind + 1]);
+  report_time = now ();
+  while ((size = recv (in, datagram, sizeof(datagram), 0)) >= 0) {
+    datagrams++;
+    offset = 0;
+    while (size - offset >= (ssize_t)sizeof(ccsds_hdr_t)) {
+      len = get_ccsds_packet_len ((ccsds_t*)(datagram + offset));
+      if (len > size - offset) {
+        // truncated packet: nothing after it can be trusted
+        break;
+      }
+      sendto (out, datagram + offset, len, 0, yamcs->ai_addr, yamcs->ai_addrlen);
+      packets++;
+      offset += len;
+    }
+    dropped += size - offset;
+    elapsed = now () - report_time;
+    if (elapsed >= interval) {
+      fprintf (stderr, "%.1f datagrams/s in, %.1f packets/s out (%.1f packets per datagram), %zu bytes dropped\n",
+               datagrams / elapsed, packets / elapsed, (double)packets / datagrams, dropped);
+      datagrams = 0;
+      packets = 0;
+      report_time += elapsed;
+    }
+  }
+  freeaddrinfo (yamcs);
+  return 0;
+}
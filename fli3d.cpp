@@ -7,6 +7,7 @@
 #include <fli3d.h>
 #include <fli3d_secrets.h>
 #include <Arduino.h>
+#include <unistd.h>
 #ifdef PLATFORM_ESP32CAM
 #include <SD_MMC.h>
 #include <SPI.h>
@@ -15,6 +16,7 @@
 //SerialTransfer serialTransfer;
 WiFiUDP wifiUDP;
 WiFiUDP wifiUDP_NTP;
+WiFiUDP wifiUDP_tx;                   // used by the transmit task only
 #ifdef ASYNCUDP
 AsyncUDP asyncUDP_yamcs_tc;
 #else
@@ -22,17 +24,51 @@ WiFiUDP wifiUDP_yamcs_tc;
 #endif
 FtpServer wifiTCP_FTP;
 NTPClient timeClient(wifiUDP_NTP, config_network.ntp_server, 0);
-File file_ccsds;
-File file_json;
-buffer_t ccsds_archive;
+writer_t writers[NUMBER_OF_WRITERS] = { { FS_LITTLEFS, ENC_CCSDS, "/nodate" },
+                                        #ifdef PLATFORM_ESP32CAM
+                                        { FS_SD_MMC, ENC_CCSDS, "/nodate" },
+                                        { FS_SD_MMC, ENC_JSON, "/nodate" }
+                                        #endif
+                                      };
+fs_space_t fs_space[3];               // by filesystem (FS_NONE unused)
 ccsds_t replayed_ccsds;
 UnixTime datetime(0);
 char buffer[BUFFER_MAX_SIZE];
 char serial_in_buffer[BUFFER_MAX_SIZE];
-char ccsds_path_buffer[38] = "/nodate.ccsds";
-char json_path_buffer[38] = "/nodate.json";
 char lock_filename[32] = "/opsmode.lock";
 char today_dir[16] = "/";
+uint8_t archive_record[ARCHIVE_RECORD_MAX_SIZE];
+datagram_t yamcs_datagram;
+RingbufHandle_t tx_queue = NULL;
+tx_server_t tx_server[2];
+portMUX_TYPE tx_mux = portMUX_INITIALIZER_UNLOCKED;
+tx_stats_t tx_stats;
+wifi_sta_t wifi_sta = { WIFI_STA_IDLE, 0, false, 0, 0, WIFI_BACKOFF_MIN };
+wifi_ap_t wifi_scan[NUMBER_OF_WIFI + 1];
+wifi_cache_t wifi_cache;
+#ifdef ASYNCUDP
+tc_pool_t tc_pool;
+#endif
+uint32_t tc_latency_max = 0;          // us from receipt to execution of a command, since the last timer packet
+File store_file;
+File store_read_file;
+reader_t store_reader;
+uint8_t store_read_segment = STORE_SEGMENTS;
+store_state_t store_state;
+store_index_t store_index;
+store_last_t store_last;
+drain_t drain = { 0, DRAIN_RATE_MIN, 0, 0, 0 };
+uint8_t store_fs = FS_NONE;
+uint8_t store_attempted_fs = FS_NONE;
+uint8_t store_request = 0;
+uint8_t store_release = 0;
+uint32_t store_sync_millis = 0;
+bool store_dirty = false;
+File replay_file;
+reader_t replay_reader;
+codec_t replay_codec;
+replay_t replay;
+uint8_t replay_packet[ARCHIVE_PACKET_MAX_SIZE];
 
 #ifdef PLATFORM_ESP32
 extern void ota_setup ();
@@ -88,24 +124,22 @@ timer_esp32_t       *timer_other = &timer_esp32;
 config_esp32cam_t   *config_this = &config_esp32cam;
 #endif
 
-const char pidName[NUMBER_OF_PID][15] =   { "sts_esp32", "sts_esp32cam", "tm_esp32", "tm_esp32cam", "tm_camera", "tm_gps", "tm_motion", "tm_pressure", "tm_radio", "timer_esp32", "timer_esp32cam", "tc_esp32", "tc_esp32cam" };
-const char eventName[8][9] =              { "init", "info", "warning", "error", "cmd", "cmd_ack", "cmd_resp", "cmd_fail" };
-const char subsystemName[13][14] =        { "esp32", "esp32cam", "ov2640", "neo6mv2", "mpuXX50", "bmp280", "radio", "sd", "separation", "timer", "fli3d", "ground", "any" };
-const char modeName[4][12] =              { "init", "checkout", "nominal", "maintenance" };
-const char stateName[4][10] =             { "static", "thrust", "freefall", "parachute" };
-const char cameraModeName[4][7] =         { "init", "idle", "single", "stream" };
-const char cameraResolutionName[11][10] = { "160x120", "invalid1", "invalid2", "240x176", "320x240", "400x300", "640x480", "800x600", "1024x768", "1280x1024", "1600x1200" };
 const char dataEncodingName[3][8] =       { "CCSDS", "JSON", "ASCII" };
 
 const char commLineName[9][13] =          { "serial", "wifi_udp", "wifi_yamcs", "wifi_cam", "sd_ccsds", "sd_json", "sd_cam", "fs", "radio" };
-const char tcName[6][20] =                { "reboot", "set_opsmode", "load_config", "load_routing", "set_parameter", "freeze_opsmode" };
-const char gpsStatusName[9][11] =         { "none", "est", "time_only", "std", "dgps", "rtk_float", "rtk_fixed", "status_pps", "waiting" }; 
 const char dhtName[5][7] =                { "AUTO", "DHT11", "DHT22", "AM2302", "RHT03" }; 
 const char fsName[3][5] =                 { "none", "FS", "SD" };
+const char sinkName[NUMBER_OF_SINKS][7] = { "yamcs", "serial" };
+const char priorityName[NUMBER_OF_PRIORITIES][13] = { "event", "housekeeping", "science" };
+const char shaperName[NUMBER_OF_SHAPERS][7] = { "yamcs", "serial", "udp" };
+const char routeName[NUMBER_OF_ROUTES][9] = { "yamcs", "serial", "udp", "fs", "sd_json", "sd_ccsds" };
 char routing_serial[NUMBER_OF_PID];
 char routing_udp[NUMBER_OF_PID];
 char routing_yamcs[NUMBER_OF_PID];
 char routing_fs[NUMBER_OF_PID];
+char routing_priority[NUMBER_OF_PID];
+shaper_t shaper[NUMBER_OF_SHAPERS][NUMBER_OF_PID];
+decimation_t decimation[NUMBER_OF_ROUTES][NUMBER_OF_PID];
 #ifdef PLATFORM_ESP32CAM
 char routing_sd_json[NUMBER_OF_PID];
 char routing_sd_ccsds[NUMBER_OF_PID];
@@ -116,27 +150,38 @@ char routing_sd_ccsds[NUMBER_OF_PID];
 bool fs_setup () {
   #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
   if (LITTLEFS.begin(false)) {
+    fs_space_sync (FS_LITTLEFS);
     sprintf (buffer, "Initialized FS (size: %u kB; free: %u kB)", LITTLEFS.totalBytes()/1024, fs_free());
   #else
   if (LittleFS.begin(false)) {
+    fs_space_sync (FS_LITTLEFS);
     sprintf (buffer, "Initialized FS (size: %u kB; free: %u kB)", LittleFS.totalBytes()/1024, fs_free());
   #endif 
     tm_this->fs_enabled = true;
     tm_this->fs_active = true;
     publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+    archive_recover_mount (FS_LITTLEFS);
+    if (config_this->buffer_fs == FS_LITTLEFS) {
+      store_setup (FS_LITTLEFS); // drain TM buffered before the reboot
+    }
     return true;
   }
   else {
     #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
     if (LITTLEFS.begin(true)) {
+      fs_space_sync (FS_LITTLEFS);
       sprintf (buffer, "Formatted and initialized FS (size: %d kB; free: %d kB)", LITTLEFS.totalBytes()/1024, fs_free());
     #else
     if (LittleFS.begin(true)) {
+      fs_space_sync (FS_LITTLEFS);
       sprintf (buffer, "Formatted and initialized FS (size: %d kB; free: %d kB)", LittleFS.totalBytes()/1024, fs_free());
     #endif
       tm_this->fs_enabled = true;
       tm_this->fs_active = true;
       publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+      if (config_this->buffer_fs == FS_LITTLEFS) {
+        store_setup (FS_LITTLEFS);
+      }
       return true;
     }
     else {
@@ -154,6 +199,7 @@ bool fs_flush_data () {
   #ifdef PLATFORM_ESP32CAM
   if (true) { // TODO: add viable inhibit for ESP32CAM
   #endif
+    close_files (FS_LITTLEFS);
     #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
     File dir = LITTLEFS.open ("/");
     #else
@@ -163,7 +209,7 @@ bool fs_flush_data () {
     char local_path_buffer[32];
     char path_buffer[32];
     while (file) {
-      if (file.isDirectory()) {
+      if (file.isDirectory() and strcmp (file.name(), STORE_DIR) and strcmp (file.name(), STORE_DIR + 1)) { // TM buffer store manages its own space
         sprintf (path_buffer, "%s", file.name());
         file.close ();
         #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
@@ -190,6 +236,7 @@ bool fs_flush_data () {
       }
       file = dir.openNextFile ();
     }
+    fs_space_sync (FS_LITTLEFS);
     tm_this->fs_enabled = true; // needed to have next message stored
     publish_event (STS_THIS, SS_THIS, EVENT_WARNING, "Deleted all data files since FS is full");
     return true;
@@ -202,10 +249,10 @@ bool fs_flush_data () {
 
 void create_today_dir (uint8_t filesystem) {
   char today_tag[14];
+  char new_base[30];
   char sequencer1 = 'A';
   char sequencer2 = 'A';
-  sync_file_ccsds ();
-  sync_file_json ();
+  close_files (filesystem);
   #ifdef PLATFORM_ESP32  
   #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
   while (!strcmp(today_dir, "/") or (filesystem == FS_LITTLEFS and LITTLEFS.exists(today_dir))) {
@@ -228,73 +275,284 @@ void create_today_dir (uint8_t filesystem) {
     }
     sprintf (today_dir, "/%s", today_tag);
   }
-  if (filesystem == FS_LITTLEFS) {
-  #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
-    LITTLEFS.mkdir(today_dir);
-    if (LITTLEFS.exists("/nodate.ccsds")) {
-      sprintf (ccsds_path_buffer, "%s/%s.ccsds", today_dir, today_tag);
-      LITTLEFS.rename ("/nodate.ccsds", ccsds_path_buffer);
-    }  
-    if (LITTLEFS.exists("/nodate.json")) {
-      sprintf (json_path_buffer, "%s/%s.json", today_dir, today_tag);
-      LITTLEFS.rename ("/nodate.json", json_path_buffer);
+  get_fs (filesystem)->mkdir (today_dir);
+  sprintf (new_base, "%s%s", today_dir, today_dir); // e.g. /240813AA/240813AA
+  archive_rename (filesystem, new_base);
+  sprintf (buffer, "Created storage directory %s on %s for current session, and moved current log files to it", today_dir, fsName[filesystem]);
+  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+  tm_this->fs_active = true;
+}
+
+void archive_path (char* path, const char* base, uint16_t segment, const char* extension) {
+  if (segment) {
+    sprintf (path, "%s_%03u.%s", base, segment, extension);
+  }
+  else {
+    sprintf (path, "%s.%s", base, extension);
+  }
+}
+
+void archive_rename (uint8_t filesystem, const char* new_base) {
+  // move all archive segments of this session on filesystem to a new base path (their writers are closed)
+  const char extensions[4][6] = { "ccsds", "ccsdx", "idx", "json" };
+  FS* fs = get_fs (filesystem);
+  writer_t* writer;
+  char old_path[38];
+  char new_path[38];
+  for (uint8_t w = 0; w < NUMBER_OF_WRITERS; w++) {
+    writer = &writers[w];
+    if (writer->filesystem != filesystem) {
+      continue;
+    }
+    for (uint16_t segment = 0; segment <= writer->segment; segment++) {
+      for (uint8_t e = (writer->encoding == ENC_JSON)?3:0; e < ((writer->encoding == ENC_JSON)?4:3); e++) {
+        archive_path (old_path, writer->base, segment, extensions[e]);
+        archive_path (new_path, new_base, segment, extensions[e]);
+        if (fs->exists (old_path)) {
+          fs->rename (old_path, new_path);
+        }
+      }
     }
+    strcpy (writer->base, new_base);
+    archive_path (writer->path, writer->base, writer->segment, (writer->encoding == ENC_JSON)?"json":ccsds_extension ());
   }
-  #else
-    LittleFS.mkdir(today_dir);
-    if (LittleFS.exists("/nodate.ccsds")) {
-      sprintf (ccsds_path_buffer, "%s/%s.ccsds", today_dir, today_tag);
-      LittleFS.rename ("/nodate.ccsds", ccsds_path_buffer);
-    }  
-    if (LittleFS.exists("/nodate.json")) {
-      sprintf (json_path_buffer, "%s/%s.json", today_dir, today_tag);
-      LittleFS.rename ("/nodate.json", json_path_buffer);
+}
+
+const char* ccsds_extension () {
+  return ((config_this->fs_compress or config_this->fs_framing)?"ccsdx":"ccsds");
+}
+
+const char* fs_basename (const char* path) {
+  const char* name = strrchr (path, '/');
+  return (name?name+1:path);
+}
+
+bool fs_evictable (uint8_t filesystem, const char* path) {
+  // archive segments that are not currently being written or replayed
+  const char* extension = strrchr (path, '.');
+  if (!extension or (strcmp (extension, ".ccsds") and strcmp (extension, ".ccsdx") and strcmp (extension, ".idx") and strcmp (extension, ".json"))) {
+    return false;
+  }
+  for (uint8_t w = 0; w < NUMBER_OF_WRITERS; w++) {
+    if (writers[w].filesystem == filesystem and (!strcmp (path, writers[w].path) or !strcmp (path, writers[w].index_path))) {
+      return false;
     }
   }
-  #endif
-  #ifdef PLATFORM_ESP32CAM 
-  else if (filesystem == FS_SD_MMC) {
-    SD_MMC.mkdir(today_dir);
-    if (SD_MMC.exists("/nodate.ccsds")) {
-      sprintf (ccsds_path_buffer, "%s/%s.ccsds", today_dir, today_tag);
-      SD_MMC.rename ("/nodate.ccsds", ccsds_path_buffer);
-    }  
-    if (SD_MMC.exists("/nodate.json")) {
-      sprintf (json_path_buffer, "%s/%s.json", today_dir, today_tag);
-      SD_MMC.rename ("/nodate.json", json_path_buffer);
+  if (replay_file and replay.fs == filesystem and !strcmp (path, replay.path)) {
+    return false;
+  }
+  return true;
+}
+
+bool fs_evict (uint8_t filesystem) {
+  // remove the oldest archive segment (or empty session directory) on the filesystem; when there was nothing
+  // to remove, the tree is walked again only after FS_EVICT_BACKOFF, or once a writer closed a segment
+  FS* fs = get_fs (filesystem);
+  File root;
+  File entry;
+  File file;
+  char dir_path[32];
+  char path[40];
+  char oldest_path[40] = "";
+  char empty_dir[32] = "";
+  uint32_t oldest_size = 0;
+  bool empty;
+  if (fs_space[filesystem].evict_idle and millis() - fs_space[filesystem].evict_millis < FS_EVICT_BACKOFF) {
+    return false;
+  }
+  if (!fs or !(root = fs->open ("/"))) {
+    return false;
+  }
+  entry = root.openNextFile ();
+  while (entry) {
+    if (entry.isDirectory ()) {
+      sprintf (dir_path, "/%s", fs_basename (entry.name()));
+      #ifdef PLATFORM_ESP32
+      if (strcmp (dir_path, STORE_DIR) and !(esp32.separation_sts and !strcmp (dir_path, today_dir))) { // protect current session after separation
+      #else
+      if (strcmp (dir_path, STORE_DIR)) {
+      #endif
+        empty = true;
+        file = entry.openNextFile ();
+        while (file) {
+          empty = false;
+          sprintf (path, "%s/%s", dir_path, fs_basename (file.name()));
+          if (fs_evictable (filesystem, path) and (!oldest_path[0] or strcmp (path, oldest_path) < 0)) {
+            strcpy (oldest_path, path);
+            oldest_size = file.size ();
+          }
+          file = entry.openNextFile ();
+        }
+        if (empty and strcmp (dir_path, today_dir)) {
+          strcpy (empty_dir, dir_path);
+        }
+      }
+    }
+    else {
+      sprintf (path, "/%s", fs_basename (entry.name()));
+      if (fs_evictable (filesystem, path) and (!oldest_path[0] or strcmp (path, oldest_path) < 0)) {
+        strcpy (oldest_path, path);
+        oldest_size = entry.size ();
+      }
+    }
+    entry = root.openNextFile ();
+  }
+  root.close ();
+  fs_space[filesystem].evict_idle = false;
+  if (empty_dir[0] and fs->rmdir (empty_dir)) {
+    return true;
+  }
+  if (oldest_path[0] and fs->remove (oldest_path)) {
+    fs_space_add (filesystem, -(int32_t)oldest_size);
+    sprintf (buffer, "Evicted %s from %s to keep %u kB free", oldest_path, fsName[filesystem], config_this->fs_reserve);
+    publish_event (STS_THIS, SS_THIS, EVENT_INFO, buffer);
+    return true;
+  }
+  fs_space[filesystem].evict_idle = true;
+  fs_space[filesystem].evict_millis = millis();
+  return false;
+}
+
+void fs_check () {
+  // time-sliced background eviction: at most one segment per filesystem per FS_EVICT_INTERVAL;
+  // the free space estimate is re-synced with the file systems every FS_SPACE_SYNC_INTERVAL
+  static uint32_t last_evict_millis = 0;
+  if (millis() - last_evict_millis < FS_EVICT_INTERVAL) {
+    return;
+  }
+  last_evict_millis = millis();
+  for (uint8_t filesystem = FS_LITTLEFS; filesystem <= FS_SD_MMC; filesystem++) {
+    if (fs_space[filesystem].total and millis() - fs_space[filesystem].sync_millis >= FS_SPACE_SYNC_INTERVAL) {
+      fs_space_sync (filesystem);
+      return; // one file system query per step
     }
   }
+  if (config_this->fs_enable and fs_space_free (FS_LITTLEFS)/1024 < config_this->fs_reserve and fs_evict (FS_LITTLEFS)) {
+    tm_this->fs_enabled = true;
+  }
+  #ifdef PLATFORM_ESP32CAM
+  if (tm_this->sd_enabled and fs_space_free (FS_SD_MMC)/1024 < config_this->fs_reserve) {
+    fs_evict (FS_SD_MMC);
+  }
   #endif
-  sprintf (buffer, "Created storage directory %s on %s for current session, and moved current log files to it", today_dir, fsName[filesystem]);
-  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
-  tm_this->fs_active = true;
+}
+
+void fs_space_sync (uint8_t filesystem) {
+  // seed or correct the free space estimate: the only place that asks the file system (walks its metadata)
+  fs_space_t* space = &fs_space[filesystem];
+  switch (filesystem) {
+  case FS_LITTLEFS: 
+                    #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
+                    space->total = LITTLEFS.totalBytes();
+                    space->used = LITTLEFS.usedBytes();
+                    #else
+                    space->total = LittleFS.totalBytes();
+                    space->used = LittleFS.usedBytes();
+                    #endif
+                    break;
+  #ifdef PLATFORM_ESP32CAM
+  case FS_SD_MMC:   space->total = SD_MMC.totalBytes();
+                    space->used = SD_MMC.usedBytes();
+                    break;
+  #endif
+  }
+  space->sync_millis = millis();
+  if (filesystem == FS_LITTLEFS and config_this->fs_enable and !tm_this->fs_enabled and space->total and fs_space_free (FS_LITTLEFS)/1024 > config_this->fs_reserve) {
+    // fs_free disabled archiving on an estimate that turned out too pessimistic, or space was freed since
+    tm_this->fs_enabled = true;
+    sprintf (buffer, "Re-enabling write access to FS (%u kB free)", (uint32_t)(fs_space_free (FS_LITTLEFS)/1024));
+    publish_event (STS_THIS, SS_THIS, EVENT_INFO, buffer);
+  }
+}
+
+void fs_space_add (uint8_t filesystem, int32_t bytes) {
+  // account for bytes committed (or given back) by our writers (block rounding and metadata are corrected at the next sync)
+  if (filesystem == FS_LITTLEFS or filesystem == FS_SD_MMC) {
+    if (bytes < 0 and fs_space[filesystem].used < (uint64_t)(-bytes)) {
+      fs_space[filesystem].used = 0;
+    }
+    else {
+      fs_space[filesystem].used += bytes;
+    }
+  }
+}
+
+uint32_t fs_data_end (File* file, uint32_t size) {
+  // end of the data in a file that may have a preallocated (zero) tail: just after its last non-zero byte
+  static uint8_t block[FS_BLOCK_SIZE];
+  uint32_t offset = size;
+  uint16_t len;
+  while (offset) {
+    len = (offset % FS_BLOCK_SIZE)?(offset % FS_BLOCK_SIZE):FS_BLOCK_SIZE;
+    offset -= len;
+    file->seek (offset);
+    if (file->read (block, len) != len) {
+      return size;
+    }
+    while (len) {
+      if (block[len - 1]) {
+        return offset + len;
+      }
+      len--;
+    }
+  }
+  return 0;
+}
+
+bool fs_truncate (uint8_t filesystem, const char* path, uint32_t size) {
+  // cut a closed file to size (the Arduino FS API cannot, so through its POSIX (VFS) mount point)
+  char vfs_path[48];
+  sprintf (vfs_path, "%s%s", (filesystem == FS_LITTLEFS)?FS_VFS_LITTLEFS:FS_VFS_SD_MMC, path);
+  return !truncate (vfs_path, size);
+}
+
+uint64_t fs_space_free (uint8_t filesystem) {
+  fs_space_t* space = &fs_space[filesystem];
+  return (space->used < space->total)?(space->total - space->used):0;
 }
 
 uint16_t fs_free () {
   if (config_this->fs_enable) {
-    sync_file_ccsds ();
-    sync_file_json ();
-    #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
-    if (tm_this->fs_enabled and LITTLEFS.totalBytes()-LITTLEFS.usedBytes() <= 8192) {
-    #else
-    if (tm_this->fs_enabled and LittleFS.totalBytes()-LittleFS.usedBytes() <= 8192) {
-    #endif
+    if (tm_this->fs_enabled and fs_space_free (FS_LITTLEFS) <= 8192) {
       tm_this->fs_enabled = false;
       tm_this->err_fs_dataloss = true;
       sprintf (buffer, "Disabling further write access to FS because it is full");
       publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
     }
-    #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
-    return ((LITTLEFS.totalBytes()-LITTLEFS.usedBytes())/1024);
-    #else
-    return ((LittleFS.totalBytes()-LittleFS.usedBytes())/1024);
-    #endif
+    return (fs_space_free (FS_LITTLEFS)/1024);
   }
   else { 
     return (0);
   }
 }
 
+uint32_t fs_file_size (uint8_t filesystem, const char* path) {
+  // size of a file (0 if there is none), to account for it in the free space estimate before it is removed or overwritten
+  FS* fs = get_fs (filesystem);
+  File file;
+  uint32_t size = 0;
+  if (fs and fs->exists (path) and (file = fs->open (path, "r"))) {
+    size = file.size ();
+    file.close ();
+  }
+  return size;
+}
+
+FS* get_fs (uint8_t filesystem) {
+  switch (filesystem) {
+  case FS_LITTLEFS: 
+                    #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
+                    return &LITTLEFS;
+                    #else
+                    return &LittleFS;
+                    #endif
+  #ifdef PLATFORM_ESP32CAM
+  case FS_SD_MMC:   return &SD_MMC;
+  #endif
+  }
+  return NULL;
+}
+
 #ifdef PLATFORM_ESP32CAM
 bool sd_setup () {
   if (!SD_MMC.begin()) {
@@ -306,13 +564,18 @@ bool sd_setup () {
     return false;
   }
   esp32cam.sd_enabled = true;
-  sprintf (buffer, "SD card mounted: size: %llu MB; space: %llu MB; used: %llu MB", SD_MMC.cardSize() / (1024 * 1024), SD_MMC.totalBytes() / (1024 * 1024), SD_MMC.usedBytes() / (1024 * 1024));
+  fs_space_sync (FS_SD_MMC);
+  sprintf (buffer, "SD card mounted: size: %llu MB; space: %llu MB; used: %llu MB", SD_MMC.cardSize() / (1024 * 1024), fs_space[FS_SD_MMC].total / (1024 * 1024), fs_space[FS_SD_MMC].used / (1024 * 1024));
   publish_event (STS_ESP32CAM, SS_SD, EVENT_INIT, buffer);
+  archive_recover_mount (FS_SD_MMC);
+  if (config_this->buffer_fs == FS_SD_MMC) {
+    store_setup (FS_SD_MMC); // drain TM buffered before the reboot
+  }
   return true;
 }
 
 uint16_t sd_free () {
-  return ((SD_MMC.totalBytes() - SD_MMC.usedBytes())/1024/1024);
+  return (fs_space_free (FS_SD_MMC)/1024/1024);
 }
 #endif
 
@@ -368,6 +631,23 @@ void load_default_config () {
   config_esp32.mpu_accel_offset_x = 0;
   config_esp32.mpu_accel_offset_y = 0;
   config_esp32.mpu_accel_offset_z = 0;
+  config_esp32.fs_stage_size = FS_BLOCK_SIZE;
+  config_esp32.sync_policy = SYNC_BYTES | SYNC_TIME | SYNC_EVENT;
+  config_esp32.sync_bytes = 4096;
+  config_esp32.sync_interval = 1000;
+  config_esp32.fs_segment_size = 256;
+  config_esp32.fs_reserve = 64;
+  config_esp32.fs_prealloc = 0;
+  config_esp32.fs_compress = false;
+  config_esp32.fs_framing = false;
+  config_esp32.fs_index_packets = 64;
+  config_esp32.fs_index_interval = 1000;
+  config_esp32.replay_share = 20;
+  config_esp32.drain_newest = (1 << PRIORITY_HOUSEKEEPING);
+  config_esp32.yamcs_mtu = 0;
+  config_esp32.yamcs_flush = 50;
+  config_esp32.tc_batch = 8;
+  config_esp32.tc_budget = 20;
   config_esp32.radio_enable = true;
   config_esp32.pressure_enable = true;
   config_esp32.motion_enable = true;
@@ -392,6 +672,23 @@ void load_default_config () {
   strcpy (config_esp32cam.config_file, "/default.cfg");
   strcpy (config_esp32cam.routing_file, "/default.rt");
   config_esp32cam.camera_rate = 2;
+  config_esp32cam.fs_stage_size = FS_STAGE_SIZE_MAX;
+  config_esp32cam.sync_policy = SYNC_BYTES | SYNC_TIME | SYNC_EVENT;
+  config_esp32cam.sync_bytes = 16384;
+  config_esp32cam.sync_interval = 2000;
+  config_esp32cam.fs_segment_size = 4096;
+  config_esp32cam.fs_reserve = 10240;
+  config_esp32cam.fs_prealloc = 0;
+  config_esp32cam.fs_compress = false;
+  config_esp32cam.fs_framing = false;
+  config_esp32cam.fs_index_packets = 64;
+  config_esp32cam.fs_index_interval = 1000;
+  config_esp32cam.replay_share = 20;
+  config_esp32cam.drain_newest = (1 << PRIORITY_HOUSEKEEPING);
+  config_esp32cam.yamcs_mtu = 0;
+  config_esp32cam.yamcs_flush = 50;
+  config_esp32cam.tc_batch = 8;
+  config_esp32cam.tc_budget = 20;
   config_esp32cam.wifi_enable = true;
   config_esp32cam.wifi_sta_enable = true;
   config_esp32cam.wifi_ap_enable = true;
@@ -430,10 +727,20 @@ void load_default_config () {
   char rt_yamcs[40] =    " 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0 ";
   char rt_udp[40] =      " 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 ";
   char rt_fs[40] =       " 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1 ";
+  char rt_priority[40] = " 0, 0, 1, 1, 2, 2, 2, 2, 1, 1, 1, 0, 0 ";
+  char rt_rate[40] =     " 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 "; // packets/s[/burst] per sink (0: not shaped)
+  char rt_decim[40] =    " 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 "; // every nth packet, or nms: a packet per n ms, per route
   set_routing (routing_serial, (const char*)rt_serial);
   set_routing (routing_yamcs, (const char*)rt_yamcs);
   set_routing (routing_udp, (const char*)rt_udp);
   set_routing (routing_fs, (const char*)rt_fs);
+  set_priority (routing_priority, (const char*)rt_priority);
+  for (uint8_t shaper_id = 0; shaper_id < NUMBER_OF_SHAPERS; shaper_id++) {
+    set_shaping (shaper[shaper_id], (const char*)rt_rate);
+  }
+  for (uint8_t route = 0; route < NUMBER_OF_ROUTES; route++) {
+    set_decimation (decimation[route], (const char*)rt_decim);
+  }
   #endif
   #ifdef PLATFORM_ESP32CAM
   //                       0  1  2  3  4  5  6  7  8  9  A  B  C
@@ -445,12 +752,22 @@ void load_default_config () {
   char rt_fs[40] =       " 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1 ";
   char rt_sd_json[40] =  " 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1 ";
   char rt_sd_ccsds[40] = " 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1 ";
+  char rt_priority[40] = " 0, 0, 1, 1, 2, 2, 2, 2, 1, 1, 1, 0, 0 ";
+  char rt_rate[40] =     " 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 "; // packets/s[/burst] per sink (0: not shaped)
+  char rt_decim[40] =    " 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 "; // every nth packet, or nms: a packet per n ms, per route
   set_routing (routing_serial, (const char*)rt_serial);
   set_routing (routing_yamcs, (const char*)rt_yamcs);
   set_routing (routing_udp, (const char*)rt_udp);
   set_routing (routing_fs, (const char*)rt_fs);
   set_routing (routing_sd_json, (const char*)rt_sd_json);
   set_routing (routing_sd_ccsds, (const char*)rt_sd_ccsds);
+  set_priority (routing_priority, (const char*)rt_priority);
+  for (uint8_t shaper_id = 0; shaper_id < NUMBER_OF_SHAPERS; shaper_id++) {
+    set_shaping (shaper[shaper_id], (const char*)rt_rate);
+  }
+  for (uint8_t route = 0; route < NUMBER_OF_ROUTES; route++) {
+    set_decimation (decimation[route], (const char*)rt_decim);
+  }
   #endif
 }
 
@@ -552,7 +869,7 @@ bool file_load_config (uint8_t filesystem, const char* filename) {
 }
 
 bool file_load_routing (uint8_t filesystem, const char* filename) {
-  char linebuffer[80], parameter[80];
+  char linebuffer[160], parameter[160];
   uint8_t value_start = 0;
   File file;
   switch (filesystem) {
@@ -599,6 +916,22 @@ bool file_load_routing (uint8_t filesystem, const char* filename) {
           sprintf (buffer, "Set routing_fs to %s", set_routing (routing_fs, (const char*)parameter).c_str());
           publish_udp_text (buffer);
         }
+        if (String(linebuffer).startsWith("rt_priority")) {
+          sprintf (buffer, "Set routing_priority to %s", set_priority (routing_priority, (const char*)parameter).c_str());
+          publish_udp_text (buffer);
+        }
+        for (uint8_t shaper_id = 0; shaper_id < NUMBER_OF_SHAPERS; shaper_id++) {
+          if (String(linebuffer).startsWith((String("rt_rate_") + shaperName[shaper_id]).c_str())) {
+            sprintf (buffer, "Set rate of %s to %s", shaperName[shaper_id], set_shaping (shaper[shaper_id], (const char*)parameter).c_str());
+            publish_udp_text (buffer);
+          }
+        }
+        for (uint8_t route = 0; route < NUMBER_OF_ROUTES; route++) {
+          if (String(linebuffer).startsWith((String("rt_decim_") + routeName[route]).c_str())) {
+            sprintf (buffer, "Set decimation of %s to %s", routeName[route], set_decimation (decimation[route], (const char*)parameter).c_str());
+            publish_udp_text (buffer);
+          }
+        }
         #ifdef PLATFORM_ESP32CAM
         if (String(linebuffer).startsWith("rt_sd_json")) {
           sprintf (buffer, "Set routing_sd_json to %s", set_routing (routing_sd_json, (const char*)parameter).c_str());
@@ -611,7 +944,7 @@ bool file_load_routing (uint8_t filesystem, const char* filename) {
         #endif
         i = 0;
       }
-      else {
+      else if (i < sizeof(linebuffer) - 1) { // longer lines are cut
         i++;
       }
     }
@@ -640,6 +973,106 @@ String set_routing (char* routing_table, const char* routing_string) {
   return (return_string);
 }
 
+String set_shaping (shaper_t* shaper_table, const char* shaping_string) {
+  // as set_routing, with the rate of each PID in packets/s (0: not shaped), optionally followed by /burst in packets
+  // (by default a quarter of a second worth of packets)
+  uint16_t PID = 0;
+  String return_string;
+  const char* p = shaping_string;
+  char* end;
+  while (*p and PID < NUMBER_OF_PID) {
+    if (*p < '0' or *p > '9') {
+      p++;
+      continue;
+    }
+    shaper_table[PID].rate = strtoul (p, &end, 10);
+    shaper_table[PID].burst = shaper_table[PID].rate / 4 + 1;
+    p = end;
+    if (*p == '/') {
+      shaper_table[PID].burst = max ((unsigned long)1, strtoul (p + 1, &end, 10));
+      p = end;
+    }
+    shaper_table[PID].tokens = 1000 * shaper_table[PID].burst;
+    shaper_table[PID].refill_millis = millis();
+    if (shaper_table[PID].rate) {
+      return_string += String(pidName[PID]) + ":" + String(shaper_table[PID].rate) + "/" + String(shaper_table[PID].burst) + " ";
+    }
+    else {
+      return_string += String(pidName[PID]) + ":- ";
+    }
+    PID++;
+  }
+  publish_udp_text (return_string.c_str());
+  return (return_string);
+}
+
+const char* parse_decimation (decimation_t* decimation, const char* entry) {
+  // a decimation factor ("10": every 10th packet) or interval ("100ms": a packet per 100 ms); returns the end of the entry
+  char* end;
+  uint32_t value = strtoul (entry, &end, 10);
+  decimation->factor = 1;
+  decimation->interval = 0;
+  decimation->slot = 0xFFFFFFFF;
+  value = min (value, (uint32_t)65535);
+  if (!strncmp(end, "ms", 2)) {
+    decimation->interval = value;
+    return end + 2;
+  }
+  decimation->factor = max ((uint32_t)1, value);
+  return end;
+}
+
+bool decimation_select (decimation_t* decimation, ccsds_t* ccsds_ptr) {
+  // whether a route takes this packet: depends on the packet and (with an interval) on the packets of its PID before it
+  if (decimation->factor > 1) {
+    return (get_ccsds_seq_ctr (ccsds_ptr) % decimation->factor == 0);
+  }
+  if (decimation->interval) {
+    if (get_ccsds_millis (ccsds_ptr) / decimation->interval == decimation->slot) {
+      return false;
+    }
+    decimation->slot = get_ccsds_millis (ccsds_ptr) / decimation->interval;
+  }
+  return true;
+}
+
+String set_decimation (decimation_t* decimation_table, const char* decimation_string) {
+  // as set_routing, with the decimation of each PID (see parse_decimation)
+  uint16_t PID = 0;
+  String return_string;
+  const char* p = decimation_string;
+  while (*p and PID < NUMBER_OF_PID) {
+    if (*p < '0' or *p > '9') {
+      p++;
+      continue;
+    }
+    p = parse_decimation (&decimation_table[PID], p);
+    if (decimation_table[PID].interval) {
+      return_string += String(pidName[PID]) + ":" + String(decimation_table[PID].interval) + "ms ";
+    }
+    else {
+      return_string += String(pidName[PID]) + ":" + String(decimation_table[PID].factor) + " ";
+    }
+    PID++;
+  }
+  publish_udp_text (return_string.c_str());
+  return (return_string);
+}
+
+String set_priority (char* priority_table, const char* priority_string) {
+  // as set_routing, with the priority class of each PID (0: event, 1: housekeeping, 2: science)
+  uint16_t PID = 0;
+  String return_string;
+  for (uint8_t i = 0; i < strlen (priority_string) and PID < NUMBER_OF_PID; i++) {
+    if (priority_string[i] >= '0' and priority_string[i] < '0' + NUMBER_OF_PRIORITIES) {
+      *priority_table++ = priority_string[i] - '0';
+      return_string += String(pidName[PID++]) + ":" + String(priorityName[priority_string[i] - '0']) + " ";
+    }
+  }
+  publish_udp_text (return_string.c_str());
+  return (return_string);
+}
+
 bool set_parameter (const char* parameter, const char* value) {
   bool success = false;
   if (!strcmp(parameter, "wifi_ssid")) { 
@@ -752,6 +1185,114 @@ bool set_parameter (const char* parameter, const char* value) {
     sprintf (buffer, "Set buffer_fs to %s", fsName[config_this->buffer_fs]);
     success = true;
   } 
+  else if (!strcmp(parameter, "fs_stage_size")) { 
+    config_this->fs_stage_size = constrain (atoi(value) / FS_BLOCK_SIZE * FS_BLOCK_SIZE, FS_BLOCK_SIZE, FS_STAGE_SIZE_MAX);
+    sprintf (buffer, "Set fs_stage_size to %u bytes", config_this->fs_stage_size);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "sync_policy")) { 
+    config_this->sync_policy = atoi(value) & (SYNC_BYTES | SYNC_TIME | SYNC_EVENT);
+    sprintf (buffer, "Set sync_policy to %s%s%s%s", config_this->sync_policy?"":"none ", (config_this->sync_policy & SYNC_BYTES)?"bytes ":"", (config_this->sync_policy & SYNC_TIME)?"time ":"", (config_this->sync_policy & SYNC_EVENT)?"event ":"");
+    success = true;
+  } 
+  else if (!strcmp(parameter, "sync_bytes")) { 
+    config_this->sync_bytes = constrain (atoi(value), FS_BLOCK_SIZE, 65535);
+    sprintf (buffer, "Set sync_bytes to %u bytes", config_this->sync_bytes);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "sync_interval")) { 
+    config_this->sync_interval = constrain (atoi(value), SYNC_INTERVAL_MIN, 65535);
+    sprintf (buffer, "Set sync_interval to %u ms", config_this->sync_interval);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_segment_size")) { 
+    config_this->fs_segment_size = max (1, atoi(value));
+    sprintf (buffer, "Set fs_segment_size to %u kB", config_this->fs_segment_size);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_reserve")) { 
+    config_this->fs_reserve = atoi(value);
+    sprintf (buffer, "Set fs_reserve to %u kB", config_this->fs_reserve);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_prealloc")) { 
+    config_this->fs_prealloc = atoi(value);
+    sprintf (buffer, "Set fs_prealloc to %u kB (from next archive segment)", config_this->fs_prealloc);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_compress")) { 
+    config_this->fs_compress = atoi(value);
+    sprintf (buffer, "Set fs_compress to %s (from next archive segment)", config_this->fs_compress?"true":"false");
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_framing")) { 
+    config_this->fs_framing = atoi(value);
+    sprintf (buffer, "Set fs_framing to %s (from next archive segment)", config_this->fs_framing?"true":"false");
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_index_packets")) { 
+    config_this->fs_index_packets = atoi(value);
+    sprintf (buffer, "Set fs_index_packets to %u (from next archive segment)", config_this->fs_index_packets);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "fs_index_interval")) { 
+    config_this->fs_index_interval = atoi(value);
+    sprintf (buffer, "Set fs_index_interval to %u ms", config_this->fs_index_interval);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "replay_share")) { 
+    config_this->replay_share = constrain (atoi(value), 0, 100);
+    sprintf (buffer, "Set replay_share to %u%%", config_this->replay_share);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "yamcs_mtu")) { 
+    config_this->yamcs_mtu = constrain (atoi(value), 0, YAMCS_MTU_MAX);
+    yamcs_flush ();
+    sprintf (buffer, "Set yamcs_mtu to %u bytes", config_this->yamcs_mtu);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "yamcs_flush")) { 
+    config_this->yamcs_flush = atoi(value);
+    sprintf (buffer, "Set yamcs_flush to %u ms", config_this->yamcs_flush);
+    success = true;
+  } 
+  else if (!strncmp(parameter, "decim_", 6)) { 
+    // decim_<route> <PID name or number>:<factor, or interval in ms>, e.g. decim_yamcs tm_motion:10
+    uint8_t route = 0;
+    uint16_t PID = 0;
+    const char* entry = strchr (value, ':');
+    while (route < NUMBER_OF_ROUTES and strcmp(parameter + 6, routeName[route])) {
+      route++;
+    }
+    while (entry and PID < NUMBER_OF_PID and ((value[0] >= '0' and value[0] <= '9')?(atoi(value) != PID):(strncmp(value, pidName[PID], entry - value) or pidName[PID][entry - value]))) {
+      PID++;
+    }
+    if (route < NUMBER_OF_ROUTES and entry and PID < NUMBER_OF_PID and entry[1] >= '0' and entry[1] <= '9') {
+      parse_decimation (&decimation[route][PID], entry + 1);
+      if (decimation[route][PID].interval) {
+        sprintf (buffer, "Set decimation of %s on %s to a packet per %u ms", pidName[PID], routeName[route], decimation[route][PID].interval);
+      }
+      else {
+        sprintf (buffer, "Set decimation of %s on %s to every %u packets", pidName[PID], routeName[route], decimation[route][PID].factor);
+      }
+      success = true;
+    }
+  } 
+  else if (!strcmp(parameter, "tc_batch")) { 
+    config_this->tc_batch = constrain (atoi(value), 1, 255);
+    sprintf (buffer, "Set tc_batch to %u commands", config_this->tc_batch);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "tc_budget")) { 
+    config_this->tc_budget = atoi(value);
+    sprintf (buffer, "Set tc_budget to %u ms", config_this->tc_budget);
+    success = true;
+  } 
+  else if (!strcmp(parameter, "drain_newest")) { 
+    config_this->drain_newest = atoi(value) & ((1 << NUMBER_OF_PRIORITIES) - 1);
+    sprintf (buffer, "Set drain_newest to %s%s%s%s", config_this->drain_newest?"":"none ", (config_this->drain_newest & (1 << PRIORITY_EVENT))?"event ":"", (config_this->drain_newest & (1 << PRIORITY_HOUSEKEEPING))?"housekeeping ":"", (config_this->drain_newest & (1 << PRIORITY_SCIENCE))?"science ":"");
+    success = true;
+  } 
   else if (!strcmp(parameter, "serial_format")) { 
     config_this->serial_format = atoi(value);
     sprintf (buffer, "Set serial_format to %s", dataEncodingName[config_this->serial_format]);
@@ -1022,6 +1563,10 @@ bool wifi_setup () {
     return_wifi_sta = wifi_sta_setup ();
     tm_this->wifi_enabled = true;
   }
+  if (tm_this->wifi_enabled) {
+    // from setup, and not on first use: starting it from a sink would publish its event from within publish_packet
+    tx_setup ();
+  }
   if (config_this->wifi_yamcs_enable) {
     sprintf (buffer, "Sending CCSDS telemetry to UDP port %s:%u", config_network.yamcs_server, config_network.yamcs_tm_port);
     publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
@@ -1039,100 +1584,181 @@ bool wifi_ap_setup () {
 }
 
 bool wifi_sta_setup () {
-  uint8_t wifi_timeout_ctr = 0;
-  uint8_t configured_wifi_id = 0;
-  uint8_t scanned_wifi_id = 0;
-  bool wifi_detected = false;
-  int scanned_wifi_num = WiFi.scanNetworks();
-  sprintf (buffer, "%s found %u WiFi networks", subsystemName[SS_THIS], scanned_wifi_num);
-  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
-  while (scanned_wifi_id < scanned_wifi_num) {
-    if (!strcmp(config_network.wifi_ssid, WiFi.SSID(scanned_wifi_id).c_str())) {
-      wifi_detected = true;
-      wifi_timeout_ctr = 0;
-      WiFi.begin(config_network.wifi_ssid, config_network.wifi_password);
-      while (wifi_timeout_ctr++ < WIFI_TIMEOUT and WiFi.status() != WL_CONNECTED) {
-        delay (1000);
-      }
-      if (WiFi.status() != WL_CONNECTED) {
-        sprintf (buffer, "%s tired of trying to connect to default WiFi network %s after %u seconds", subsystemName[SS_THIS], config_network.wifi_ssid, WIFI_TIMEOUT);
-        publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
-      }
-    }
-    scanned_wifi_id++;
-  }
-  if (!wifi_detected) {
-    sprintf (buffer, "%s did not detect default WiFi network %s", subsystemName[SS_THIS], config_network.wifi_ssid);
-    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer); 
-  }
-  if (WiFi.status() != WL_CONNECTED) {
-  	// try all configured networks
-    while (configured_wifi_id < NUMBER_OF_WIFI and WiFi.status() != WL_CONNECTED) {
-      scanned_wifi_id = 0;
-      wifi_detected = false;
-      while (scanned_wifi_id < scanned_wifi_num and WiFi.status() != WL_CONNECTED) {
-        if (!strcmp(default_wifi_ssid[configured_wifi_id], WiFi.SSID(scanned_wifi_id).c_str())) {
-          wifi_detected = true;
-          WiFi.begin(default_wifi_ssid[configured_wifi_id], default_wifi_password[configured_wifi_id]); 
-          wifi_timeout_ctr = 0;
-          while (wifi_timeout_ctr++ < WIFI_TIMEOUT and WiFi.status() != WL_CONNECTED) {
-            delay (1000);
-          }
-          if (WiFi.status() != WL_CONNECTED) {
-            sprintf (buffer, "%s tired of trying to connect to %s WiFi network", subsystemName[SS_THIS], default_wifi_ssid[configured_wifi_id]);
-            publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
-          }
-        }
-        scanned_wifi_id++;
-      }
-      if (!wifi_detected) {
-        sprintf (buffer, "%s did not detect %s WiFi network", subsystemName[SS_THIS], default_wifi_ssid[configured_wifi_id]);
-        publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);      	  
-      }
-      configured_wifi_id++;
-    }
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-  	if (configured_wifi_id-- != 0) {
-      strcpy (config_network.wifi_ssid, default_wifi_ssid[configured_wifi_id]);
-      strcpy (config_network.udp_server, default_udp_server[configured_wifi_id]);
-      strcpy (config_network.yamcs_server, default_yamcs_server[configured_wifi_id]);
-      strcpy (config_network.ntp_server, default_ntp_server[configured_wifi_id]);
-    }
-    sprintf (buffer, "%s connected to WiFi network %s with IP %s", subsystemName[SS_THIS], config_network.wifi_ssid, WiFi.localIP().toString().c_str());
-    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
-    if (config_this->wifi_udp_enable) {
-      tm_this->wifi_udp_enabled = true;
-    }
-    if (config_this->wifi_yamcs_enable) {
-      tm_this->wifi_yamcs_enabled = true;
-    }
-    tm_this->wifi_connected = true;
-  } 
+  // only starts connecting: wifi_check drives the connection from the loop, so that booting does not wait for WiFi
+  WiFi.setAutoReconnect(false);
   timeClient.begin();
-  ntp_check();
-  return tm_this->wifi_connected;
+  wifi_sta.backoff = WIFI_BACKOFF_MIN;
+  if (!wifi_sta_fast ()) {
+    wifi_sta_scan ();
+  }
+  return true;
 }
 
 bool wifi_check () {
-  if (WiFi.status() != WL_CONNECTED) {
-    if (tm_this->wifi_connected) {
-      tm_this->wifi_connected = false;
-      tm_this->warn_wifi_connloss = true;
-    }
-    return false;
+  // advance the station connection; true if connected
+  uint8_t candidate;
+  int16_t scanned_wifi_num;
+  switch (wifi_sta.state) {
+    case WIFI_STA_SCANNING:   scanned_wifi_num = WiFi.scanComplete();
+                              if (scanned_wifi_num == WIFI_SCAN_RUNNING and millis() - wifi_sta.state_millis < 1000 * WIFI_TIMEOUT) {
+                                break;
+                              }
+                              if (scanned_wifi_num < 0) {
+                                sprintf (buffer, "%s failed to scan for WiFi networks", subsystemName[SS_THIS]);
+                                publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+                                WiFi.scanDelete();
+                                wifi_sta_backoff ();
+                                break;
+                              }
+                              // the strongest access point of every known network
+                              memset (wifi_scan, 0, sizeof(wifi_scan));
+                              for (int16_t scanned_wifi_id = 0; scanned_wifi_id < scanned_wifi_num; scanned_wifi_id++) {
+                                for (candidate = 0; candidate <= NUMBER_OF_WIFI; candidate++) {
+                                  if (!strcmp(wifi_candidate_ssid (candidate), WiFi.SSID(scanned_wifi_id).c_str()) and (!wifi_scan[candidate].found or WiFi.RSSI(scanned_wifi_id) > wifi_scan[candidate].rssi)) {
+                                    wifi_scan[candidate].found = true;
+                                    wifi_scan[candidate].rssi = WiFi.RSSI(scanned_wifi_id);
+                                    wifi_scan[candidate].channel = WiFi.channel(scanned_wifi_id);
+                                    memcpy (wifi_scan[candidate].bssid, WiFi.BSSID(scanned_wifi_id), 6);
+                                  }
+                                }
+                              }
+                              WiFi.scanDelete();
+                              sprintf (buffer, "%s found %u WiFi networks", subsystemName[SS_THIS], scanned_wifi_num);
+                              publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+                              wifi_sta_next (0);
+                              break;
+    case WIFI_STA_CONNECTING: if (WiFi.status() == WL_CONNECTED) {
+                                wifi_sta_connected ();
+                              }
+                              else if (millis() - wifi_sta.state_millis >= 1000 * wifi_sta.timeout) {
+                                WiFi.disconnect();
+                                sprintf (buffer, "%s tired of trying to connect to %s WiFi network after %u seconds", subsystemName[SS_THIS], wifi_candidate_ssid (wifi_sta.candidate), wifi_sta.timeout);
+                                publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+                                if (wifi_sta.fast) {
+                                  wifi_sta_scan ();
+                                }
+                                else {
+                                  wifi_sta_next (wifi_sta.candidate + 1);
+                                }
+                              }
+                              break;
+    case WIFI_STA_CONNECTED:  if (WiFi.status() != WL_CONNECTED) {
+                                tm_this->wifi_connected = false;
+                                tm_this->warn_wifi_connloss = true;
+                                sprintf (buffer, "%s lost connection to %s WiFi network", subsystemName[SS_THIS], config_network.wifi_ssid);
+                                publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+                                WiFi.disconnect();
+                                if (!wifi_sta_fast ()) {
+                                  wifi_sta_scan ();
+                                }
+                              }
+                              break;
+    case WIFI_STA_BACKOFF:    if (millis() - wifi_sta.state_millis >= 1000 * wifi_sta.backoff) {
+                                wifi_sta.backoff = min (2 * wifi_sta.backoff, WIFI_BACKOFF_MAX);
+                                if (!wifi_sta_fast ()) {
+                                  wifi_sta_scan ();
+                                }
+                              }
+                              break;
   }
-  else {
-    if (!tm_this->wifi_connected) {
-      tm_this->wifi_connected = true;
-      tm_this->warn_wifi_connloss = false;
-    }
-    return true;
+  if (tm_this->wifi_connected) {
+    tx_resolve (TX_YAMCS);
+    tx_resolve (TX_UDP);
   }
+  return tm_this->wifi_connected;
 }
 
-bool ntp_check () {
-  if (timeClient.update() and !tm_this->time_set) {
+const char* wifi_candidate_ssid (uint8_t candidate) {
+  return candidate?default_wifi_ssid[candidate - 1]:config_network.wifi_ssid;
+}
+
+const char* wifi_candidate_password (uint8_t candidate) {
+  return candidate?default_wifi_password[candidate - 1]:config_network.wifi_password;
+}
+
+void wifi_sta_begin (uint8_t candidate, const wifi_ap_t* ap, uint16_t timeout) {
+  // join the given access point of a known network
+  WiFi.begin(wifi_candidate_ssid (candidate), wifi_candidate_password (candidate), ap->channel, ap->bssid);
+  wifi_sta.state = WIFI_STA_CONNECTING;
+  wifi_sta.candidate = candidate;
+  wifi_sta.timeout = timeout;
+  wifi_sta.state_millis = millis();
+}
+
+bool wifi_sta_fast () {
+  // rejoin the access point of the last connection straight away, on its channel (no scan)
+  wifi_sta.fast = false;
+  if (!wifi_cache.valid) {
+    return false;
+  }
+  for (uint8_t candidate = 0; candidate <= NUMBER_OF_WIFI; candidate++) {
+    if (!strcmp(wifi_candidate_ssid (candidate), wifi_cache.ssid)) {
+      wifi_sta.fast = true;
+      wifi_sta_begin (candidate, &wifi_cache.ap, WIFI_FAST_TIMEOUT);
+      return true;
+    }
+  }
+  return false;
+}
+
+void wifi_sta_scan () {
+  wifi_sta.fast = false;
+  WiFi.scanNetworks(true);
+  wifi_sta.state = WIFI_STA_SCANNING;
+  wifi_sta.state_millis = millis();
+}
+
+void wifi_sta_next (uint8_t candidate) {
+  // try the next known network found by the scan, in order of preference; back off when none is left
+  while (candidate <= NUMBER_OF_WIFI and !wifi_scan[candidate].found) {
+    candidate++;
+  }
+  if (candidate <= NUMBER_OF_WIFI) {
+    wifi_sta_begin (candidate, &wifi_scan[candidate], WIFI_TIMEOUT);
+  }
+  else {
+    wifi_sta_backoff ();
+  }
+}
+
+void wifi_sta_backoff () {
+  sprintf (buffer, "%s could not join a known WiFi network, scanning again in %u seconds", subsystemName[SS_THIS], wifi_sta.backoff);
+  publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+  wifi_sta.state = WIFI_STA_BACKOFF;
+  wifi_sta.state_millis = millis();
+}
+
+void wifi_sta_connected () {
+  if (wifi_sta.candidate) {
+    strcpy (config_network.wifi_ssid, default_wifi_ssid[wifi_sta.candidate - 1]);
+    strcpy (config_network.wifi_password, default_wifi_password[wifi_sta.candidate - 1]);
+    strcpy (config_network.udp_server, default_udp_server[wifi_sta.candidate - 1]);
+    strcpy (config_network.yamcs_server, default_yamcs_server[wifi_sta.candidate - 1]);
+    strcpy (config_network.ntp_server, default_ntp_server[wifi_sta.candidate - 1]);
+    wifi_sta.candidate = 0;
+  }
+  wifi_cache.valid = true;
+  strcpy (wifi_cache.ssid, config_network.wifi_ssid);
+  wifi_cache.ap.channel = WiFi.channel();
+  memcpy (wifi_cache.ap.bssid, WiFi.BSSID(), 6);
+  sprintf (buffer, "%s connected to WiFi network %s with IP %s (channel %u)", subsystemName[SS_THIS], config_network.wifi_ssid, WiFi.localIP().toString().c_str(), wifi_cache.ap.channel);
+  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+  if (config_this->wifi_udp_enable) {
+    tm_this->wifi_udp_enabled = true;
+  }
+  if (config_this->wifi_yamcs_enable) {
+    tm_this->wifi_yamcs_enabled = true;
+  }
+  tm_this->wifi_connected = true;
+  tm_this->warn_wifi_connloss = false;
+  wifi_sta.state = WIFI_STA_CONNECTED;
+  wifi_sta.state_millis = millis();
+  wifi_sta.backoff = WIFI_BACKOFF_MIN;
+  ntp_check();
+}
+
+bool ntp_check () {
+  if (timeClient.update() and !tm_this->time_set) {
     sprintf (buffer, "Time on %s set via NTP server %s: %s", subsystemName[SS_THIS], config_network.ntp_server, timeClient.getFormattedDate().c_str());
     publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
     tm_this->time_set = true;
@@ -1153,49 +1779,71 @@ bool ntp_check () {
 // TM/TC FUNCTIONALITY (serial/udp/yamcs/fs/sd)
 
 void publish_packet (ccsds_t* ccsds_ptr) { 
-  static uint32_t start_millis;
-  static uint16_t PID;
+  uint32_t start_millis;
+  uint16_t PID;
+  uint8_t outer_store_request;
+  uint8_t outer_store_release;
 
   if (tm_this->opsmode != MODE_MAINTENANCE) {
     PID = update_packet (ccsds_ptr);
-    ccsds_archive.packet_saved = false;
-    // SD-card (potentially needed for packet recovery, so needs to be first in line)
+    outer_store_request = store_request; // publish_packet is re-entered when a sink publishes an event
+    outer_store_release = store_release;
+    store_request = 0;
+    store_release = 0;
+    // SD-card (archive first, so the packet is on file before it goes out)
     #ifdef PLATFORM_ESP32CAM
     start_millis = millis();
-    if (routing_sd_json[PID] and config_this->sd_enable and tm_this->sd_json_enabled) {
+    if (routing_sd_json[PID] and decimation_select (&decimation[ROUTE_SD_JSON][PID], ccsds_ptr) and config_this->sd_enable and tm_this->sd_json_enabled) {
       publish_file (FS_SD_MMC, ENC_JSON, ccsds_ptr);
     }
-    if (routing_sd_ccsds[PID] and config_this->sd_enable and tm_this->sd_ccsds_enabled) {
+    if (routing_sd_ccsds[PID] and decimation_select (&decimation[ROUTE_SD_CCSDS][PID], ccsds_ptr) and config_this->sd_enable and tm_this->sd_ccsds_enabled) {
       publish_file (FS_SD_MMC, ENC_CCSDS, ccsds_ptr);
     }
     timer_this->publish_sd_duration += millis() - start_millis;
     #endif
-    // FS (potentially needed for packet recovery, so needs to be first in line)
-    if (routing_fs[PID] and tm_this->fs_enabled) {
+    // FS (archive first, so the packet is on file before it goes out)
+    if (routing_fs[PID] and decimation_select (&decimation[ROUTE_FS][PID], ccsds_ptr) and tm_this->fs_enabled) {
       start_millis = millis();
       publish_file (FS_LITTLEFS, ENC_CCSDS, ccsds_ptr);
       timer_this->publish_fs_duration += millis() - start_millis;
     }
     // serial
     #ifdef SERIAL_TCTM
-    if (routing_serial[PID]) {
+    if (routing_serial[PID] and decimation_select (&decimation[ROUTE_SERIAL][PID], ccsds_ptr)) {
       start_millis = millis();
       publish_serial (ccsds_ptr);
       timer_this->publish_serial_duration += millis() - start_millis;
     }
     #endif
     // Yamcs
-    if (routing_yamcs[PID] and config_this->wifi_enable and config_this->wifi_yamcs_enable) {
+    yamcs_flush_check ();
+    if (routing_yamcs[PID] and decimation_select (&decimation[ROUTE_YAMCS][PID], ccsds_ptr) and config_this->wifi_enable and config_this->wifi_yamcs_enable) {
       start_millis = millis();
       publish_yamcs (ccsds_ptr);
       timer_this->publish_yamcs_duration += millis() - start_millis;
     }
     // UDP
-    if (routing_udp[PID] and config_this->wifi_enable and config_this->wifi_udp_enable) {
+    if (routing_udp[PID] and decimation_select (&decimation[ROUTE_UDP][PID], ccsds_ptr) and config_this->wifi_enable and config_this->wifi_udp_enable) {
       start_millis = millis();
       publish_udp (ccsds_ptr);
       timer_this->publish_udp_duration += millis() - start_millis;
     }
+    // TM buffer store (keeps the packet for the sinks above that could not send it now, then replays part of the backlog)
+    if (store_request or store_release) {
+      start_millis = millis();
+      store_commit (ccsds_ptr);
+      store_drain ();
+      switch (store_fs) {
+      case FS_LITTLEFS: timer_this->publish_fs_duration += millis() - start_millis;
+                        break;
+      #ifdef PLATFORM_ESP32CAM
+      case FS_SD_MMC:   timer_this->publish_sd_duration += millis() - start_millis;
+                        break;
+      #endif
+      }
+    }
+    store_request = outer_store_request;
+    store_release = outer_store_release;
     // radio
     #ifdef PLATFORM_ESP32
     if (tm_this->radio_enabled and PID == TM_RADIO) {
@@ -1230,413 +1878,1015 @@ void publish_event (uint16_t PID, uint8_t subsystem, uint8_t event_type, const c
   }
 }
 
-bool open_file_ccsds (uint8_t filesystem) { 
-  if (!file_ccsds) {
-    switch (filesystem) {
-    case FS_LITTLEFS: 
-                        #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
-                        file_ccsds = LITTLEFS.open(ccsds_path_buffer, "a+");
-                        #else
-                        file_ccsds = LittleFS.open(ccsds_path_buffer, "a+");
-                        #endif
-                        break;
-    #ifdef PLATFORM_ESP32CAM
-    case FS_SD_MMC:     file_ccsds = SD_MMC.open(ccsds_path_buffer, "a+");
-                        break;
-    #endif
-    }
-    if (!file_ccsds) {
-      sprintf (buffer, "Failed to open '%s' on %s in append/read mode", ccsds_path_buffer, fsName[filesystem]);
-      publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
-      switch (filesystem) {
-      case FS_LITTLEFS: tm_this->err_fs_dataloss = true;
-                        break;
-      #ifdef PLATFORM_ESP32CAM
-      case FS_SD_MMC:   tm_this->sd_ccsds_enabled = false;
-                        tm_this->err_sd_dataloss = true;
-                        break;
-      #endif
-      }
-      if (tm_this->buffer_fs == filesystem) {
-        tm_this->buffer_fs = FS_NONE;
-      }
-      return false;
+writer_t* get_writer (uint8_t filesystem, uint8_t encoding) {
+  for (uint8_t w = 0; w < NUMBER_OF_WRITERS; w++) {
+    if (writers[w].filesystem == filesystem and writers[w].encoding == encoding) {
+      return &writers[w];
     }
   }
-  return true;
+  return NULL;
 }
 
-bool open_file_json (uint8_t filesystem) { 
-  if (!file_json) {
-    switch (filesystem) {
-    case FS_LITTLEFS: 
-                        #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
-                        file_json = LITTLEFS.open(json_path_buffer, "a+");
-                        #else
-                        file_json = LittleFS.open(json_path_buffer, "a+");
-                        #endif
-                        break;
+bool open_file (writer_t* writer) { 
+  // open the current segment of an archive in append/read mode
+  writer->file = get_fs (writer->filesystem)->open (writer->path, "a+");
+  writer->stage.len = 0;
+  writer->stage.file_size = writer->file?writer->file.size():0;
+  writer->stage.filesystem = writer->filesystem;
+  writer->stage.extent = 0;
+  writer->unsynced_bytes = 0;
+  writer->sync_millis = millis();
+  if (!writer->file) {
+    sprintf (buffer, "Failed to open '%s' on %s in append/read mode", writer->path, fsName[writer->filesystem]);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
+    switch (writer->filesystem) {
+    case FS_LITTLEFS: tm_this->err_fs_dataloss = true;
+                      break;
     #ifdef PLATFORM_ESP32CAM
-    case FS_SD_MMC:   file_json = SD_MMC.open(json_path_buffer, "a+");
-                          break;
+    case FS_SD_MMC:   if (writer->encoding == ENC_JSON) {
+                        tm_this->sd_json_enabled = false;
+                      }
+                      else {
+                        tm_this->sd_ccsds_enabled = false;
+                      }
+                      tm_this->err_sd_dataloss = true;
+                      break;
     #endif
     }
-    if (!file_json) {
-      sprintf (buffer, "Failed to open '%s' on %s in append/read mode", json_path_buffer, fsName[filesystem]);
-      publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
-      switch (filesystem) {
-      case FS_LITTLEFS: tm_this->err_fs_dataloss = true;
-                        break;
-      #ifdef PLATFORM_ESP32CAM
-      case FS_SD_MMC:   tm_this->sd_json_enabled = false;
-                        tm_this->err_sd_dataloss = true;
-                        break;
-      #endif
-      }
-      return false;
-    }
+    return false;
   }
   return true;
 }
 
-bool sync_file_ccsds () { // to be executed periodically to avoid data loss
-  static uint32_t start_millis;
-  if (file_ccsds) {
-    start_millis = millis();
-    file_ccsds.close();
-    switch (config_this->buffer_fs) {
-    case FS_LITTLEFS: tm_this->fs_active = true;
-                      timer_this->publish_fs_duration += millis() - start_millis;
-                      break;
-    #ifdef PLATFORM_ESP32CAM
-    case FS_SD_MMC:   tm_this->sd_active = true;
-                      timer_this->publish_sd_duration += millis() - start_millis;
-                      break;
-    #endif
-    }               
+bool open_file_ccsds (writer_t* writer) { 
+  archive_hdr_t archive_hdr;
+  if (!writer->file) {
+    archive_path (writer->path, writer->base, writer->segment, ccsds_extension ()); // fs_compress/fs_framing take effect here
+    if (!open_file (writer)) {
+      return false;
+    }
+    writer->compressed = false;
+    writer->framed = false;
+    if (!strcmp (ccsds_extension (), "ccsdx")) {
+      // extended archive: every segment decodes on its own, so start with fresh references
+      archive_codec_reset (&writer->codec);
+      if (!writer->stage.file_size) {
+        writer->compressed = config_this->fs_compress;
+        writer->framed = config_this->fs_framing;
+        if (writer->framed and !stage_prealloc (&writer->file, &writer->stage, writer->path)) {
+          // only framed segments: their end can be found again in a preallocated file left behind by a reset
+          return false;
+        }
+        archive_hdr_init (&archive_hdr, (writer->compressed?ARCHIVE_FLAG_DELTA:0) | (writer->framed?ARCHIVE_FLAG_FRAMED:0));
+        stage_write (&writer->file, &writer->stage, (const uint8_t*)&archive_hdr, sizeof(archive_hdr_t));
+      }
+      else if (!archive_recover (writer)) {
+        // unusable segment: leave it as it is and continue in the next one
+        return rotate_file (writer);
+      }
+    }
+    writer->index_entry.packets = 0;
+    if (config_this->fs_index_packets) {
+      archive_path (writer->index_path, writer->base, writer->segment, "idx");
+      writer->index = get_fs (writer->filesystem)->open (writer->index_path, "a+");
+    }
   }
   return true;
 }
 
-bool sync_file_json () { // to be executed periodically to avoid data loss
-  static uint32_t start_millis;
-  if (file_json) {
-    start_millis = millis();
-    file_json.close();
-    switch (config_this->buffer_fs) {
-    case FS_LITTLEFS: tm_this->fs_active = true;
-                      timer_this->publish_fs_duration += millis() - start_millis;
-                      break;
-    #ifdef PLATFORM_ESP32CAM
-    case FS_SD_MMC:   tm_this->sd_active = true;
-                      timer_this->publish_sd_duration += millis() - start_millis;
-                      break;
-    #endif
-    }    
-  }
-  return true;
+bool archive_recover (writer_t* writer) { 
+  // reopening an extended archive segment: take over its format and cut off a torn record at its end
+  uint8_t flags = 0;
+  bool recovered = archive_recover_file (writer->filesystem, writer->path, &writer->file, &writer->stage.file_size, &flags);
+  writer->compressed = flags & ARCHIVE_FLAG_DELTA;
+  writer->framed = flags & ARCHIVE_FLAG_FRAMED;
+  return recovered;
 }
 
-bool publish_file (uint8_t filesystem, uint8_t encoding, ccsds_t* ccsds_ptr) {
-  static uint16_t packet_len;
-  packet_len = get_ccsds_packet_len(ccsds_ptr);
-  if (filesystem == FS_LITTLEFS and tm_this->fs_enabled and open_file_ccsds (FS_LITTLEFS)) {
-    if (config_this->buffer_fs == FS_LITTLEFS) {
-      file_ccsds.write ((const uint8_t*)ccsds_ptr, packet_len);
-      ccsds_archive.packet_len = packet_len;
-      ccsds_archive.packet_offset = file_ccsds.position() - packet_len;
-      ccsds_archive.packet_saved = true;
-      tm_this->buffer_fs = filesystem;
-      tm_this->buffer_active = true;
-    }
-    else {
-      file_ccsds.write ((const uint8_t*)ccsds_ptr, packet_len);
-    }
-    tm_this->fs_active = true;
-    tm_this->fs_rate++;
+bool archive_recover_file (uint8_t filesystem, const char* path, File* file, uint32_t* file_size, uint8_t* flags) { 
+  // check the tail of an extended archive segment opened as *file and cut off a torn record at its end
+  // (only the tail is checked, so this does not take longer for larger archives)
+  static uint8_t window[2*ARCHIVE_FRAME_MAX_SIZE];
+  archive_hdr_t archive_hdr;
+  uint32_t size = *file_size;
+  uint32_t window_offset = sizeof(archive_hdr_t);
+  uint32_t valid_end;
+  uint32_t data_end;
+  uint16_t window_len;
+  file->seek (0);
+  if (file->read ((uint8_t*)&archive_hdr, sizeof(archive_hdr_t)) != sizeof(archive_hdr_t) or 
+      !archive_hdr_valid ((const uint8_t*)&archive_hdr, sizeof(archive_hdr_t))) {
+    return false;
+  }
+  *flags = archive_hdr.flags;
+  if (!(archive_hdr.flags & ARCHIVE_FLAG_FRAMED) or size == sizeof(archive_hdr_t)) {
     return true;
   }
-  #ifdef PLATFORM_ESP32CAM
-  else if (filesystem == FS_SD_MMC and tm_this->sd_enabled and encoding == ENC_CCSDS and open_file_ccsds (FS_SD_MMC)) {
-    if (config_this->buffer_fs == FS_SD_MMC) {
-      file_ccsds.write ((const uint8_t*)ccsds_ptr, packet_len);
-      ccsds_archive.packet_len = packet_len;
-      ccsds_archive.packet_saved = true;
-      ccsds_archive.packet_offset = file_ccsds.position() - packet_len;
-      tm_this->buffer_fs = filesystem;
-      tm_this->buffer_active = true;
+  if (filesystem == FS_SD_MMC) {
+    // a preallocated segment left behind by a reset ends in zeros, but so can the last frame (zero data, zero CRC):
+    // it starts at the last sync marker before the zeros, so look no further than a frame beyond that marker
+    data_end = fs_data_end (file, size);
+    window_offset = (data_end > sizeof(archive_hdr_t) + ARCHIVE_FRAME_MAX_SIZE)?(data_end - ARCHIVE_FRAME_MAX_SIZE):sizeof(archive_hdr_t);
+    file->seek (window_offset);
+    window_len = (data_end > window_offset)?file->read (window, data_end - window_offset):0;
+    valid_end = data_end;
+    while (window_len >= 2) {
+      window_len--;
+      if (window[window_len - 1] == ARCHIVE_SYNC_H and window[window_len] == ARCHIVE_SYNC_L) {
+        valid_end = window_offset + window_len - 1 + ARCHIVE_FRAME_MAX_SIZE;
+        break;
+      }
     }
-    else {
-      file_ccsds.write ((const uint8_t*)ccsds_ptr, packet_len);
+    if (valid_end < size) {
+      size = valid_end;
     }
-    tm_this->sd_active = true;
-    tm_this->sd_ccsds_rate++;
-    return true;
+    window_offset = sizeof(archive_hdr_t);
   }
-  else if (filesystem == FS_SD_MMC and tm_this->sd_enabled and encoding == ENC_JSON and open_file_json (FS_SD_MMC)) {
-    build_json_str (buffer, ccsds_ptr);
-    file_json.println (buffer);
-    tm_this->sd_active = true;
-    tm_this->sd_json_rate++;
+  if (size > window_offset + sizeof(window)) {
+    window_offset = size - sizeof(window);
+  }
+  file->seek (window_offset);
+  window_len = file->read (window, size - window_offset);
+  valid_end = archive_valid_end (window, window_len, window_offset);
+  if (valid_end == *file_size) {
     return true;
   }
-  #endif
-  else {
+  if (valid_end == window_offset and window_offset > sizeof(archive_hdr_t)) {
+    // no complete record in the tail window: no safe place to cut
+    return false;
+  }
+  file->close ();
+  if (!fs_truncate (filesystem, path, valid_end)) {
+    sprintf (buffer, "Failed to truncate torn record at the end of %s", path);
+    publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+    *file = get_fs (filesystem)->open (path, "a+");
     return false;
   }
+  *file = get_fs (filesystem)->open (path, "a+");
+  index_trim (filesystem, path, valid_end);
+  sprintf (buffer, "Truncated torn record at the end of %s (%u bytes)", path, *file_size - valid_end);
+  *file_size = valid_end;
+  publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+  return (bool)*file;
 }
 
-bool publish_serial (ccsds_t* ccsds_ptr) { 
-  static LinkedList<buffer_t*> serial_out_buffer;
-  static buffer_t* serial_out_buffer_entry;
+bool json_recover_file (uint8_t filesystem, const char* path, File* file, uint32_t* file_size) {
+  // cut the preallocated (zero) tail a reset left behind in a JSON segment opened as *file:
+  // JSON text has no zero bytes, so its data ends at the zeros
+  uint32_t data_end = fs_data_end (file, *file_size);
+  if (data_end == *file_size) {
+    return true;
+  }
+  file->close ();
+  if (!fs_truncate (filesystem, path, data_end)) {
+    sprintf (buffer, "Failed to truncate preallocated tail of %s", path);
+    publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+    *file = get_fs (filesystem)->open (path, "a+");
+    return false;
+  }
+  *file = get_fs (filesystem)->open (path, "a+");
+  fs_space_add (filesystem, -(int32_t)(*file_size - data_end));
+  *file_size = data_end;
+  return true;
+}
 
-  if (tm_this->serial_connected) {
-    // we can publish now
-    if (serial_out_buffer.size() == 0) {
-      // publish real-time
-      switch ((uint8_t)config_this->serial_format) {
-        case ENC_JSON:  build_json_str ((char*)&buffer, ccsds_ptr);
-                        /*if (serialTransfer.available()) {
-                            serialTransfer.sendDatum(buffer, strlen(buffer));
-                        }
-                        else {
-                            Serial.println(buffer);
-                        } */
-                        publish_udp_text(buffer);
-                        break;
-        case ENC_CCSDS: /* if (serialTransfer.available()) {
-                            serialTransfer.sendDatum((const uint8_t*)ccsds_ptr, get_ccsds_packet_len(ccsds_ptr));
-                        } */
-                        break;
-      }
-      tm_this->serial_out_rate++;
-      var_timer.last_serial_out_millis = millis();
-      return true; 
-    }
-    else {
-      // there's a buffer to empty first
-      if (open_file_ccsds (config_this->buffer_fs)) {
-        // first safely add the new packet to the buffer
-        serial_out_buffer_entry = (buffer_t*)malloc(sizeof(buffer_t));
-        serial_out_buffer_entry->packet_len = ccsds_archive.packet_len;
-        serial_out_buffer_entry->packet_offset = ccsds_archive.packet_offset;
-        serial_out_buffer.add(serial_out_buffer_entry);
-        // then replay buffer
-        uint8_t replay_count = 0;
-        while (serial_out_buffer.size() and replay_count++ < BUFFER_RELEASE_BATCH_SIZE) {
-          serial_out_buffer_entry = serial_out_buffer.remove(0);
-          file_ccsds.seek(serial_out_buffer_entry->packet_offset);         
-          file_ccsds.read((uint8_t*)&replayed_ccsds, serial_out_buffer_entry->packet_len);
-          if (valid_ccsds_hdr (&replayed_ccsds, PKT_TM)) {
-            // good packet recovered from buffer, publish
-            switch ((uint8_t)config_this->serial_format) {
-              case ENC_JSON:  build_json_str ((char*)&buffer, &replayed_ccsds);
-                              /*if (serialTransfer.available()) {
-                                  serialTransfer.sendDatum(buffer, strlen(buffer));
-                              }
-                              else {
-                                  Serial.println(buffer);
-                              }*/
-                              publish_udp_text(buffer);
-                              break;
-              case ENC_CCSDS: /* if (serialTransfer.available()) {
-                                  serialTransfer.sendDatum((const uint8_t*)&replayed_ccsds, get_ccsds_packet_len(&replayed_ccsds));
-                              } */
-                              break;
-            }            
-            tm_this->serial_out_rate++;          
+void archive_recover_mount (uint8_t filesystem) {
+  // at mount: recover the last extended archive segment and the last JSON segment of each session, 
+  // which no writer will reopen
+  FS* fs = get_fs (filesystem);
+  File root;
+  File entry;
+  File file;
+  char dir_path[32];
+  char path[40];
+  char last_path[40];
+  char last_json_path[40];
+  const char* extension;
+  uint32_t size;
+  uint8_t flags;
+  if (!fs or !(root = fs->open ("/"))) {
+    return;
+  }
+  entry = root.openNextFile ();
+  while (entry) {
+    if (entry.isDirectory ()) {
+      sprintf (dir_path, "/%s", fs_basename (entry.name()));
+      if (strcmp (dir_path, STORE_DIR)) {
+        last_path[0] = 0;
+        last_json_path[0] = 0;
+        file = entry.openNextFile ();
+        while (file) {
+          sprintf (path, "%s/%s", dir_path, fs_basename (file.name()));
+          extension = strrchr (path, '.');
+          if (extension and !strcmp (extension, ".ccsdx") and strcmp (path, last_path) > 0) { // segment numbers are zero-padded
+            strcpy (last_path, path);
           }
-          else {
-            // archive corruption
-            tm_this->err_serial_dataloss = true;            
-            sprintf (buffer, "Got invalid CCSDS packet when reading packet from buffer");
-            publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);             
+          if (extension and !strcmp (extension, ".json") and strcmp (path, last_json_path) > 0) {
+            strcpy (last_json_path, path);
           }
-          free (serial_out_buffer_entry);
-        }         
-        tm_this->fs_active = true;
-        tm_this->serial_out_buffer = min (255, serial_out_buffer.size());
-        return true;
-      }
-      else {
-        // cannot open buffer file: dataloss!
-        tm_this->serial_out_buffer = 0; // TODO: release LL and pointer memory
-        tm_this->err_serial_dataloss = true;
-        return false;
+          file = entry.openNextFile ();
+        }
+        if (last_path[0] and (file = fs->open (last_path, "r"))) {
+          size = file.size ();
+          archive_recover_file (filesystem, last_path, &file, &size, &flags);
+          file.close ();
+        }
+        if (filesystem == FS_SD_MMC and last_json_path[0] and (file = fs->open (last_json_path, "r"))) {
+          size = file.size ();
+          json_recover_file (filesystem, last_json_path, &file, &size);
+          file.close ();
+        }
       }
-    } 
-  }
-  else {
-    // no serial, we cannot publish now
-    if (ccsds_archive.packet_saved) {
-      // packet was stored on fs so we can add it to buffer index
-      serial_out_buffer_entry = (buffer_t*)malloc(sizeof(buffer_t));
-      serial_out_buffer_entry->packet_len = ccsds_archive.packet_len;
-      serial_out_buffer_entry->packet_offset = ccsds_archive.packet_offset;
-      serial_out_buffer.add(serial_out_buffer_entry);
-      tm_this->serial_out_buffer = min (255, serial_out_buffer.size());
-      return true;
     }
-    else {
-      // packet not stored on fs for buffer: dataloss!
-      tm_this->serial_out_buffer = 0; // TODO: release LL and pointer memory
-      tm_this->err_serial_dataloss = true;
+    entry = root.openNextFile ();
+  }
+  root.close ();
+}
+
+bool open_file_json (writer_t* writer) { 
+  if (!writer->file) {
+    archive_path (writer->path, writer->base, writer->segment, "json");
+    if (!open_file (writer)) {
       return false;
     }
-  } 
+    if (writer->filesystem == FS_SD_MMC and writer->stage.file_size) {
+      if (!json_recover_file (writer->filesystem, writer->path, &writer->file, &writer->stage.file_size)) {
+        // appending after the zeros would bury the new data: leave the segment as it is and continue in the next one
+        return rotate_file (writer);
+      }
+    }
+    else if (!writer->stage.file_size) {
+      return stage_prealloc (&writer->file, &writer->stage, writer->path);
+    }
+  }
+  return true;
 }
 
-bool publish_yamcs (ccsds_t* ccsds_ptr) { 
-  static LinkedList<buffer_t*> yamcs_buffer;
-  static buffer_t* yamcs_buffer_entry;
+bool sync_file (writer_t* writer) { // flush the archive to the medium without closing it
+  static uint32_t start_millis;
+  store_sync ();
+  if (writer->file) {
+    start_millis = millis();
+    stage_flush (&writer->file, &writer->stage, true);
+    writer->file.flush();
+    if (writer->index) {
+      writer->index.flush();
+    }
+    sync_file_done (writer->filesystem, millis() - start_millis);
+  }
+  writer->unsynced_bytes = 0;
+  writer->sync_millis = millis();
+  return true;
+}
 
-  if (tm_this->wifi_connected) {
-    // we can publish now
-    if (tm_this->opsmode == MODE_NOMINAL or yamcs_buffer.size() == 0) {
-      // publish real-time
-      wifiUDP.beginPacket(config_network.yamcs_server, config_network.yamcs_tm_port);
-      wifiUDP.write ((const uint8_t*)ccsds_ptr, get_ccsds_packet_len (ccsds_ptr));
-      wifiUDP.endPacket();
-      tm_this->yamcs_rate++;
-      return true; 
+void sync_file_done (uint8_t filesystem, uint16_t sync_duration) {
+  switch (filesystem) {
+  case FS_LITTLEFS: tm_this->fs_active = true;
+                    timer_this->publish_fs_duration += sync_duration;
+                    break;
+  #ifdef PLATFORM_ESP32CAM
+  case FS_SD_MMC:   tm_this->sd_active = true;
+                    timer_this->publish_sd_duration += sync_duration;
+                    break;
+  #endif
+  }
+  timer_this->sync_count++;
+  if (sync_duration > timer_this->sync_latency) {
+    timer_this->sync_latency = sync_duration;
+  }
+}
+
+bool close_file (writer_t* writer) { // to be executed before the archive changes or the filesystem goes away
+  if (writer->file) {
+    index_flush (writer);
+    sync_file (writer);
+    writer->file.close();
+    writer->index.close();
+    stage_trim (&writer->stage, writer->path);
+    writer->index_path[0] = 0;
+    fs_space[writer->filesystem].evict_idle = false; // the closed segment can be evicted now
+  }
+  return true;
+}
+
+void close_files (uint8_t filesystem) { // all archives on filesystem (FS_NONE: on all filesystems)
+  for (uint8_t w = 0; w < NUMBER_OF_WRITERS; w++) {
+    if (filesystem == FS_NONE or writers[w].filesystem == filesystem) {
+      close_file (&writers[w]);
     }
-    else {
-      // there's a buffer to empty first
-      if (open_file_ccsds (config_this->buffer_fs)) {
-        // first safely add the new packet to the buffer
-        yamcs_buffer_entry = (buffer_t*)malloc(sizeof(buffer_t));
-        yamcs_buffer_entry->packet_len = ccsds_archive.packet_len;
-        yamcs_buffer_entry->packet_offset = ccsds_archive.packet_offset;
-        yamcs_buffer.add(yamcs_buffer_entry);
-        // then replay buffer
-        uint8_t replay_count = 0;
-        while (yamcs_buffer.size() and replay_count++ < BUFFER_RELEASE_BATCH_SIZE) {
-          yamcs_buffer_entry = yamcs_buffer.remove(0);
-          file_ccsds.seek(yamcs_buffer_entry->packet_offset);         
-          file_ccsds.read((uint8_t*)&replayed_ccsds, yamcs_buffer_entry->packet_len);
-          if (valid_ccsds_hdr (&replayed_ccsds, PKT_TM)) {
-            // good packet recovered from buffer, publish
-            wifiUDP.beginPacket(config_network.yamcs_server, config_network.yamcs_tm_port);
-            wifiUDP.write ((const uint8_t*)&replayed_ccsds, yamcs_buffer_entry->packet_len);
-            wifiUDP.endPacket();
-            tm_this->yamcs_rate++;          
-          }
-          else {
-            // archive corruption
-            tm_this->err_yamcs_dataloss = true;            
-            sprintf (buffer, "Got invalid CCSDS packet when reading packet from fs");
-            publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);             
-          }
-          free (yamcs_buffer_entry);
-        }         
-        tm_this->fs_active = true;
-        tm_this->yamcs_buffer = min (255, yamcs_buffer.size());
-        return true;
-      }
-      else {
-        // cannot open buffer file: dataloss!
-        tm_this->yamcs_buffer = 0; // TODO: release LL and pointer memory
-        tm_this->err_yamcs_dataloss = true;
-        return false;
-      }
-    } 
   }
-  else {
-    // no wifi, we cannot publish now
-    if (ccsds_archive.packet_saved) {
-      // packet was stored on fs so we can add it to buffer index
-      yamcs_buffer_entry = (buffer_t*)malloc(sizeof(buffer_t));
-      yamcs_buffer_entry->packet_len = ccsds_archive.packet_len;
-      yamcs_buffer_entry->packet_offset = ccsds_archive.packet_offset;
-      yamcs_buffer.add(yamcs_buffer_entry);
-      tm_this->yamcs_buffer = min (255, yamcs_buffer.size());
-      return true;
+}
+
+bool rotate_file (writer_t* writer) { // continue the archive in its next segment
+  close_file (writer);
+  writer->segment++;
+  return ((writer->encoding == ENC_JSON)?open_file_json (writer):open_file_ccsds (writer));
+}
+
+void sync_check () {
+  // sync the archives when a trigger of the configured durability policy fires
+  static uint8_t last_opsmode = MODE_INIT;
+  static bool last_separation_sts = false;
+  uint8_t event = SYNC_NONE;
+  uint8_t trigger;
+  if (tm_this->opsmode != last_opsmode or esp32.separation_sts != last_separation_sts) {
+    last_opsmode = tm_this->opsmode;
+    last_separation_sts = esp32.separation_sts;
+    event = SYNC_EVENT;
+  }
+  for (uint8_t w = 0; w < NUMBER_OF_WRITERS; w++) {
+    trigger = event;
+    if (writers[w].unsynced_bytes >= config_this->sync_bytes) {
+      trigger |= SYNC_BYTES;
     }
-    else {
-      // packet not stored on fs for buffer: dataloss!
-      tm_this->yamcs_buffer = 0; // TODO: release LL and pointer memory
-      tm_this->err_yamcs_dataloss = true;
+    if (millis() - writers[w].sync_millis >= config_this->sync_interval) {
+      trigger |= SYNC_TIME;
+    }
+    if (writers[w].file and (trigger & config_this->sync_policy)) {
+      sync_file (&writers[w]);
+    }
+  }
+}
+
+bool stage_write (File* file, stage_t* stage, const uint8_t* data, uint16_t len) { 
+  // collect small archive writes in RAM and hand them to the file system in whole blocks
+  bool success = true;
+  if (stage->len + len > sizeof(stage->data)) {
+    success = stage_flush (file, stage, true);
+    if (stage->len + len > sizeof(stage->data)) {
+      // the file system still does not take the staged data: no room for more
       return false;
     }
-  } 
+  }
+  memcpy (stage->data + stage->len, data, len);
+  stage->len += len;
+  timer_this->archive_staged += len;
+  if (stage->len >= config_this->fs_stage_size or stage->len >= FS_STAGE_SIZE_MAX) {
+    success = stage_flush (file, stage, false) and success;
+  }
+  return success;
 }
 
-bool publish_udp (ccsds_t* ccsds_ptr) { 
-  if (tm_this->wifi_connected) { // TODO: and publish_udp_enabled???
-    build_json_str ((char*)&buffer, ccsds_ptr);
-    wifiUDP.beginPacket(config_network.udp_server, config_network.udp_port);
-    wifiUDP.println (buffer);
-    wifiUDP.endPacket();   
-    tm_this->udp_rate++;
+bool stage_flush (File* file, stage_t* stage, bool flush_all) { 
+  // write staged data up to the last block boundary in the file (or all of it)
+  uint16_t write_len = stage->len;
+  size_t written;
+  if (!flush_all) {
+    write_len = (stage->file_size + stage->len) / FS_BLOCK_SIZE * FS_BLOCK_SIZE - stage->file_size;
+  }
+  if (!write_len or !(*file)) {
     return true;
   }
-  else {
+  written = file->write (stage->data, write_len);
+  timer_this->archive_flushed += written;
+  if (stage->file_size + written > stage->extent) {
+    // writes inside a preallocated extent take no extra space
+    fs_space_add (stage->filesystem, stage->file_size + written - ((stage->file_size > stage->extent)?stage->file_size:stage->extent));
+  }
+  timer_this->archive_writes++;
+  // bytes the file system did not take stay staged, so the file has no hole and the next flush retries them
+  stage->file_size += written;
+  stage->len -= written;
+  memmove (stage->data, stage->data + written, stage->len);
+  if (written != write_len) {
+    sprintf (buffer, "Failed to write %u bytes of staged data to archive", write_len - written);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
     return false;
   }
+  return true;
 }
 
-bool publish_udp_text (const char* message) { 
-  if (tm_this->wifi_connected) { // TODO: and publish_udp_enabled???
-    wifiUDP.beginPacket(config_network.udp_server, config_network.udp_port);
-    wifiUDP.println (message);
-    wifiUDP.endPacket();   
-    tm_this->udp_rate++;
+bool stage_prealloc (File* file, stage_t* stage, const char* path) {
+  // reserve fs_prealloc kB for a new archive segment on SD, so its clusters are allocated once up front: 
+  // staged data is then written in place, and the file is trimmed to its data at close
+  // (not on LittleFS, where writing inside a file rewrites everything after it)
+  static const uint8_t zeros[FS_BLOCK_SIZE] = { 0 };
+  uint32_t extent = (uint32_t)config_this->fs_prealloc * 1024;
+  uint32_t reserved = 0;
+  stage->extent = 0;
+  if (stage->filesystem != FS_SD_MMC or !extent or stage->file_size or stage->len) {
     return true;
   }
-  else {
+  if (extent > (uint32_t)config_this->fs_segment_size * 1024) {
+    extent = (uint32_t)config_this->fs_segment_size * 1024;
+  }
+  file->close ();
+  *file = get_fs (stage->filesystem)->open (path, "w");
+  while (*file and reserved < extent and file->write (zeros, FS_BLOCK_SIZE) == FS_BLOCK_SIZE) {
+    reserved += FS_BLOCK_SIZE;
+  }
+  file->close ();
+  *file = get_fs (stage->filesystem)->open (path, "r+");
+  if (!*file) {
+    sprintf (buffer, "Failed to reopen '%s' on %s after preallocating it", path, fsName[stage->filesystem]);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
     return false;
   }
+  stage->extent = reserved;
+  fs_space_add (stage->filesystem, reserved);
+  return true;
 }
 
-#ifdef ASYNCUDP
-bool yamcs_tc_setup () {
-  if (asyncUDP_yamcs_tc.listen(config_network.yamcs_tc_port)) {
-    sprintf (buffer, "Listening for CCSDS commands on UDP port %s:%u (async)", WiFi.localIP().toString().c_str(), config_network.yamcs_tc_port);
-    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
-    asyncUDP_yamcs_tc.onPacket([](AsyncUDPPacket packet) {  
-                                                           memcpy (&ccsds_tc_buffer, packet.data(), packet.length());
-                                                           parse_ccsds ((ccsds_t*)&ccsds_tc_buffer);
-                                                         });
-  }
-  else {
-    sprintf (buffer, "Fail to listen for commands on UDP port %s:%u (async)", WiFi.localIP().toString().c_str(), config_network.yamcs_tc_port);
-    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);  
+void stage_trim (stage_t* stage, const char* path) {
+  // give back the unused part of a preallocated archive segment, once it is closed
+  if (stage->extent > stage->file_size and fs_truncate (stage->filesystem, path, stage->file_size)) {
+    fs_space_add (stage->filesystem, -(int32_t)(stage->extent - stage->file_size));
   }
+  stage->extent = 0;
 }
-#endif
 
-#ifndef ASYNCUDP
-bool yamcs_tc_setup () {
-  if (wifiUDP_yamcs_tc.begin(WiFi.localIP(), config_network.yamcs_tc_port)) {
-    sprintf (buffer, "Listening for CCSDS commands on UDP port %s:%u", WiFi.localIP().toString().c_str(), config_network.yamcs_tc_port);
-    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
-    return true;
+bool write_file_ccsds (writer_t* writer, ccsds_t* ccsds_ptr) {
+  // append one packet (raw or delta-coded) to a CCSDS archive, starting a new segment when it is full
+  uint16_t record_len = get_ccsds_packet_len (ccsds_ptr) + (writer->compressed?1:0) + (writer->framed?ARCHIVE_FRAME_OVERHEAD:0); // upper bound until encoded
+  const uint8_t* record = (const uint8_t*)ccsds_ptr;
+  uint8_t frame_hdr[4];
+  uint16_t crc;
+  if ((writer->compressed or writer->framed) and get_ccsds_packet_len (ccsds_ptr) > ARCHIVE_PACKET_MAX_SIZE) {
+    // the codec and the tail recovery window are sized for ARCHIVE_PACKET_MAX_SIZE
+    sprintf (buffer, "Packet of %u bytes too large for extended archive %s", get_ccsds_packet_len (ccsds_ptr), writer->path);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
+    if (writer->filesystem == FS_LITTLEFS) {
+      tm_this->err_fs_dataloss = true;
+    }
+    #ifdef PLATFORM_ESP32CAM
+    else {
+      tm_this->err_sd_dataloss = true;
+    }
+    #endif
+    return false;
   }
-  else {
-    sprintf (buffer, "Fail to listen for commands on UDP port %s:%u", WiFi.localIP().toString().c_str(), config_network.yamcs_tc_port);
-    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);  
+  if (writer->stage.file_size + writer->stage.len and writer->stage.file_size + writer->stage.len + record_len > (uint32_t)config_this->fs_segment_size * 1024 and !rotate_file (writer)) {
     return false;
   }
-}
-
-bool yamcs_tc_check () {
-  if (wifiUDP_yamcs_tc.parsePacket()) {
-    Serial.println ("Received command");
-    wifiUDP_yamcs_tc.read((char*)&ccsds_tc_buffer, BUFFER_MAX_SIZE);
-    parse_ccsds ((ccsds_t*)&ccsds_tc_buffer);
-    return true;
+  record_len = get_ccsds_packet_len (ccsds_ptr);
+  if (writer->index and !writer->index_entry.packets) {
+    index_begin (writer, writer->stage.file_size + writer->stage.len);
+  }
+  if (writer->compressed) {
+    record_len = archive_encode (&writer->codec, (const uint8_t*)ccsds_ptr, archive_record);
+    record = archive_record;
+  }
+  if (writer->framed) {
+    archive_frame_hdr (frame_hdr, record_len);
+    crc = archive_frame_crc (record, record_len);
+    stage_write (&writer->file, &writer->stage, frame_hdr, 4);
+    stage_write (&writer->file, &writer->stage, record, record_len);
+    frame_hdr[0] = crc >> 8;
+    frame_hdr[1] = crc & 0xFF;
+    stage_write (&writer->file, &writer->stage, frame_hdr, 2);
+    record_len += ARCHIVE_FRAME_OVERHEAD;
   }
   else {
-    return false;
+    stage_write (&writer->file, &writer->stage, record, record_len);
   }
+  writer->unsynced_bytes += record_len;
+  index_add (writer, ccsds_ptr);
+  return true;
 }
-#endif
 
-uint16_t update_packet (ccsds_t* ccsds_ptr) {
-  static uint16_t PID;
-  ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L++;
-  if (((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L == 0) {
-    ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_H++;
+void index_begin (writer_t* writer, uint32_t offset) {
+  // start a new index block; delta coding restarts so the block decodes on its own
+  writer->index_entry.offset = offset;
+  writer->index_entry.millis = millis();
+  writer->index_entry.apids = 0;
+  writer->index_entry.packets = 0;
+  if (writer->compressed) {
+    archive_codec_reset (&writer->codec);
+  }
+}
+
+void index_add (writer_t* writer, ccsds_t* ccsds_ptr) {
+  uint16_t apid = get_ccsds_apid (ccsds_ptr);
+  if (apid >= ARCHIVE_APID_BASE and apid < ARCHIVE_APID_BASE + 16) {
+    writer->index_entry.apids |= (1 << (apid - ARCHIVE_APID_BASE));
+  }
+  writer->index_entry.packets++;
+  // fs_index_packets set to 0 while the segment is open: its current block runs on to the end of the segment
+  if (config_this->fs_index_packets and (writer->index_entry.packets >= config_this->fs_index_packets or millis() - writer->index_entry.millis >= config_this->fs_index_interval)) {
+    index_flush (writer);
+  }
+}
+
+void index_flush (writer_t* writer) {
+  if (writer->index_entry.packets and writer->index) {
+    fs_space_add (writer->filesystem, writer->index.write ((const uint8_t*)&writer->index_entry, sizeof(index_entry_t)));
+  }
+  writer->index_entry.packets = 0;
+}
+
+void index_trim (uint8_t filesystem, const char* path, uint32_t end) {
+  // a segment was cut to end: drop the blocks of its .idx sidecar that started beyond it
+  FS* fs = get_fs (filesystem);
+  File file;
+  index_entry_t entry;
+  char index_path[40];
+  uint32_t entries;
+  uint32_t size;
+  const char* extension = strrchr (path, '.');
+  if (!fs or !extension or extension - path + 5 > (int)sizeof(index_path)) {
+    return;
+  }
+  sprintf (index_path, "%.*s.idx", (int)(extension - path), path);
+  if (!fs->exists (index_path) or !(file = fs->open (index_path, "r"))) {
+    return;
+  }
+  size = file.size ();
+  entries = size / sizeof(index_entry_t);
+  while (entries) {
+    file.seek ((entries - 1) * sizeof(index_entry_t));
+    if (file.read ((uint8_t*)&entry, sizeof(index_entry_t)) != sizeof(index_entry_t) or entry.offset < end) {
+      break;
+    }
+    entries--;
+  }
+  file.close ();
+  if (entries * sizeof(index_entry_t) != size) {
+    fs_truncate (filesystem, index_path, entries * sizeof(index_entry_t));
+  }
+}
+
+bool index_lookup (uint8_t filesystem, const char* index_path, uint32_t millis, index_entry_t* entry) {
+  // binary search in an .idx sidecar: last block started at or before millis (or the first block)
+  FS* fs = get_fs (filesystem);
+  File file;
+  uint32_t low = 0;
+  uint32_t high;
+  uint32_t mid;
+  if (!fs) {
+    return false;
+  }
+  file = fs->open (index_path, "r");
+  if (!file or file.size() < sizeof(index_entry_t)) {
+    return false;
+  }
+  high = file.size() / sizeof(index_entry_t);
+  while (high - low > 1) {
+    mid = low + (high - low) / 2;
+    file.seek (mid * sizeof(index_entry_t));
+    file.read ((uint8_t*)entry, sizeof(index_entry_t));
+    if (entry->millis <= millis) {
+      low = mid;
+    }
+    else {
+      high = mid;
+    }
+  }
+  file.seek (low * sizeof(index_entry_t));
+  file.read ((uint8_t*)entry, sizeof(index_entry_t));
+  file.close ();
+  return true;
+}
+
+bool publish_file (uint8_t filesystem, uint8_t encoding, ccsds_t* ccsds_ptr) {
+  writer_t* writer = get_writer (filesystem, encoding);
+  if (!writer) {
+    return false;
+  }
+  if (filesystem == FS_LITTLEFS and tm_this->fs_enabled and open_file_ccsds (writer) and write_file_ccsds (writer, ccsds_ptr)) {
+    tm_this->fs_active = true;
+    tm_this->fs_rate++;
+    sync_check ();
+    return true;
+  }
+  #ifdef PLATFORM_ESP32CAM
+  else if (filesystem == FS_SD_MMC and tm_this->sd_enabled and encoding == ENC_CCSDS and open_file_ccsds (writer) and write_file_ccsds (writer, ccsds_ptr)) {
+    tm_this->sd_active = true;
+    tm_this->sd_ccsds_rate++;
+    sync_check ();
+    return true;
+  }
+  else if (filesystem == FS_SD_MMC and tm_this->sd_enabled and encoding == ENC_JSON and open_file_json (writer)) {
+    build_json_str (buffer, ccsds_ptr);
+    if (writer->stage.file_size + writer->stage.len and writer->stage.file_size + writer->stage.len + strlen (buffer) + 2 > (uint32_t)config_this->fs_segment_size * 1024 and !rotate_file (writer)) {
+      return false;
+    }
+    stage_write (&writer->file, &writer->stage, (const uint8_t*)buffer, strlen (buffer));
+    stage_write (&writer->file, &writer->stage, (const uint8_t*)"\r\n", 2);
+    tm_this->sd_active = true;
+    tm_this->sd_json_rate++;
+    writer->unsynced_bytes += strlen (buffer) + 2;
+    sync_check ();
+    return true;
+  }
+  #endif
+  else {
+    return false;
+  }
+}
+
+void send_serial (ccsds_t* ccsds_ptr) {
+  switch ((uint8_t)config_this->serial_format) {
+    case ENC_JSON:  build_json_str ((char*)&buffer, ccsds_ptr);
+                    /*if (serialTransfer.available()) {
+                        serialTransfer.sendDatum(buffer, strlen(buffer));
+                    }
+                    else {
+                        Serial.println(buffer);
+                    } */
+                    publish_udp_text(buffer);
+                    break;
+    case ENC_CCSDS: /* if (serialTransfer.available()) {
+                        serialTransfer.sendDatum((const uint8_t*)ccsds_ptr, get_ccsds_packet_len(ccsds_ptr));
+                    } */
+                    break;
+  }
+  tm_this->serial_out_rate++;
+}
+
+bool publish_serial (ccsds_t* ccsds_ptr) { 
+  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
+  uint8_t priority = routing_priority[PID];
+  if (tm_this->serial_connected) {
+    // we can publish now
+    if ((config_this->drain_newest & (1 << priority)) or !store_queued (priority, SINK_SERIAL)) {
+      // publish real-time (also ahead of a backlog of its class that is drained newest first), within the rate of the PID
+      if (shape_pass (SINK_SERIAL, PID)) {
+        send_serial (ccsds_ptr);
+        var_timer.last_serial_out_millis = millis();
+      }
+    }
+    else {
+      // there's a buffer of its class to empty first: queue the new packet behind it
+      store_defer (SINK_SERIAL);
+    }
+    if (store_request & (1 << SINK_SERIAL) or store_pending (SINK_SERIAL)) {
+      // store_drain replays part of the buffer, most urgent class first
+      store_ready (SINK_SERIAL);
+    }
+    return true;
+  }
+  else {
+    // no serial, we cannot publish now: keep the packet in the buffer store
+    store_defer (SINK_SERIAL);
+    tm_this->serial_out_buffer = min ((uint32_t)255, store_pending (SINK_SERIAL) + 1);
+    return true;
+  } 
+}
+
+void tx_task (void* parameter) {
+  // hands queued datagrams to the WiFi stack, so that a congested driver stalls this core and not the loop
+  tx_item_t* item;
+  size_t size;
+  bool sent;
+  uint32_t latency;
+  while (true) {
+    item = (tx_item_t*)xRingbufferReceive (tx_queue, &size, portMAX_DELAY);
+    if (!item) {
+      continue;
+    }
+    wifiUDP_tx.beginPacket(IPAddress(item->ip), item->port);
+    switch (item->destination) {
+      case TX_YAMCS: wifiUDP_tx.write ((const uint8_t*)item + sizeof(tx_item_t), size - sizeof(tx_item_t));
+                     break;
+      case TX_UDP:   wifiUDP_tx.write ((const uint8_t*)item + sizeof(tx_item_t), size - sizeof(tx_item_t));
+                     wifiUDP_tx.write ((const uint8_t*)"\r\n", 2);
+                     break;
+    }
+    sent = wifiUDP_tx.endPacket();
+    latency = micros() - item->enqueue_micros;
+    vRingbufferReturnItem (tx_queue, item);
+    portENTER_CRITICAL (&tx_mux);
+    if (!sent) {
+      tx_stats.failed++;
+    }
+    if (latency > tx_stats.latency_max) {
+      tx_stats.latency_max = latency;
+    }
+    portEXIT_CRITICAL (&tx_mux);
+  }
+}
+
+bool tx_setup () {
+  tx_queue = xRingbufferCreate (TX_QUEUE_SIZE, RINGBUF_TYPE_NOSPLIT);
+  if (!tx_queue or xTaskCreatePinnedToCore (tx_task, "tx", TX_TASK_STACK, NULL, TX_TASK_PRIORITY, NULL, TX_TASK_CORE) != pdPASS) {
+    if (tx_queue) {
+      vRingbufferDelete (tx_queue);
+    }
+    tx_queue = NULL;
+    sprintf (buffer, "Failed to start transmit task: sending from the loop");
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
+    return false;
+  }
+  sprintf (buffer, "Started transmit task on core %u (%u byte queue)", TX_TASK_CORE, TX_QUEUE_SIZE);
+  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+  return true;
+}
+
+bool tx_room (uint16_t len) {
+  // whether a datagram of len bytes can be queued now
+  return (!tx_queue or xRingbufferGetCurFreeSize (tx_queue) >= sizeof(tx_item_t) + len);
+}
+
+void tx_resolve (uint8_t destination) {
+  // look up the server of a destination again when the configuration changed, or retry a failed lookup;
+  // called from wifi_check and not from tx_send, as a lookup blocks and reports an event (publish_packet)
+  tx_server_t* server = &tx_server[destination];
+  const char* configured = (destination == TX_YAMCS)?config_network.yamcs_server:config_network.udp_server;
+  IPAddress address;
+  if (strcmp (server->name, configured) or (!server->resolved and millis() - server->resolve_millis >= TX_RESOLVE_INTERVAL)) {
+    strncpy (server->name, configured, sizeof(server->name) - 1);
+    server->resolve_millis = millis();
+    server->resolved = address.fromString (configured) or WiFi.hostByName (configured, address);
+    server->ip = (uint32_t)address;
+    if (!server->resolved) {
+      sprintf (buffer, "Failed to resolve server '%s'", configured);
+      publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+    }
+  }
+}
+
+bool tx_send (uint8_t destination, const uint8_t* data, uint16_t len) {
+  // queue a datagram for the transmit task (TX_UDP: a text line, the transmit task adds the line end);
+  // false if the queue is full and the datagram is dropped
+  static uint8_t item[sizeof(tx_item_t) + BUFFER_MAX_SIZE + YAMCS_MTU_MAX];
+  uint32_t start_micros = micros();
+  uint32_t ip = tx_server[destination].ip;
+  uint16_t port = (destination == TX_YAMCS)?config_network.yamcs_tm_port:config_network.udp_port;
+  bool queued;
+  if (!tx_server[destination].resolved) {
+    return false;
+  }
+  if (!tx_queue) {
+    // no transmit task: send from the loop
+    wifiUDP.beginPacket(IPAddress(ip), port);
+    switch (destination) {
+      case TX_YAMCS: wifiUDP.write (data, len);
+                     break;
+      case TX_UDP:   wifiUDP.write (data, len);
+                     wifiUDP.write ((const uint8_t*)"\r\n", 2);
+                     break;
+    }
+    return wifiUDP.endPacket();
+  }
+  if (len > sizeof(item) - sizeof(tx_item_t)) {
+    len = sizeof(item) - sizeof(tx_item_t);
+  }
+  ((tx_item_t*)item)->destination = destination;
+  ((tx_item_t*)item)->ip = ip;
+  ((tx_item_t*)item)->port = port;
+  ((tx_item_t*)item)->enqueue_micros = start_micros;
+  memcpy (item + sizeof(tx_item_t), data, len);
+  queued = xRingbufferSend (tx_queue, item, sizeof(tx_item_t) + len, 0);
+  portENTER_CRITICAL (&tx_mux);
+  if (!queued) {
+    tx_stats.dropped++;
+  }
+  if (micros() - start_micros > tx_stats.enqueue_max) {
+    tx_stats.enqueue_max = micros() - start_micros;
+  }
+  portEXIT_CRITICAL (&tx_mux);
+  return queued;
+}
+
+void tx_collect () {
+  // once per timer packet: report and restart the transmit queue accounting
+  portENTER_CRITICAL (&tx_mux);
+  timer_this->tx_dropped = tx_stats.dropped;
+  timer_this->tx_failed = tx_stats.failed;
+  timer_this->tx_throttled = tx_stats.throttled;
+  timer_this->tx_latency = (tx_stats.latency_max / 1000 < 65535)?tx_stats.latency_max / 1000:65535;
+  timer_this->tx_enqueue = (tx_stats.enqueue_max < 65535)?tx_stats.enqueue_max:65535;
+  memset (&tx_stats, 0, sizeof(tx_stats_t));
+  portEXIT_CRITICAL (&tx_mux);
+}
+
+void send_yamcs (ccsds_t* ccsds_ptr) {
+  // with yamcs_mtu set, packets are packed back to back into datagrams (split again on the ground by fli3d_unpack)
+  uint16_t len = get_ccsds_packet_len (ccsds_ptr);
+  if (!config_this->yamcs_mtu) {
+    tx_send (TX_YAMCS, (const uint8_t*)ccsds_ptr, len);
+    tm_this->yamcs_rate++;
+    return;
+  }
+  if (yamcs_datagram.len and yamcs_datagram.len + len > config_this->yamcs_mtu) {
+    yamcs_flush ();
+  }
+  if (!yamcs_datagram.len) {
+    yamcs_datagram.millis = millis();
+  }
+  memcpy (yamcs_datagram.data + yamcs_datagram.len, ccsds_ptr, len);
+  yamcs_datagram.len += len;
+  tm_this->yamcs_rate++;
+  yamcs_flush_check ();
+}
+
+void yamcs_flush () {
+  if (!yamcs_datagram.len) {
+    return;
+  }
+  tx_send (TX_YAMCS, yamcs_datagram.data, yamcs_datagram.len);
+  yamcs_datagram.len = 0;
+}
+
+void yamcs_flush_check () {
+  // send a packed datagram that is full, or that has waited yamcs_flush ms for more packets
+  if (yamcs_datagram.len and (yamcs_datagram.len + sizeof(ccsds_hdr_t) >= config_this->yamcs_mtu or millis() - yamcs_datagram.millis >= config_this->yamcs_flush)) {
+    yamcs_flush ();
+  }
+}
+
+bool publish_yamcs (ccsds_t* ccsds_ptr) { 
+  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
+  uint8_t priority = routing_priority[PID];
+  if (tm_this->wifi_connected) {
+    // we can publish now
+    if ((config_this->drain_newest & (1 << priority)) or !store_queued (priority, SINK_YAMCS)) {
+      // publish real-time (also ahead of a backlog of its class that is drained newest first), within the rate of the PID
+      if (shape_pass (SINK_YAMCS, PID)) {
+        send_yamcs (ccsds_ptr);
+      }
+    }
+    else {
+      // there's a buffer of its class to empty first: queue the new packet behind it
+      store_defer (SINK_YAMCS);
+    }
+    if (store_request & (1 << SINK_YAMCS) or store_pending (SINK_YAMCS)) {
+      // store_drain replays part of the buffer, most urgent class first
+      store_ready (SINK_YAMCS);
+    }
+    return true;
+  }
+  else {
+    // no wifi, we cannot publish now: keep the packet in the buffer store
+    store_defer (SINK_YAMCS);
+    tm_this->yamcs_buffer = min ((uint32_t)255, store_pending (SINK_YAMCS) + 1);
+    return true;
+  } 
+}
+
+bool publish_udp (ccsds_t* ccsds_ptr) { 
+  if (tm_this->wifi_connected) { // TODO: and publish_udp_enabled???
+    if (!shape_pass (SHAPE_UDP, get_ccsds_apid (ccsds_ptr) - 42)) {
+      return true;
+    }
+    build_json_str ((char*)&buffer, ccsds_ptr);
+    tx_send (TX_UDP, (const uint8_t*)buffer, strlen (buffer));
+    tm_this->udp_rate++;
+    return true;
+  }
+  else {
+    return false;
+  }
+}
+
+bool publish_udp_text (const char* message) { 
+  if (tm_this->wifi_connected) { // TODO: and publish_udp_enabled???
+    tx_send (TX_UDP, (const uint8_t*)message, strlen (message));
+    tm_this->udp_rate++;
+    return true;
+  }
+  else {
+    return false;
+  }
+}
+
+#ifdef ASYNCUDP
+bool yamcs_tc_setup () {
+  if (asyncUDP_yamcs_tc.listen(config_network.yamcs_tc_port)) {
+    sprintf (buffer, "Listening for CCSDS commands on UDP port %u (async)", config_network.yamcs_tc_port);
+    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+    asyncUDP_yamcs_tc.onPacket([](AsyncUDPPacket packet) {  
+                                                           // runs in the AsyncUDP task: only queue the command, the loop executes it in yamcs_tc_check
+                                                           uint32_t head = tc_pool.head;
+                                                           tc_slot_t* slot;
+                                                           if (packet.length() < sizeof(ccsds_hdr_t) or packet.length() > sizeof(ccsds_t) or head - __atomic_load_n (&tc_pool.tail, __ATOMIC_ACQUIRE) >= TC_POOL_SIZE) {
+                                                             tc_pool.dropped++;
+                                                             return;
+                                                           }
+                                                           slot = &tc_pool.slot[head & (TC_POOL_SIZE - 1)];
+                                                           memcpy (&slot->ccsds, packet.data(), packet.length());
+                                                           slot->len = packet.length();
+                                                           slot->received_micros = micros();
+                                                           __atomic_store_n (&tc_pool.head, head + 1, __ATOMIC_RELEASE);
+                                                         });
+    return true;
+  }
+  else {
+    sprintf (buffer, "Fail to listen for commands on UDP port %u (async)", config_network.yamcs_tc_port);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);  
+    return false;
+  }
+}
+
+bool yamcs_tc_check () {
+  // execute the commands queued by the AsyncUDP task, oldest first, up to tc_batch commands or tc_budget ms
+  uint32_t start_millis = millis();
+  uint32_t tail = tc_pool.tail;
+  uint32_t head = __atomic_load_n (&tc_pool.head, __ATOMIC_ACQUIRE);
+  uint8_t count = 0;
+  tc_slot_t* slot;
+  if (head == tail) {
+    return false;
+  }
+  if (head - tail > tc_pool.queued_max) {
+    tc_pool.queued_max = head - tail;
+  }
+  while (tail != head and count < config_this->tc_batch and (!count or millis() - start_millis < config_this->tc_budget)) {
+    // executed in place: the slot is only handed back to the AsyncUDP task afterwards
+    slot = &tc_pool.slot[tail & (TC_POOL_SIZE - 1)];
+    if (micros() - slot->received_micros > tc_latency_max) {
+      tc_latency_max = micros() - slot->received_micros;
+    }
+    parse_ccsds (&slot->ccsds);
+    __atomic_store_n (&tc_pool.tail, ++tail, __ATOMIC_RELEASE);
+    count++;
+  }
+  return true;
+}
+#endif
+
+#ifndef ASYNCUDP
+bool yamcs_tc_setup () {
+  // bound to all interfaces: wifi_sta_setup returns before the station has an IP address
+  if (wifiUDP_yamcs_tc.begin(config_network.yamcs_tc_port)) {
+    sprintf (buffer, "Listening for CCSDS commands on UDP port %u", config_network.yamcs_tc_port);
+    publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+    return true;
+  }
+  else {
+    sprintf (buffer, "Fail to listen for commands on UDP port %u", config_network.yamcs_tc_port);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);  
+    return false;
+  }
+}
+
+bool yamcs_tc_check () {
+  // execute the commands waiting on the socket, up to tc_batch commands or tc_budget ms
+  // (receipt is taken as the start of this call: the time a command spent in the WiFi stack is not known)
+  uint32_t start_millis = millis();
+  uint32_t start_micros = micros();
+  uint8_t count = 0;
+  while (count < config_this->tc_batch and (!count or millis() - start_millis < config_this->tc_budget) and wifiUDP_yamcs_tc.parsePacket()) {
+    wifiUDP_yamcs_tc.read((char*)&ccsds_tc_buffer, sizeof(ccsds_t));
+    if (micros() - start_micros > tc_latency_max) {
+      tc_latency_max = micros() - start_micros;
+    }
+    parse_ccsds ((ccsds_t*)&ccsds_tc_buffer);
+    count++;
+  }
+  return (count > 0);
+}
+#endif
+
+void tc_collect () {
+  // once per timer packet: report and restart the command intake accounting
+  #ifdef ASYNCUDP
+  uint32_t dropped = tc_pool.dropped;
+  timer_this->tc_queued = tc_pool.queued_max;
+  timer_this->tc_dropped = (dropped - tc_pool.dropped_reported < 65535)?dropped - tc_pool.dropped_reported:65535;
+  tc_pool.dropped_reported = dropped;
+  tc_pool.queued_max = 0;
+  #endif
+  timer_this->tc_latency = (tc_latency_max / 1000 < 65535)?tc_latency_max / 1000:65535;
+  tc_latency_max = 0;
+}
+
+bool shape_pass (uint8_t shaper_id, uint16_t PID) {
+  // token bucket of a PID on a live sink: false if the packet is over its rate and is held back
+  // (it is not queued: with routing_fs it stays in the archive, for a later replay)
+  shaper_t* bucket = &shaper[shaper_id][PID];
+  uint32_t elapsed = min ((uint32_t)(millis() - bucket->refill_millis), (uint32_t)60000);
+  if (!bucket->rate) {
+    return true;
+  }
+  bucket->tokens = min ((uint32_t)(bucket->tokens + bucket->rate * elapsed), (uint32_t)(1000 * bucket->burst));
+  bucket->refill_millis = millis();
+  if (bucket->tokens < 1000) {
+    bucket->shaped++;
+    return false;
+  }
+  bucket->tokens -= 1000;
+  return true;
+}
+
+void shape_collect () {
+  // once per timer packet: report and restart the shaper accounting
+  uint16_t shaped[NUMBER_OF_SHAPERS] = { 0 };
+  uint16_t PID_shaped;
+  uint16_t PID_shaped_max = 0;
+  timer_this->shape_pid = 255;
+  for (uint16_t PID = 0; PID < NUMBER_OF_PID; PID++) {
+    PID_shaped = 0;
+    for (uint8_t shaper_id = 0; shaper_id < NUMBER_OF_SHAPERS; shaper_id++) {
+      shaped[shaper_id] += shaper[shaper_id][PID].shaped;
+      PID_shaped += shaper[shaper_id][PID].shaped;
+      shaper[shaper_id][PID].shaped = 0;
+    }
+    if (PID_shaped > PID_shaped_max) {
+      PID_shaped_max = PID_shaped;
+      timer_this->shape_pid = PID;
+    }
+  }
+  timer_this->shape_yamcs = shaped[SINK_YAMCS];
+  timer_this->shape_serial = shaped[SINK_SERIAL];
+  timer_this->shape_udp = shaped[SHAPE_UDP];
+}
+
+uint16_t update_packet (ccsds_t* ccsds_ptr) {
+  static uint16_t PID;
+  ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L++;
+  if (((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L == 0) {
+    ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_H++;
   }
   PID = get_ccsds_apid (ccsds_ptr) - 42;
   switch (PID) {
@@ -1706,7 +2956,12 @@ uint16_t update_packet (ccsds_t* ccsds_ptr) {
                          radio.esp32cam_sd_image_enabled = esp32cam.wifi_image_enabled;
                          break;
     case TIMER_ESP32:    timer_esp32.packet_ctr++;
+                         timer_esp32.sync_policy = config_esp32.sync_policy;
                          timer_esp32.idle_duration = max(0, 1000 - timer_esp32.radio_duration - timer_esp32.pressure_duration - timer_esp32.motion_duration - timer_esp32.gps_duration - timer_esp32.esp32cam_duration - timer_esp32.serial_duration - timer_esp32.ota_duration - timer_esp32.ftp_duration - timer_esp32.wifi_duration - timer_esp32.tc_duration);
+                         drain_adapt ();
+                         tx_collect ();
+                         tc_collect ();
+                         shape_collect ();
                          break;
     case TC_ESP32CAM:    // do nothing
                          break;
@@ -1743,130 +2998,874 @@ uint16_t update_packet (ccsds_t* ccsds_ptr) {
     case TM_CAMERA:      ov2640.packet_ctr++; 
                          break;     
     case TIMER_ESP32CAM: timer_esp32cam.packet_ctr++;
+                         timer_esp32cam.sync_policy = config_esp32cam.sync_policy;
                          timer_esp32cam.idle_duration = max(0, 1000 - timer_esp32cam.sd_duration - timer_esp32cam.camera_duration - timer_esp32cam.serial_duration - timer_esp32cam.ftp_duration - timer_esp32cam.wifi_duration - timer_esp32cam.tc_duration);
+                         drain_adapt ();
+                         tx_collect ();
+                         tc_collect ();
+                         shape_collect ();
                          break;                     
     case TC_ESP32:       // do nothing
                          break;
     #endif
   }
-  return (PID);
+  return (PID);
+}
+
+void reset_packet (ccsds_t* ccsds_ptr) { 
+  switch (get_ccsds_apid (ccsds_ptr) - 42) {
+    #ifdef PLATFORM_ESP32
+    case STS_ESP32:      sts_esp32.message[0] = 0;
+                         break;
+    case TM_ESP32:       esp32.radio_rate = 0;
+                         esp32.pressure_rate = 0;
+                         esp32.motion_rate = 0;
+                         esp32.gps_rate = 0;
+                         esp32.camera_rate = 0;
+                         esp32.udp_rate = 0;
+                         esp32.yamcs_rate = 0;
+                         esp32.serial_out_rate = 0;    
+                         esp32.serial_in_rate = 0;  
+                         esp32.fs_rate = 0;
+                         //esp32.warn_serial_connloss = false;
+                         //esp32.warn_wifi_connloss = false;
+                         //esp32.err_serial_dataloss = false;
+                         //esp32.err_yamcs_dataloss = false;    
+                         //esp32.err_fs_dataloss = false;    
+                         esp32.radio_active = false;
+                         esp32.pressure_active = false;
+                         esp32.motion_active = false;
+                         esp32.gps_active = false; 
+                         esp32.camera_active = false;
+                         esp32.fs_active = false;
+                         esp32.ftp_active = false;
+                         esp32.buffer_active = false;
+                         esp32.ota_enabled = false;
+                         break;
+    case TM_GPS:         esp32.gps_rate++;
+                         neo6mv2.status = 8;  // set default to "none"
+                         break;
+    case TM_MOTION:      esp32.motion_rate++;
+                         break;
+    case TM_PRESSURE:    esp32.pressure_rate++;
+                         break;
+    case TM_RADIO:       radio.pressure_active = false;
+                         radio.motion_active = false;
+                         radio.gps_active = false; 
+                         radio.camera_active = false; 
+                         esp32.radio_rate++;
+                         esp32.radio_active = true;
+                         break;
+    case TIMER_ESP32:    timer_esp32.radio_duration = 0;
+                         timer_esp32.pressure_duration = 0;
+                         timer_esp32.motion_duration = 0;
+                         timer_esp32.gps_duration = 0;
+                         timer_esp32.esp32cam_duration = 0;
+                         timer_esp32.serial_duration = 0;
+                         timer_esp32.ota_duration = 0;
+                         timer_esp32.ftp_duration = 0;
+                         timer_esp32.wifi_duration = 0;
+                         timer_esp32.tc_duration = 0;
+                         timer_esp32.idle_duration = 0;
+                         timer_esp32.publish_fs_duration = 0;
+                         timer_esp32.publish_serial_duration = 0;
+                         timer_esp32.publish_yamcs_duration = 0;
+                         timer_esp32.publish_udp_duration = 0;
+                         timer_esp32.archive_staged = 0;
+                         timer_esp32.archive_flushed = 0;
+                         timer_esp32.archive_writes = 0;
+                         timer_esp32.sync_count = 0;
+                         timer_esp32.sync_latency = 0;
+                         break;    
+    case TC_ESP32CAM:    tc_esp32cam.parameter[0] = 0;
+                         break;
+    #endif
+    #ifdef PLATFORM_ESP32CAM
+    case STS_ESP32CAM:   sts_esp32cam.message[0] = 0;
+                         break;
+    case TM_ESP32CAM:    esp32cam.camera_rate = 0;
+                         esp32cam.udp_rate = 0;
+                         esp32cam.yamcs_rate = 0;
+                         esp32cam.serial_in_rate = 0;
+                         esp32cam.serial_out_rate = 0;
+                         esp32cam.fs_rate = 0;
+                         esp32cam.sd_json_rate = 0;
+                         esp32cam.sd_ccsds_rate = 0;
+                         esp32cam.sd_image_rate = 0;
+                         //esp32cam.warn_serial_connloss = false;
+                         //esp32cam.warn_wifi_connloss = false;
+                         //esp32cam.err_serial_dataloss = false;
+                         //esp32cam.err_yamcs_dataloss = false;    
+                         //esp32cam.err_fs_dataloss = false;    
+                         //esp32cam.err_sd_dataloss = false;    
+                         esp32cam.camera_active = false;
+                         esp32cam.fs_active = false;
+                         esp32cam.sd_active = false;
+                         esp32cam.ftp_active = false;
+                         esp32cam.http_active = false;
+                         esp32cam.buffer_active = false; 
+                         esp32cam.ota_enabled = false; 
+                         break;
+    case TM_CAMERA:      strcpy (ov2640.filename, "");
+                         ov2640.filesize = 0;
+                         ov2640.wifi_ms = 0;
+                         ov2640.sd_ms = 0;
+                         ov2640.exposure_ms = 0;
+                         esp32.camera_rate++;
+                         esp32.camera_active = true;
+                         radio.camera_active = true;  
+                         break;
+    case TIMER_ESP32CAM: timer_esp32cam.camera_duration = 0;
+                         timer_esp32cam.serial_duration = 0;
+                         timer_esp32cam.tc_duration = 0;
+                         timer_esp32cam.sd_duration = 0;
+                         timer_esp32cam.ftp_duration = 0;
+                         timer_esp32cam.wifi_duration = 0;
+                         timer_esp32cam.idle_duration = 0;
+                         timer_esp32cam.publish_sd_duration = 0;
+                         timer_esp32cam.publish_fs_duration = 0;
+                         timer_esp32cam.publish_serial_duration = 0;
+                         timer_esp32cam.publish_yamcs_duration = 0;
+                         timer_esp32cam.publish_udp_duration = 0;
+                         timer_esp32cam.archive_staged = 0;
+                         timer_esp32cam.archive_flushed = 0;
+                         timer_esp32cam.archive_writes = 0;
+                         timer_esp32cam.sync_count = 0;
+                         timer_esp32cam.sync_latency = 0;
+                         break;                     
+    case TC_ESP32:       tc_esp32.parameter[0] = 0;
+                         break;
+    #endif
+  }
+}
+
+// TM BUFFER STORE FUNCTIONALITY
+// Packets that a sink cannot send right away are appended to a ring of fixed-size segment files.
+// Each record is a sink mask byte, the CCSDS packet and a CRC-16 over both. The head, tail, 
+// per-sink cursors and pending counts are saved to alternating state files, so the buffer 
+// survives a reboot.
+
+void reader_reset (reader_t* reader) {
+  reader->offset = 0;
+  reader->len = 0;
+}
+
+bool reader_cached (reader_t* reader, uint32_t offset, uint16_t len) {
+  return (offset >= reader->offset and offset + len <= reader->offset + reader->len);
+}
+
+bool reader_read (File* file, reader_t* reader, uint32_t offset, uint8_t* data, uint16_t len) {
+  // serve sequential reads from a read-ahead block, refilling it with one large read on a miss
+  if (!reader_cached (reader, offset, len)) {
+    reader->len = 0;
+    if (!(*file) or !file->seek (offset)) {
+      return false;
+    }
+    reader->offset = offset;
+    reader->len = file->read (reader->data, READ_AHEAD_SIZE);
+    if (!reader_cached (reader, offset, len)) {
+      return false;
+    }
+  }
+  memcpy (data, reader->data + (offset - reader->offset), len);
+  return true;
+}
+
+void store_segment_path (char* path, uint8_t segment) {
+  sprintf (path, "%s/seg%02u", STORE_DIR, segment);
+}
+
+bool store_pos_equal (store_pos_t* pos1, store_pos_t* pos2) {
+  return (pos1->segment == pos2->segment and pos1->offset == pos2->offset);
+}
+
+uint32_t store_distance (uint8_t segment, uint32_t offset) {
+  // position in the ring counted from the start of the tail segment, to order records across segments
+  return ((segment + STORE_SEGMENTS - store_state.tail.segment) % STORE_SEGMENTS) * STORE_SEGMENT_SIZE + offset;
+}
+
+void store_index_reset () {
+  store_index.first = 0;
+  store_index.next = 0;
+  memset (store_index.hint, 0, sizeof(store_index.hint));
+}
+
+void store_index_add (uint32_t offset, uint16_t len, uint8_t flags) {
+  // index a record just appended to the head segment; the oldest entry makes way when the ring is full
+  store_entry_t* entry = &store_index.entry[store_index.next % STORE_INDEX_SIZE];
+  entry->segment = store_state.head.segment;
+  entry->offset = offset;
+  entry->len = len;
+  entry->flags = flags;
+  store_index.next++;
+  if (store_index.next - store_index.first > STORE_INDEX_SIZE) {
+    store_index.first = store_index.next - STORE_INDEX_SIZE;
+  }
+}
+
+void store_index_drop (uint8_t segment) {
+  // forget the entries (and the last read record) of a segment that leaves the ring (always the oldest ones)
+  if (store_last.pos.segment == segment) {
+    store_last.len = 0;
+  }
+  while (store_index.first != store_index.next and store_index.entry[store_index.first % STORE_INDEX_SIZE].segment == segment) {
+    store_index.first++;
+  }
+}
+
+bool store_index_find (uint8_t priority, uint8_t sink, store_pos_t* pos, uint32_t* sequence) {
+  // sequence number of the indexed record at pos: the queue's hint, or else a binary search (entries are in ring order)
+  store_entry_t* entry;
+  uint32_t low = store_index.first;
+  uint32_t high = store_index.next;
+  uint32_t mid;
+  uint32_t target = store_distance (pos->segment, pos->offset);
+  uint32_t distance;
+  uint32_t hint = store_index.hint[priority][sink];
+  if (hint - low < high - low) {
+    entry = &store_index.entry[hint % STORE_INDEX_SIZE];
+    if (entry->segment == pos->segment and entry->offset == pos->offset) {
+      *sequence = hint;
+      return true;
+    }
+  }
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    entry = &store_index.entry[mid % STORE_INDEX_SIZE];
+    distance = store_distance (entry->segment, entry->offset);
+    if (distance == target) {
+      *sequence = mid;
+      return true;
+    }
+    if (distance < target) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+bool store_wanted (uint8_t flags, uint8_t priority, uint8_t sink) {
+  return ((flags & (1 << sink)) and (flags >> STORE_PRIORITY_SHIFT) == priority);
+}
+
+void store_index_skip (uint8_t priority, uint8_t sink, store_pos_t* pos) {
+  // move pos over indexed records of its segment that are not in this queue, without reading them from the file system
+  store_entry_t* entry;
+  uint32_t sequence;
+  if (!store_index_find (priority, sink, pos, &sequence)) {
+    return;
+  }
+  while (sequence != store_index.next) {
+    entry = &store_index.entry[sequence % STORE_INDEX_SIZE];
+    if (entry->segment != pos->segment or store_wanted (entry->flags, priority, sink)) {
+      break;
+    }
+    pos->offset = entry->offset + entry->len;
+    sequence++;
+  }
+  store_index.hint[priority][sink] = sequence;
+}
+
+void store_dataloss (uint8_t sink) {
+  switch (sink) {
+    case SINK_YAMCS:  tm_this->err_yamcs_dataloss = true;
+                      break;
+    case SINK_SERIAL: tm_this->err_serial_dataloss = true;
+                      break;
+  }
+}
+
+void store_roll () {
+  char path[24];
+  uint8_t next = (store_state.head.segment + 1) % STORE_SEGMENTS;
+  store_file.close ();
+  if (next == store_state.tail.segment) {
+    // ring is full: recycle the oldest segment
+    store_index_drop (next);
+    store_state.tail.segment = (next + 1) % STORE_SEGMENTS;
+    store_state.tail.offset = 0;
+    for (uint8_t priority = 0; priority < NUMBER_OF_PRIORITIES; priority++) {
+      for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+        if (store_state.pending[next][priority][sink]) {
+          store_state.pending[next][priority][sink] = 0;
+          store_dataloss (sink);
+        }
+      }
+    }
+  }
+  memset (store_state.offset[next], 0, sizeof(store_state.offset[next]));
+  if (store_read_segment == next) {
+    store_read_file.close ();
+    store_read_segment = STORE_SEGMENTS;
+    reader_reset (&store_reader);
+  }
+  store_segment_path (path, next);
+  fs_space_add (store_fs, -(int32_t)fs_file_size (store_fs, path)); // recycled segment: its records were accounted for when written
+  store_file = get_fs (store_fs)->open (path, "w");
+  store_state.head.segment = next;
+  store_state.head.offset = 0;
+  store_dirty = true;
+  store_sync ();
+}
+
+void store_trim () {
+  char path[24];
+  while (store_fs != FS_NONE and store_state.tail.segment != store_state.head.segment) {
+    for (uint8_t priority = 0; priority < NUMBER_OF_PRIORITIES; priority++) {
+      for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+        if (store_state.pending[store_state.tail.segment][priority][sink]) {
+          return;
+        }
+      }
+    }
+    // every queue is done with the oldest segment: give its space back to the file system
+    if (store_read_segment == store_state.tail.segment) {
+      store_read_file.close ();
+      store_read_segment = STORE_SEGMENTS;
+      reader_reset (&store_reader);
+    }
+    store_segment_path (path, store_state.tail.segment);
+    fs_space_add (store_fs, -(int32_t)fs_file_size (store_fs, path));
+    get_fs (store_fs)->remove (path);
+    store_index_drop (store_state.tail.segment);
+    store_state.tail.segment = (store_state.tail.segment + 1) % STORE_SEGMENTS;
+    store_state.tail.offset = 0;
+    store_dirty = true;
+  }
+}
+
+void store_recover () {
+  // count records appended after the state was last saved
+  uint32_t size = store_file.size ();
+  uint8_t flags;
+  uint8_t crc[2];
+  uint16_t packet_len;
+  if (store_state.head.offset > size) {
+    store_state.head.offset = size;
+  }
+  while (size - store_state.head.offset >= STORE_RECORD_OVERHEAD + sizeof(ccsds_hdr_t)) {
+    store_file.seek (store_state.head.offset);
+    store_file.read (&flags, 1);
+    store_file.read ((uint8_t*)&replayed_ccsds, sizeof(ccsds_hdr_t));
+    packet_len = get_ccsds_packet_len (&replayed_ccsds);
+    if (packet_len > sizeof(ccsds_t) or store_state.head.offset + STORE_RECORD_OVERHEAD + packet_len > size) {
+      break;
+    }
+    store_file.read ((uint8_t*)&replayed_ccsds + sizeof(ccsds_hdr_t), packet_len - sizeof(ccsds_hdr_t));
+    store_file.read (crc, 2);
+    if (256*crc[0] + crc[1] != crc16 ((const uint8_t*)&replayed_ccsds, packet_len, crc16 (&flags, 1)) or
+        (flags >> STORE_PRIORITY_SHIFT) >= NUMBER_OF_PRIORITIES) {
+      break;
+    }
+    for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+      if (flags & (1 << sink)) {
+        store_state.pending[store_state.head.segment][flags >> STORE_PRIORITY_SHIFT][sink]++;
+      }
+    }
+    store_state.head.offset += STORE_RECORD_OVERHEAD + packet_len;
+  }
+  if (store_state.head.offset != size) {
+    // torn record at the end of the head segment: continue in a fresh segment
+    store_roll ();
+  }
+}
+bool store_setup (uint8_t filesystem) {
+  FS* fs = get_fs (filesystem);
+  store_state_t slot_state;
+  File file;
+  char path[24];
+  bool recovered = false;
+  store_attempted_fs = filesystem;
+  store_fs = FS_NONE;
+  store_file.close ();
+  store_read_file.close ();
+  store_read_segment = STORE_SEGMENTS;
+  reader_reset (&store_reader);
+  store_index_reset ();
+  store_last.len = 0;
+  if (!fs) {
+    return false;
+  }
+  fs->mkdir (STORE_DIR);
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    sprintf (path, "%s/state%u", STORE_DIR, slot);
+    file = fs->open (path, "r");
+    if (file) {
+      if (file.read ((uint8_t*)&slot_state, sizeof(store_state_t)) == sizeof(store_state_t) and
+          slot_state.crc == crc16 ((const uint8_t*)&slot_state, sizeof(store_state_t) - 2) and
+          slot_state.version == STORE_VERSION and
+          slot_state.segments == STORE_SEGMENTS and
+          (!recovered or slot_state.sequence > store_state.sequence)) {
+        memcpy (&store_state, &slot_state, sizeof(store_state_t));
+        recovered = true;
+      }
+      file.close ();
+    }
+  }
+  if (!recovered) {
+    // no usable state: start with an empty ring
+    for (uint8_t segment = 0; segment < STORE_SEGMENTS; segment++) {
+      store_segment_path (path, segment);
+      fs->remove (path);
+    }
+    memset (&store_state, 0, sizeof(store_state_t));
+    store_state.version = STORE_VERSION;
+    store_state.segments = STORE_SEGMENTS;
+  }
+  store_segment_path (path, store_state.head.segment);
+  store_file = fs->open (path, "a+");
+  if (!store_file) {
+    sprintf (buffer, "Failed to open TM buffer store '%s' on %s", path, fsName[filesystem]);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
+    tm_this->buffer_fs = FS_NONE;
+    return false;
+  }
+  store_fs = filesystem;
+  if (recovered) {
+    store_recover ();
+  }
+  store_dirty = true;
+  store_sync ();
+  tm_this->buffer_fs = filesystem;
+  sprintf (buffer, "Mounted TM buffer store on %s (%u x %u kB); pending: %u to yamcs, %u to serial", fsName[filesystem], STORE_SEGMENTS, STORE_SEGMENT_SIZE/1024, store_pending (SINK_YAMCS), store_pending (SINK_SERIAL));
+  publish_event (STS_THIS, SS_THIS, EVENT_INIT, buffer);
+  return true;
+}
+
+void store_defer (uint8_t sink) {
+  store_request |= (1 << sink);
+}
+
+bool store_commit (ccsds_t* ccsds_ptr) {
+  uint16_t crc;
+  uint8_t sinks = store_request;
+  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
+  uint8_t priority = (PID < NUMBER_OF_PID)?routing_priority[PID]:PRIORITY_SCIENCE;
+  uint8_t flags = sinks | (priority << STORE_PRIORITY_SHIFT);
+  uint16_t packet_len = get_ccsds_packet_len (ccsds_ptr);
+  store_request = 0;
+  if (!sinks) {
+    return true;
+  }
+  if (store_fs != config_this->buffer_fs and store_attempted_fs != config_this->buffer_fs) {
+    store_setup (config_this->buffer_fs);
+  }
+  if (store_fs == FS_NONE) {
+    // no buffer store: dataloss!
+    for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+      if (sinks & (1 << sink)) {
+        store_dataloss (sink);
+      }
+    }
+    return false;
+  }
+  if (store_state.head.offset + STORE_RECORD_OVERHEAD + packet_len > STORE_SEGMENT_SIZE) {
+    store_roll ();
+  }
+  crc = crc16 ((const uint8_t*)ccsds_ptr, packet_len, crc16 (&flags, 1));
+  if (store_file.write (flags) != 1 or store_file.write ((const uint8_t*)ccsds_ptr, packet_len) != packet_len or
+      store_file.write ((uint8_t)(crc >> 8)) != 1 or store_file.write ((uint8_t)crc) != 1) {
+    sprintf (buffer, "Failed to append packet to TM buffer store on %s", fsName[store_fs]);
+    publish_event (STS_THIS, SS_THIS, EVENT_ERROR, buffer);
+    for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+      if (sinks & (1 << sink)) {
+        store_dataloss (sink);
+      }
+    }
+    return false;
+  }
+  for (uint8_t queue = 0; queue < NUMBER_OF_PRIORITIES; queue++) {
+    for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+      if (queue == priority and (sinks & (1 << sink))) {
+        store_state.pending[store_state.head.segment][queue][sink]++;
+      }
+      else if (!store_state.pending[store_state.head.segment][queue][sink]) {
+        // queue is up to date and does not need this packet: skip it
+        store_state.offset[store_state.head.segment][queue][sink] = store_state.head.offset + STORE_RECORD_OVERHEAD + packet_len;
+      }
+    }
+  }
+  store_index_add (store_state.head.offset, STORE_RECORD_OVERHEAD + packet_len, flags);
+  store_state.head.offset += STORE_RECORD_OVERHEAD + packet_len;
+  fs_space_add (store_fs, STORE_RECORD_OVERHEAD + packet_len);
+  store_dirty = true;
+  tm_this->buffer_fs = store_fs;
+  tm_this->buffer_active = true;
+  if (millis() - store_sync_millis > STORE_SYNC_INTERVAL) {
+    store_sync ();
+  }
+  return true;
+}
+
+bool store_read (uint8_t priority, uint8_t sink, ccsds_t* ccsds_ptr) {
+  // next record of a queue: from the oldest segment that holds any, or from the newest one if the class is drained newest first
+  store_pos_t pos;
+  uint16_t* pending;
+  uint16_t* offset;
+  uint8_t flags;
+  uint8_t crc[2];
+  uint16_t packet_len;
+  char path[24];
+  if (store_fs == FS_NONE) {
+    return false;
+  }
+  for (uint8_t i = 0; i < STORE_SEGMENTS; i++) {
+    if (config_this->drain_newest & (1 << priority)) {
+      pos.segment = (store_state.head.segment + STORE_SEGMENTS - i) % STORE_SEGMENTS;
+    }
+    else {
+      pos.segment = (store_state.tail.segment + i) % STORE_SEGMENTS;
+    }
+    pending = &store_state.pending[pos.segment][priority][sink];
+    offset = &store_state.offset[pos.segment][priority][sink];
+    while (*pending) {
+      pos.offset = *offset;
+      store_index_skip (priority, sink, &pos);
+      if (store_last.len and store_pos_equal (&pos, &store_last.pos)) {
+        // record just read for another queue (e.g. another sink after a shared outage): no second read from the file system
+        flags = store_last.flags;
+        packet_len = store_last.len - STORE_RECORD_OVERHEAD;
+        memcpy (ccsds_ptr, &store_last.packet, packet_len);
+      }
+      else {
+        if (store_read_segment != pos.segment) {
+          store_read_file.close ();
+          store_segment_path (path, pos.segment);
+          store_read_file = get_fs (store_fs)->open (path, "r");
+          store_read_segment = pos.segment;
+          reader_reset (&store_reader);
+        }
+        if (pos.segment == store_state.head.segment and !reader_cached (&store_reader, pos.offset, STORE_RECORD_OVERHEAD + sizeof(ccsds_t))) {
+          store_file.flush (); // make the latest appends visible to the read handle before it reads ahead
+        }
+        packet_len = 0;
+        if (reader_read (&store_read_file, &store_reader, pos.offset, &flags, 1) and
+            reader_read (&store_read_file, &store_reader, pos.offset + 1, (uint8_t*)ccsds_ptr, sizeof(ccsds_hdr_t))) {
+          packet_len = get_ccsds_packet_len (ccsds_ptr);
+          if (packet_len > sizeof(ccsds_t) or 
+              !reader_read (&store_read_file, &store_reader, pos.offset + 1 + sizeof(ccsds_hdr_t), (uint8_t*)ccsds_ptr + sizeof(ccsds_hdr_t), packet_len - sizeof(ccsds_hdr_t)) or
+              !reader_read (&store_read_file, &store_reader, pos.offset + 1 + packet_len, crc, 2) or
+              256*crc[0] + crc[1] != crc16 ((const uint8_t*)ccsds_ptr, packet_len, crc16 (&flags, 1))) {
+            packet_len = 0;
+          }
+        }
+        if (!packet_len) {
+          // end of segment (or torn/corrupt record) before the queue's records were found: they are lost
+          *pending = 0;
+          store_dirty = true;
+          store_dataloss (sink);
+          break;
+        }
+        store_last.pos = pos;
+        store_last.len = STORE_RECORD_OVERHEAD + packet_len;
+        store_last.flags = flags;
+        memcpy (&store_last.packet, ccsds_ptr, packet_len);
+      }
+      *offset = pos.offset + STORE_RECORD_OVERHEAD + packet_len;
+      store_dirty = true;
+      if (store_wanted (flags, priority, sink)) {
+        (*pending)--;
+        tm_this->buffer_active = true;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void store_ready (uint8_t sink) {
+  store_release |= (1 << sink);
+}
+
+void store_drain () {
+  // replay backlog records to the sinks that are ready for them, as far as the drain rate allows, taking the sinks in turn
+  // record by record (each from its most urgent non-empty queue): sinks draining the same stretch of the store then get
+  // each record from a single read (store_last)
+  uint8_t released = store_release;
+  uint8_t sinks = store_release;
+  uint8_t priority;
+  uint32_t start_micros = micros();
+  store_release = 0;
+  drain.tokens += (float)drain.rate * (millis() - drain.refill_millis) / 1000;
+  drain.refill_millis = millis();
+  if (drain.tokens > DRAIN_BURST) {
+    drain.tokens = DRAIN_BURST;
+  }
+  while (sinks and drain.tokens >= 1) {
+    if (!tx_room (YAMCS_MTU_MAX)) {
+      // transmit queue filling up: leave the rest of the backlog in the store for now
+      portENTER_CRITICAL (&tx_mux);
+      tx_stats.throttled++;
+      portEXIT_CRITICAL (&tx_mux);
+      break;
+    }
+    for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+      if (!(sinks & (1 << sink))) {
+        continue;
+      }
+      priority = 0;
+      while (priority < NUMBER_OF_PRIORITIES and !store_read (priority, sink, &replayed_ccsds)) {
+        priority++;
+      }
+      if (priority == NUMBER_OF_PRIORITIES) {
+        sinks &= ~(1 << sink);
+        continue;
+      }
+      drain.tokens--;
+      drain.sent++;
+      if (!valid_ccsds_hdr (&replayed_ccsds, PKT_TM)) {
+        // archive corruption
+        store_dataloss (sink);
+        sprintf (buffer, "Got invalid CCSDS packet when reading packet from buffer");
+        publish_event (STS_THIS, SS_THIS, EVENT_WARNING, buffer);
+        continue;
+      }
+      // good packet recovered from buffer, publish
+      switch (sink) {
+        case SINK_YAMCS:  send_yamcs (&replayed_ccsds);
+                          break;
+        case SINK_SERIAL: send_serial (&replayed_ccsds);
+                          break;
+      }
+    }
+  }
+  if (released & (1 << SINK_YAMCS)) {
+    tm_this->yamcs_buffer = min ((uint32_t)255, store_pending (SINK_YAMCS));
+  }
+  if (released & (1 << SINK_SERIAL)) {
+    tm_this->serial_out_buffer = min ((uint32_t)255, store_pending (SINK_SERIAL));
+  }
+  store_trim ();
+  drain.busy_micros += micros() - start_micros;
+}
+
+void drain_adapt () {
+  // once per timer packet: size the drain rate to a share of the loop idle time, at the measured cost of releasing a record
+  uint32_t pending = 0;
+  uint32_t cost;
+  uint32_t target;
+  for (uint8_t sink = 0; sink < NUMBER_OF_SINKS; sink++) {
+    if (store_pending (sink) > pending) {
+      pending = store_pending (sink);
+    }
+  }
+  if (drain.sent) {
+    cost = drain.busy_micros / drain.sent; // us per record, read and send
+    if (!cost) {
+      cost = 1;
+    }
+    target = (uint32_t)timer_this->idle_duration * 10 * DRAIN_IDLE_SHARE / cost;
+    if (target < DRAIN_RATE_MIN) {
+      target = DRAIN_RATE_MIN;
+    }
+    if (target > DRAIN_RATE_MAX) {
+      target = DRAIN_RATE_MAX;
+    }
+    drain.rate = (drain.rate + target) / 2; // smooth over two seconds
+  }
+  drain.sent = 0;
+  drain.busy_micros = 0;
+  timer_this->drain_rate = drain.rate;
+  timer_this->drain_eta = (pending / drain.rate < 65535)?(pending + drain.rate - 1) / drain.rate:65535;
 }
 
-void reset_packet (ccsds_t* ccsds_ptr) { 
-  switch (get_ccsds_apid (ccsds_ptr) - 42) {
-    #ifdef PLATFORM_ESP32
-    case STS_ESP32:      sts_esp32.message[0] = 0;
-                         break;
-    case TM_ESP32:       esp32.radio_rate = 0;
-                         esp32.pressure_rate = 0;
-                         esp32.motion_rate = 0;
-                         esp32.gps_rate = 0;
-                         esp32.camera_rate = 0;
-                         esp32.udp_rate = 0;
-                         esp32.yamcs_rate = 0;
-                         esp32.serial_out_rate = 0;    
-                         esp32.serial_in_rate = 0;  
-                         esp32.fs_rate = 0;
-                         //esp32.warn_serial_connloss = false;
-                         //esp32.warn_wifi_connloss = false;
-                         //esp32.err_serial_dataloss = false;
-                         //esp32.err_yamcs_dataloss = false;    
-                         //esp32.err_fs_dataloss = false;    
-                         esp32.radio_active = false;
-                         esp32.pressure_active = false;
-                         esp32.motion_active = false;
-                         esp32.gps_active = false; 
-                         esp32.camera_active = false;
-                         esp32.fs_active = false;
-                         esp32.ftp_active = false;
-                         esp32.buffer_active = false;
-                         esp32.ota_enabled = false;
-                         break;
-    case TM_GPS:         esp32.gps_rate++;
-                         neo6mv2.status = 8;  // set default to "none"
-                         break;
-    case TM_MOTION:      esp32.motion_rate++;
-                         break;
-    case TM_PRESSURE:    esp32.pressure_rate++;
-                         break;
-    case TM_RADIO:       radio.pressure_active = false;
-                         radio.motion_active = false;
-                         radio.gps_active = false; 
-                         radio.camera_active = false; 
-                         esp32.radio_rate++;
-                         esp32.radio_active = true;
-                         break;
-    case TIMER_ESP32:    timer_esp32.radio_duration = 0;
-                         timer_esp32.pressure_duration = 0;
-                         timer_esp32.motion_duration = 0;
-                         timer_esp32.gps_duration = 0;
-                         timer_esp32.esp32cam_duration = 0;
-                         timer_esp32.serial_duration = 0;
-                         timer_esp32.ota_duration = 0;
-                         timer_esp32.ftp_duration = 0;
-                         timer_esp32.wifi_duration = 0;
-                         timer_esp32.tc_duration = 0;
-                         timer_esp32.idle_duration = 0;
-                         timer_esp32.publish_fs_duration = 0;
-                         timer_esp32.publish_serial_duration = 0;
-                         timer_esp32.publish_yamcs_duration = 0;
-                         timer_esp32.publish_udp_duration = 0;
-                         break;    
-    case TC_ESP32CAM:    tc_esp32cam.parameter[0] = 0;
-                         break;
-    #endif
-    #ifdef PLATFORM_ESP32CAM
-    case STS_ESP32CAM:   sts_esp32cam.message[0] = 0;
-                         break;
-    case TM_ESP32CAM:    esp32cam.camera_rate = 0;
-                         esp32cam.udp_rate = 0;
-                         esp32cam.yamcs_rate = 0;
-                         esp32cam.serial_in_rate = 0;
-                         esp32cam.serial_out_rate = 0;
-                         esp32cam.fs_rate = 0;
-                         esp32cam.sd_json_rate = 0;
-                         esp32cam.sd_ccsds_rate = 0;
-                         esp32cam.sd_image_rate = 0;
-                         //esp32cam.warn_serial_connloss = false;
-                         //esp32cam.warn_wifi_connloss = false;
-                         //esp32cam.err_serial_dataloss = false;
-                         //esp32cam.err_yamcs_dataloss = false;    
-                         //esp32cam.err_fs_dataloss = false;    
-                         //esp32cam.err_sd_dataloss = false;    
-                         esp32cam.camera_active = false;
-                         esp32cam.fs_active = false;
-                         esp32cam.sd_active = false;
-                         esp32cam.ftp_active = false;
-                         esp32cam.http_active = false;
-                         esp32cam.buffer_active = false; 
-                         esp32cam.ota_enabled = false; 
-                         break;
-    case TM_CAMERA:      strcpy (ov2640.filename, "");
-                         ov2640.filesize = 0;
-                         ov2640.wifi_ms = 0;
-                         ov2640.sd_ms = 0;
-                         ov2640.exposure_ms = 0;
-                         esp32.camera_rate++;
-                         esp32.camera_active = true;
-                         radio.camera_active = true;  
-                         break;
-    case TIMER_ESP32CAM: timer_esp32cam.camera_duration = 0;
-                         timer_esp32cam.serial_duration = 0;
-                         timer_esp32cam.tc_duration = 0;
-                         timer_esp32cam.sd_duration = 0;
-                         timer_esp32cam.ftp_duration = 0;
-                         timer_esp32cam.wifi_duration = 0;
-                         timer_esp32cam.idle_duration = 0;
-                         timer_esp32cam.publish_sd_duration = 0;
-                         timer_esp32cam.publish_fs_duration = 0;
-                         timer_esp32cam.publish_serial_duration = 0;
-                         timer_esp32cam.publish_yamcs_duration = 0;
-                         timer_esp32cam.publish_udp_duration = 0;
-                         break;                     
-    case TC_ESP32:       tc_esp32.parameter[0] = 0;
-                         break;
-    #endif
+uint32_t store_pending (uint8_t sink) {
+  uint32_t pending = 0;
+  for (uint8_t priority = 0; priority < NUMBER_OF_PRIORITIES; priority++) {
+    pending += store_queued (priority, sink);
+  }
+  return (pending);
+}
+
+uint32_t store_queued (uint8_t priority, uint8_t sink) {
+  uint32_t pending = 0;
+  if (store_fs != FS_NONE) {
+    for (uint8_t segment = 0; segment < STORE_SEGMENTS; segment++) {
+      pending += store_state.pending[segment][priority][sink];
+    }
+  }
+  return (pending);
+}
+
+bool store_sync () {
+  File file;
+  char path[24];
+  if (store_fs == FS_NONE or !store_dirty) {
+    return true;
+  }
+  store_file.flush ();
+  store_state.sequence++;
+  store_state.crc = crc16 ((const uint8_t*)&store_state, sizeof(store_state_t) - 2);
+  sprintf (path, "%s/state%u", STORE_DIR, store_state.sequence % 2);
+  file = get_fs (store_fs)->open (path, "w");
+  if (!file) {
+    return false;
   }
+  file.write ((const uint8_t*)&store_state, sizeof(store_state_t));
+  file.close ();
+  store_dirty = false;
+  store_sync_millis = millis ();
+  return true;
+}
+
+// ARCHIVE REPLAY FUNCTIONALITY
+// A CCSDS archive segment is streamed back to Yamcs a few packets per loop, paced on the millis 
+// of its packets. Replayed packets get a secondary header with the playback flag set, and are 
+// neither archived nor buffered again: when the link cannot take them, the replay waits.
+
+bool replay_next () {
+  // read the next packet of the replay file into replay_packet; false at the end of the file
+  static uint8_t window[ARCHIVE_FRAME_MAX_SIZE];
+  uint16_t len;
+  uint16_t record_len;
+  int16_t frame_len;
+  int16_t consumed;
+  while (replay.offset < replay.size) {
+    len = (replay.size - replay.offset < ARCHIVE_FRAME_MAX_SIZE)?(replay.size - replay.offset):ARCHIVE_FRAME_MAX_SIZE;
+    if (!reader_read (&replay_file, &replay_reader, replay.offset, window, len)) {
+      return false;
+    }
+    if (replay.framed) {
+      frame_len = archive_unframe (window, len, &record_len);
+      if (frame_len <= 0) {
+        // no (complete) frame here: resynchronise on the next sync marker; delta records cannot 
+        // be decoded against a lost predecessor, so the codec waits for the next raw record
+        archive_codec_reset (&replay_codec);
+        replay.offset++;
+        replay.skipped++;
+        continue;
+      }
+      if (replay.compressed) {
+        consumed = archive_decode (&replay_codec, window + 4, record_len, replay_packet);
+      }
+      else {
+        consumed = (record_len >= 6 and record_len <= ARCHIVE_PACKET_MAX_SIZE and archive_packet_len (window + 4) == record_len)?record_len:-1;
+        if (consumed > 0) {
+          memcpy (replay_packet, window + 4, record_len);
+        }
+      }
+      replay.offset += frame_len;
+      if (consumed != record_len) {
+        archive_codec_reset (&replay_codec);
+        replay.skipped += frame_len;
+        continue;
+      }
+      return true;
+    }
+    if (replay.compressed) {
+      consumed = archive_decode (&replay_codec, window, len, replay_packet);
+    }
+    else if (len < 6 or archive_packet_len (window) > len or archive_packet_len (window) > ARCHIVE_PACKET_MAX_SIZE) {
+      consumed = (len >= 6 and archive_packet_len (window) > ARCHIVE_PACKET_MAX_SIZE)?-1:0;
+    }
+    else {
+      consumed = archive_packet_len (window);
+      memcpy (replay_packet, window, consumed);
+    }
+    if (consumed <= 0) {
+      // torn record at the end, or corruption that cannot be skipped without framing
+      replay.skipped += replay.size - replay.offset;
+      return false;
+    }
+    replay.offset += consumed;
+    return true;
+  }
+  return false;
+}
+
+bool publish_replay (ccsds_t* ccsds_ptr) {
+  // send a replayed packet to Yamcs with a playback secondary header; false if the link cannot take it now
+  static uint8_t playback[sizeof(ccsds_hdr_t) + sizeof(ccsds_sec_hdr_t) + ARCHIVE_PACKET_MAX_SIZE];
+  ccsds_sec_hdr_t* sec_hdr = (ccsds_sec_hdr_t*)(playback + sizeof(ccsds_hdr_t));
+  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
+  uint16_t len = get_ccsds_packet_len (ccsds_ptr);
+  uint32_t packet_millis = get_ccsds_millis (ccsds_ptr);
+  if (PID >= NUMBER_OF_PID or !routing_yamcs[PID]) {
+    return true;
+  }
+  if (!tm_this->wifi_connected or store_pending (SINK_YAMCS)) {
+    // live telemetry (and its backlog) goes first
+    return false;
+  }
+  if (!tx_room (yamcs_datagram.len + sizeof(tx_item_t) + len + sizeof(ccsds_sec_hdr_t))) {
+    // transmit queue full: try again later
+    return false;
+  }
+  yamcs_flush (); // live packets packed so far go first
+  memcpy (playback, ccsds_ptr, sizeof(ccsds_hdr_t));
+  memset (sec_hdr, 0, sizeof(ccsds_sec_hdr_t));
+  sec_hdr->playback = true;
+  sec_hdr->source_id = SS_THIS;
+  sec_hdr->timestamp_msw = packet_millis >> 16;
+  sec_hdr->timestamp_lsw = packet_millis & 0xFFFF;
+  memcpy (playback + sizeof(ccsds_hdr_t) + sizeof(ccsds_sec_hdr_t), (uint8_t*)ccsds_ptr + sizeof(ccsds_hdr_t), len - sizeof(ccsds_hdr_t));
+  ((ccsds_hdr_t*)playback)->sec_hdr = true;
+  set_ccsds_payload_len ((ccsds_t*)playback, len - sizeof(ccsds_hdr_t) + sizeof(ccsds_sec_hdr_t));
+  if (!tx_send (TX_YAMCS, playback, len + sizeof(ccsds_sec_hdr_t))) {
+    // no room in the network stack: try again later
+    return false;
+  }
+  tm_this->yamcs_rate++;
+  return true;
+}
+
+void replay_close (const char* reason) {
+  replay_file.close ();
+  replay.pending = false;
+  if (replay.skipped) {
+    sprintf (buffer, "%s replay of %s after %u packets (skipped %u corrupt bytes)", reason, replay.path, replay.packets, replay.skipped);
+  }
+  else {
+    sprintf (buffer, "%s replay of %s after %u packets", reason, replay.path, replay.packets);
+  }
+  publish_event (STS_THIS, SS_THIS, EVENT_INFO, buffer);
+}
+
+void replay_check () {
+  // stream the archive being replayed within replay_share % of the loop time, interleaved with live telemetry
+  static uint32_t last_micros = 0;
+  uint32_t start_micros = micros();
+  uint32_t slice = (start_micros - last_micros) / 100 * config_this->replay_share;
+  uint32_t packet_millis;
+  last_micros = start_micros;
+  if (!replay_file) {
+    return;
+  }
+  if (slice > REPLAY_SLICE_MAX) {
+    slice = REPLAY_SLICE_MAX;
+  }
+  do {
+    if (!replay.pending) {
+      if (!replay_next ()) {
+        replay_close ("Finished");
+        return;
+      }
+      if (!valid_ccsds_hdr ((ccsds_t*)replay_packet, PKT_TM)) {
+        continue;
+      }
+      packet_millis = get_ccsds_millis ((ccsds_t*)replay_packet);
+      if (!replay.packets or ((packet_millis - replay.last_millis) & 0xFFFFFF) > REPLAY_GAP_MAX) {
+        // (re)anchor the timeline at the start, after a long gap, or when the recording restarted
+        replay.start_millis = millis();
+        replay.first_millis = packet_millis;
+      }
+      replay.last_millis = packet_millis;
+      replay.pending = true;
+    }
+    if (replay.speed and millis() - replay.start_millis < ((replay.last_millis - replay.first_millis) & 0xFFFFFF) / replay.speed) {
+      // not due yet
+      return;
+    }
+    if (!publish_replay ((ccsds_t*)replay_packet)) {
+      // backpressure: keep the packet for the next loop
+      return;
+    }
+    replay.pending = false;
+    replay.packets++;
+  } while (micros() - start_micros < slice);
 }
 
 // CCSDS FUNCTIONALITY
@@ -1912,26 +3911,14 @@ bool valid_ccsds_hdr (ccsds_t* ccsds_ptr, bool pkt_type) {
   }
 }
 
-uint16_t get_ccsds_apid (ccsds_t* ccsds_ptr) {
-  return (256*((ccsds_hdr_t*)ccsds_ptr)->apid_H + ((ccsds_hdr_t*)ccsds_ptr)->apid_L);
-}
-
 uint16_t get_ccsds_packet_ctr (ccsds_t* ccsds_ptr) {
   return (256*((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_H + ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L);
 }
 
-uint16_t get_ccsds_packet_len (ccsds_t* ccsds_ptr) {
-  return (sizeof (ccsds_hdr_t) + 256*((ccsds_hdr_t*)ccsds_ptr)->pkt_len_H + ((ccsds_hdr_t*)ccsds_ptr)->pkt_len_L + 1);
-}
-
 void set_ccsds_payload_len (ccsds_t* ccsds_ptr, uint16_t len) {
   (ccsds_ptr->ccsds_hdr).pkt_len_H = (uint8_t)((len - 1) >> 8);  
   (ccsds_ptr->ccsds_hdr).pkt_len_L = (uint8_t)(len - 1);
 }
-  
-uint32_t get_ccsds_millis (ccsds_t* ccsds_ptr) {
-  return (65536*(uint8_t)*((byte*)ccsds_ptr+8)+256*(uint8_t)*((byte*)ccsds_ptr+7)+(uint8_t)*((byte*)ccsds_ptr+6));
-}
 
 uint32_t get_ccsds_ctr (ccsds_t* ccsds_ptr) {
   return (256*(uint8_t)*((byte*)ccsds_ptr+10)+(uint8_t)*((byte*)ccsds_ptr+9));
@@ -1994,6 +3981,10 @@ void parse_ccsds (ccsds_t* ccsds_ptr) {
                                                          break;
                              case TC_FREEZE_OPSMODE:     cmd_freeze_opsmode ((uint8_t)tc_this->parameter[0]);
                                                          break;
+                             case TC_REPLAY_START:       cmd_replay_start ((const char*)(tc_this->parameter + 1), (uint8_t)tc_this->parameter[0]);
+                                                         break;
+                             case TC_REPLAY_STOP:        cmd_replay_stop ();
+                                                         break;
                              default:                    sprintf (buffer,  "CCSDS command to %s not understood", subsystemName[SS_THIS]);
                                                          publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, buffer);
                                                          break;
@@ -2015,199 +4006,6 @@ void parse_ccsds (ccsds_t* ccsds_ptr) {
 
 // JSON FUNCTIONALITY
 
-void build_json_str (char* json_buffer, ccsds_t* ccsds_ptr) {
-  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
-  switch (PID) {
-    case STS_ESP32:      { 
-                           sts_esp32_t* sts_esp32_ptr = (sts_esp32_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"type\":\"%s\",\"ss\":\"%s\",\"msg\":\"%s\"}", 
-                                    pidName[PID], sts_esp32_ptr->packet_ctr, sts_esp32_ptr->millis, 
-                                    eventName[sts_esp32_ptr->type], subsystemName[sts_esp32_ptr->subsystem], sts_esp32_ptr->message);
-                         }
-                         break;
-    case STS_ESP32CAM:   { 
-                           sts_esp32cam_t* sts_esp32cam_ptr = (sts_esp32cam_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"type\":\"%s\",\"ss\":\"%s\",\"msg\":\"%s\"}", 
-                                    pidName[PID], sts_esp32cam_ptr->packet_ctr, sts_esp32cam_ptr->millis, 
-                                    eventName[sts_esp32cam_ptr->type], subsystemName[sts_esp32cam_ptr->subsystem], sts_esp32cam_ptr->message);
-                         }
-                         break;                  
-    case TM_ESP32:       {
-                           tm_esp32_t* esp32_ptr = (tm_esp32_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"state\":\"%s\",\"err\":%u,\"warn\":%u,\"tc\":{\"exec\":%u,\"fail\":%u},\"mem\":[%u,%u],\"buf\":[%u,%u],\"fs\":[%u,%u],\"ntp\":%u,\"inst_rate\":[%u,%u,%u,%u,%u],\"comm_rate\":[%u,%u,%u,%u,%u],\"sep\":%d,\"ena\":\"%d%d%d%d%d%d%d%d%d%d%d\",\"act\":\"%d%d%d%d%d%d%d%d\",\"conn\":{\"up\":\"%d%d\",\"warn\":\"%d%d\",\"err\":\"%d%d%d\"}}", 
-                                    pidName[PID], esp32_ptr->packet_ctr, esp32_ptr->millis,  
-                                    modeName[esp32_ptr->opsmode], stateName[esp32_ptr->state], esp32_ptr->error_ctr, esp32_ptr->warning_ctr, 
-                                    esp32_ptr->tc_exec_ctr, esp32_ptr->tc_fail_ctr,
-                                    esp32_ptr->mem_free, esp32_ptr->fs_free, 
-                                    esp32_ptr->yamcs_buffer, esp32_ptr->serial_out_buffer, 
-                                    esp32_ptr->ftp_fs, esp32_ptr->buffer_fs,
-                                    esp32_ptr->time_set, 
-                                    esp32_ptr->radio_rate, esp32_ptr->pressure_rate, esp32_ptr->motion_rate, esp32_ptr->gps_rate, esp32_ptr->camera_rate, esp32_ptr->udp_rate, esp32_ptr->yamcs_rate, esp32_ptr->serial_in_rate, esp32_ptr->serial_out_rate, esp32_ptr->fs_rate, 
-                                    esp32_ptr->separation_sts,
-                                    esp32_ptr->radio_enabled, esp32_ptr->pressure_enabled, esp32_ptr->motion_enabled, esp32_ptr->gps_enabled, esp32_ptr->camera_enabled, esp32_ptr->wifi_enabled, esp32_ptr->wifi_udp_enabled, esp32_ptr->wifi_yamcs_enabled, esp32_ptr->fs_enabled, esp32_ptr->ftp_enabled, esp32_ptr->time_set,
-                                    esp32_ptr->radio_active, esp32_ptr->pressure_active, esp32_ptr->motion_active, esp32_ptr->gps_active, esp32_ptr->camera_active, esp32_ptr->fs_active, esp32_ptr->ftp_active, esp32_ptr->ota_enabled,
-                                    esp32_ptr->serial_connected, esp32_ptr->wifi_connected, esp32_ptr->warn_serial_connloss, esp32_ptr->warn_wifi_connloss, esp32_ptr->err_serial_dataloss, esp32_ptr->err_yamcs_dataloss, esp32_ptr->err_fs_dataloss); 
-                         }
-                         break;
-    case TM_ESP32CAM:    { // TODO: ota_enabled missing
-                           tm_esp32cam_t* esp32cam_ptr = (tm_esp32cam_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"err\":%u,\"warn\":%u,\"tc\":{\"exec\":%u,\"fail\":%u},\"mem\":[%u,%u,%u],\"buf\":[%u,%u],\"fs\":[%u,%u],\"ntp\":%u,\"rate\":[%u,%u,%u,%u,%u,%u,%u,%u,%u],\"ena\":\"%d%d%d%d%d%d%d%d%d%d%d\",\"act\":\"%d%d%d%d\",\"conn\":{\"up\":\"%d%d\",\"warn\":\"%d%d\",\"err\":\"%d%d%d%d\"}}",
-                                    pidName[PID], esp32cam_ptr->packet_ctr, esp32cam_ptr->millis,  
-                                    cameraModeName[esp32cam_ptr->opsmode], esp32cam_ptr->error_ctr, esp32cam_ptr->warning_ctr, 
-                                    esp32cam_ptr->tc_exec_ctr, esp32cam_ptr->tc_fail_ctr,
-                                    esp32cam_ptr->mem_free, esp32cam_ptr->fs_free, esp32cam_ptr->sd_free, 
-                                    esp32cam_ptr->yamcs_buffer, esp32cam_ptr->serial_out_buffer, 
-                                    esp32cam_ptr->ftp_fs, esp32cam_ptr->buffer_fs, 
-                                    esp32cam_ptr->time_set, 
-                                    esp32cam_ptr->camera_rate, esp32cam_ptr->udp_rate, esp32cam_ptr->yamcs_rate, esp32cam_ptr->serial_in_rate, esp32cam_ptr->serial_out_rate, esp32cam_ptr->fs_rate, esp32cam_ptr->sd_json_rate, esp32cam_ptr->sd_ccsds_rate, esp32cam_ptr->sd_image_rate,  
-                                    esp32cam_ptr->camera_enabled, esp32cam_ptr->wifi_enabled, esp32cam_ptr->wifi_udp_enabled, esp32cam_ptr->wifi_yamcs_enabled, esp32cam_ptr->wifi_image_enabled, esp32cam_ptr->fs_enabled, esp32cam_ptr->sd_enabled, esp32cam_ptr->ftp_enabled, esp32cam_ptr->sd_json_enabled, esp32cam_ptr->sd_ccsds_enabled, esp32cam_ptr->sd_image_enabled, 
-                                    esp32cam_ptr->camera_active, esp32cam_ptr->fs_active, esp32cam_ptr->sd_active, esp32cam_ptr->ftp_active, 
-                                    esp32cam_ptr->serial_connected, esp32cam_ptr->wifi_connected, esp32cam_ptr->warn_serial_connloss, esp32cam_ptr->warn_wifi_connloss, esp32cam_ptr->err_serial_dataloss, esp32cam_ptr->err_yamcs_dataloss, esp32cam_ptr->err_fs_dataloss, esp32cam_ptr->err_sd_dataloss); 
-                         }
-                         break;
-    case TM_CAMERA:      {
-                           tm_camera_t* ov2640_ptr = (tm_camera_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"res\":\"%s\",\"auto_res\":%d,\"file\":\"%s\",\"size\":%u,\"ms\":{\"exp\":%u,\"sd\":%u,\"wifi\":%u}}", 
-                                    pidName[PID], ov2640_ptr->packet_ctr, ov2640_ptr->millis, 
-                                    cameraModeName[ov2640_ptr->camera_mode], cameraResolutionName[ov2640_ptr->resolution], ov2640_ptr->auto_res, ov2640_ptr->filename, ov2640_ptr->filesize, ov2640_ptr->exposure_ms, ov2640_ptr->sd_ms, ov2640_ptr->wifi_ms);
-                         }
-                         break;
-    case TM_GPS:         { 
-                           tm_gps_t* neo6mv2_ptr = (tm_gps_t*)ccsds_ptr;
-                           *json_buffer++ = '{';
-                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"sts\":\"%s\",\"sats\":%d", pidName[PID], neo6mv2_ptr->packet_ctr, neo6mv2_ptr->millis, gpsStatusName[neo6mv2_ptr->status], neo6mv2_ptr->satellites);
-                           if (neo6mv2_ptr->time_valid) {
-                             json_buffer += sprintf (json_buffer, ",\"time\":\"%02d:%02d:%02d.%02d\"", neo6mv2_ptr->hours, neo6mv2_ptr->minutes, neo6mv2_ptr->seconds, neo6mv2_ptr->centiseconds);
-                           }
-                           if (neo6mv2_ptr->location_valid) {
-                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
-                             json_buffer += sprintf (json_buffer, ",\"loc\":[%d,%d]", neo6mv2_ptr->latitude, neo6mv2_ptr->longitude);
-                             #else
-                             json_buffer += sprintf (json_buffer, ",\"loc\":[%ld,%ld]", neo6mv2_ptr->latitude, neo6mv2_ptr->longitude);
-                             #endif
-                           }
-                           if (neo6mv2_ptr->altitude_valid) {
-                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
-                             json_buffer += sprintf (json_buffer, ",\"alt\":%d", neo6mv2_ptr->altitude);
-                             #else
-                             json_buffer += sprintf (json_buffer, ",\"alt\":%ld", neo6mv2_ptr->altitude);
-                             #endif
-                           }  
-                           if (neo6mv2_ptr->location_valid and neo6mv2_ptr->altitude_valid) {
-                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
-                             json_buffer += sprintf (json_buffer, ",\"zero\":[%d,%d,%d]", neo6mv2_ptr->latitude_zero, neo6mv2_ptr->longitude_zero, neo6mv2_ptr->altitude_zero);
-                             #else
-                             json_buffer += sprintf (json_buffer, ",\"zero\":[%ld,%ld,%ld]", neo6mv2_ptr->latitude_zero, neo6mv2_ptr->longitude_zero, neo6mv2_ptr->altitude_zero);
-                             #endif
-                           }
-                           if (neo6mv2_ptr->offset_valid) {
-                             json_buffer += sprintf (json_buffer, ",\"xyz\":[%d,%d,%d]", neo6mv2_ptr->x, neo6mv2_ptr->y, neo6mv2_ptr->z);
-                           }
-                           if (neo6mv2_ptr->speed_valid) {
-                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
-                             json_buffer += sprintf (json_buffer, ",\"v\":[%d,%d,%d]", neo6mv2_ptr->v_north, neo6mv2_ptr->v_east, neo6mv2_ptr->v_down);
-                             #else
-                             json_buffer += sprintf (json_buffer, ",\"v\":[%ld,%ld,%ld]", neo6mv2_ptr->v_north, neo6mv2_ptr->v_east, neo6mv2_ptr->v_down);
-                             #endif
-                           }
-                           if (neo6mv2_ptr->hdop_valid and neo6mv2_ptr->vdop_valid and neo6mv2_ptr->pdop_valid) {
-                             json_buffer += sprintf (json_buffer, ",\"dop\":[%u,%u,%u]", neo6mv2_ptr->milli_hdop, neo6mv2_ptr->milli_vdop, neo6mv2_ptr->milli_pdop);
-                           }
-                           if (neo6mv2_ptr->error_valid) {
-                             json_buffer += sprintf (json_buffer, ",\"err\":[%d,%d,%d]", neo6mv2_ptr->x_err, neo6mv2_ptr->y_err, neo6mv2_ptr->z_err);
-                           }
-                           json_buffer += sprintf (json_buffer, ",\"valid\":\"%d%d%d%d%d%d%d%d%d\"", neo6mv2_ptr->time_valid, neo6mv2_ptr->location_valid, neo6mv2_ptr->altitude_valid, neo6mv2_ptr->speed_valid, neo6mv2_ptr->hdop_valid, neo6mv2_ptr->vdop_valid, neo6mv2_ptr->pdop_valid, neo6mv2_ptr->error_valid, neo6mv2_ptr->offset_valid);
-                           *json_buffer++ = '}';
-                           *json_buffer++ = 0;
-                         }
-                         break;
-    case TM_MOTION:      {
-                           tm_motion_t* motion_ptr = (tm_motion_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"accel\":[%d,%d,%d],\"gyro\":[%d,%d,%d],\"tilt\":%d,\"g\":%d,\"a\":%d,\"rpm\":%d,\"range\":[%u,%u],\"valid\":\"%d%d\"}", 
-                                    pidName[PID], motion_ptr->packet_ctr, motion_ptr->millis, 
-                                    motion_ptr->accel_x, motion_ptr->accel_y, motion_ptr->accel_z, 
-                                    motion_ptr->gyro_x, motion_ptr->gyro_y, motion_ptr->gyro_z, 
-                                    motion_ptr->tilt, motion_ptr->g, motion_ptr->a, motion_ptr->rpm,
-                                    motion_ptr->accel_range, motion_ptr->gyro_range, motion_ptr->accel_valid, motion_ptr->gyro_valid); 
-                         }
-                         break;
-    case TM_PRESSURE:    {
-                           tm_pressure_t* bmp280_ptr = (tm_pressure_t*)ccsds_ptr;
-                           #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"p\":%u,\"p0\":%u,\"T\":%d,\"h\":%d,\"v_v\":%d,\"valid\":%u}", 
-                                    pidName[PID], bmp280_ptr->packet_ctr, bmp280_ptr->millis, 
-                                    bmp280_ptr->pressure, bmp280_ptr->zero_level_pressure, bmp280_ptr->temperature, bmp280_ptr->height, bmp280_ptr->velocity_v, bmp280_ptr->height_valid);
-                           #else
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"p\":%lu,\"p0\":%lu,\"T\":%d,\"h\":%d,\"v_v\":%d,\"valid\":%u}", 
-                                    pidName[PID], bmp280_ptr->packet_ctr, bmp280_ptr->millis, 
-                                    bmp280_ptr->pressure, bmp280_ptr->zero_level_pressure, bmp280_ptr->temperature, bmp280_ptr->height, bmp280_ptr->velocity_v, bmp280_ptr->height_valid);
-                           #endif
-                         }
-                         break;
-    case TM_RADIO:       {
-                           tm_radio_t* radio_ptr = (tm_radio_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"data\":\"%s\"}", 
-                                    pidName[PID], radio_ptr->packet_ctr, radio_ptr->millis, 
-                                    get_hex_str((char*)&radio, sizeof(tm_radio_t)).c_str());
-                         }
-                         break;
-    case TIMER_ESP32:    {
-                           timer_esp32_t* timer_esp32_ptr = (timer_esp32_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"idle\":%u,\"instr\":[%u,%u,%u,%u,%u],\"fun\":[%u,%u,%u,%u,%u],\"pub\":[%u,%u,%u,%u]}", 
-                                    pidName[PID], timer_esp32_ptr->packet_ctr, timer_esp32_ptr->millis,  
-                                    timer_esp32_ptr->idle_duration,
-                                    timer_esp32_ptr->radio_duration, timer_esp32_ptr->pressure_duration, timer_esp32_ptr->motion_duration, timer_esp32_ptr->gps_duration, timer_esp32_ptr->esp32cam_duration,
-                                    timer_esp32_ptr->serial_duration, timer_esp32_ptr->ota_duration, timer_esp32_ptr->ftp_duration, timer_esp32_ptr->wifi_duration, timer_esp32_ptr->tc_duration,
-                                    timer_esp32_ptr->publish_fs_duration, timer_esp32_ptr->publish_serial_duration, timer_esp32_ptr->publish_yamcs_duration, timer_esp32_ptr->publish_udp_duration);
-                         }
-                         break;
-    case TIMER_ESP32CAM: { // TODO: fine-tune packet
-                           timer_esp32cam_t* timer_esp32cam_ptr = (timer_esp32cam_t*)ccsds_ptr;
-                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"idle\":%u,\"cam\":%u,\"fun\":[%u,%u,%u,%u,%u],\"pub\":[%u,%u,%u,%u,%u]}", 
-                                    pidName[PID], timer_esp32cam_ptr->packet_ctr, timer_esp32cam_ptr->millis, 
-                                    timer_esp32cam_ptr->idle_duration,
-                                    timer_esp32cam_ptr->camera_duration,
-                                    timer_esp32cam_ptr->serial_duration, timer_esp32cam_ptr->tc_duration, timer_esp32cam_ptr->sd_duration, timer_esp32cam_ptr->ftp_duration, timer_esp32cam_ptr->wifi_duration, 
-                                    timer_esp32cam_ptr->publish_sd_duration, timer_esp32cam_ptr->publish_fs_duration, timer_esp32cam_ptr->publish_serial_duration, timer_esp32cam_ptr->publish_yamcs_duration, timer_esp32cam_ptr->publish_udp_duration);
-                         }
-                         break;
-    case TC_ESP32:       { 
-                           tc_esp32_t* tc_esp32_ptr = (tc_esp32_t*)ccsds_ptr;
-                           *json_buffer++ = '{';
-                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"millis\":%lu,\"cmd\":\"%s\"", pidName[PID], millis(), tcName[tc_esp32_ptr->cmd_id-42]);
-                           if (tc_esp32_ptr->cmd_id-42 == TC_REBOOT or tc_esp32_ptr->cmd_id-42 == TC_SET_OPSMODE) {
-                             json_buffer += sprintf (json_buffer, ",\"int_val\":\"%u\"", (uint8_t)tc_esp32_ptr->parameter[0]);
-                           }
-                           if (tc_esp32_ptr->cmd_id-42 == TC_LOAD_CONFIG or tc_esp32_ptr->cmd_id-42 == TC_LOAD_ROUTING) {
-                             json_buffer += sprintf (json_buffer, ",\"str_val\":\"%s\"", tc_esp32_ptr->parameter);
-                           }
-                           if (tc_esp32_ptr->cmd_id-42 == TC_SET_PARAMETER) {
-                             json_buffer += sprintf (json_buffer, ",\"param\":\"%s\",\"value\":\"%s\"", tc_esp32_ptr->parameter, (char*)(&tc_esp32_ptr->parameter+strlen(tc_esp32_ptr->parameter)+1)); // TODO: value
-                           }
-                           *json_buffer++ = '}';
-                           *json_buffer++ = 0;
-                         }
-                         break;
-    case TC_ESP32CAM:    { 
-                           tc_esp32cam_t* tc_esp32cam_ptr = (tc_esp32cam_t*)ccsds_ptr;
-                           *json_buffer++ = '{';
-                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"millis\":%lu,\"cmd\":\"%s\"", pidName[PID], millis(), tcName[tc_esp32cam_ptr->cmd_id-42]);
-                           if (tc_esp32cam_ptr->cmd_id-42 == TC_REBOOT or tc_esp32cam_ptr->cmd_id-42 == TC_SET_OPSMODE) {
-                             json_buffer += sprintf (json_buffer, ",\"int_val\":\"%u\"", (uint8_t)tc_esp32cam_ptr->parameter[0]);
-                           }
-                           if (tc_esp32cam_ptr->cmd_id-42 == TC_LOAD_CONFIG or tc_esp32cam_ptr->cmd_id-42 == TC_LOAD_ROUTING) {
-                             json_buffer += sprintf (json_buffer, ",\"str_val\":\"%s\"", tc_esp32cam_ptr->parameter);
-                           }
-                           if (tc_esp32cam_ptr->cmd_id-42 == TC_SET_PARAMETER) {
-                             json_buffer += sprintf (json_buffer, ",\"param\":\"%s\",\"value\":\"%s\"", tc_esp32cam_ptr->parameter, tc_esp32cam_ptr->parameter); // TODO: value
-                           }
-                           *json_buffer++ = '}';
-                           *json_buffer++ = 0;
-                         } 
-                         break;   
-  } 
-}
-
 bool parse_json (const char* json_string) {
 //  static Document<BUFFER_MAX_SIZE> obj;
   static JsonDocument obj;
@@ -2304,6 +4102,26 @@ bool parse_json (const char* json_string) {
                         timer_esp32cam.publish_serial_duration = obj["pub"][2];
                         timer_esp32cam.publish_yamcs_duration = obj["pub"][3];
                         timer_esp32cam.publish_udp_duration = obj["pub"][4];
+                        timer_esp32cam.archive_staged = obj["arch"][0];
+                        timer_esp32cam.archive_flushed = obj["arch"][1];
+                        timer_esp32cam.archive_writes = obj["arch"][2];
+                        timer_esp32cam.sync_policy = obj["sync"][0];
+                        timer_esp32cam.sync_count = obj["sync"][1];
+                        timer_esp32cam.sync_latency = obj["sync"][2];
+                        timer_esp32cam.drain_rate = obj["drain"][0];
+                        timer_esp32cam.drain_eta = obj["drain"][1];
+                        timer_esp32cam.tx_dropped = obj["tx"][0];
+                        timer_esp32cam.tx_failed = obj["tx"][1];
+                        timer_esp32cam.tx_throttled = obj["tx"][2];
+                        timer_esp32cam.tx_latency = obj["tx"][3];
+                        timer_esp32cam.tx_enqueue = obj["tx"][4];
+                        timer_esp32cam.tc_queued = obj["tcq"][0];
+                        timer_esp32cam.tc_dropped = obj["tcq"][1];
+                        timer_esp32cam.tc_latency = obj["tcq"][2];
+                        timer_esp32cam.shape_yamcs = obj["shape"][0];
+                        timer_esp32cam.shape_serial = obj["shape"][1];
+                        timer_esp32cam.shape_udp = obj["shape"][2];
+                        timer_esp32cam.shape_pid = obj["shape"][3];
                         publish_packet ((ccsds_t*)&timer_esp32cam);
                         break;                                        
     case TC_ESP32:      // execute command
@@ -2331,6 +4149,14 @@ bool parse_json (const char* json_string) {
                           // {"cmd":"freeze_opsmode", "frozen":0|1}
                           cmd_freeze_opsmode (obj["frozen"]);
                         }
+                        else if (!strcmp(obj["cmd"], "replay_start")) {
+                          // {"cmd":"replay_start","filename":"xxxxxx.ccsds","speed":0|1|N}
+                          cmd_replay_start (obj["filename"], obj["speed"]);
+                        }
+                        else if (!strcmp(obj["cmd"], "replay_stop")) {
+                          // {"cmd":"replay_stop"}
+                          cmd_replay_stop ();
+                        }
                         else {
                           publish_event (STS_THIS, SS_THIS, EVENT_ERROR, "JSON command to ESP32 not understood");
                           return false;
@@ -2363,6 +4189,15 @@ bool parse_json (const char* json_string) {
                                              tc_esp32cam.parameter[1] = 0;
                                                  set_ccsds_payload_len ((ccsds_t*)&tc_esp32cam, 7);
                                      break;
+                          case TC_REPLAY_START:  // {"cmd":"replay_start","filename":"xxxxxx.ccsds","speed":0|1|N}
+                                                 tc_esp32cam.parameter[0] = (char) atoi (obj["speed"]);
+                                                 strcpy (tc_esp32cam.parameter + 1, obj["filename"]);
+                                                 set_ccsds_payload_len ((ccsds_t*)&tc_esp32cam, strlen (obj["filename"]) + 8);
+                                                 break;
+                          case TC_REPLAY_STOP:   // {"cmd":"replay_stop"}
+                                                 tc_esp32cam.parameter[0] = 0;
+                                                 set_ccsds_payload_len ((ccsds_t*)&tc_esp32cam, 6);
+                                                 break;
                           default:               publish_event (STS_THIS, SS_THIS, EVENT_ERROR, "JSON command to ESP32CAM not understood");
                                                  return false;
                             
@@ -2544,6 +4379,26 @@ bool parse_json (const char* json_string) {
                         timer_esp32.publish_serial_duration = obj["pub"][1];
                         timer_esp32.publish_yamcs_duration = obj["pub"][2];
                         timer_esp32.publish_udp_duration = obj["pub"][3];
+                        timer_esp32.archive_staged = obj["arch"][0];
+                        timer_esp32.archive_flushed = obj["arch"][1];
+                        timer_esp32.archive_writes = obj["arch"][2];
+                        timer_esp32.sync_policy = obj["sync"][0];
+                        timer_esp32.sync_count = obj["sync"][1];
+                        timer_esp32.sync_latency = obj["sync"][2];
+                        timer_esp32.drain_rate = obj["drain"][0];
+                        timer_esp32.drain_eta = obj["drain"][1];
+                        timer_esp32.tx_dropped = obj["tx"][0];
+                        timer_esp32.tx_failed = obj["tx"][1];
+                        timer_esp32.tx_throttled = obj["tx"][2];
+                        timer_esp32.tx_latency = obj["tx"][3];
+                        timer_esp32.tx_enqueue = obj["tx"][4];
+                        timer_esp32.tc_queued = obj["tcq"][0];
+                        timer_esp32.tc_dropped = obj["tcq"][1];
+                        timer_esp32.tc_latency = obj["tcq"][2];
+                        timer_esp32.shape_yamcs = obj["shape"][0];
+                        timer_esp32.shape_serial = obj["shape"][1];
+                        timer_esp32.shape_udp = obj["shape"][2];
+                        timer_esp32.shape_pid = obj["shape"][3];
                         publish_packet ((ccsds_t*)&timer_esp32);
                         break;    
     case TC_ESP32:      // forward command
@@ -2578,6 +4433,15 @@ bool parse_json (const char* json_string) {
                                                  tc_esp32.parameter[1] = 0;
                                                  set_ccsds_payload_len ((ccsds_t*)&tc_esp32, 7);
                                      break;
+                          case TC_REPLAY_START:  // {"cmd":"replay_start","filename":"xxxxxx.ccsds","speed":0|1|N}
+                                                 tc_esp32.parameter[0] = (unsigned char)obj["speed"];
+                                                 strcpy (tc_esp32.parameter + 1, obj["filename"]);
+                                                 set_ccsds_payload_len ((ccsds_t*)&tc_esp32, strlen (obj["filename"]) + 8);
+                                                 break;
+                          case TC_REPLAY_STOP:   // {"cmd":"replay_stop"}
+                                                 tc_esp32.parameter[0] = 0;
+                                                 set_ccsds_payload_len ((ccsds_t*)&tc_esp32, 6);
+                                                 break;
                           default:               publish_event (STS_THIS, SS_THIS, EVENT_ERROR, "JSON command to ESP32 not understood");
                                                  return false;
                             
@@ -2609,6 +4473,14 @@ bool parse_json (const char* json_string) {
                           // {"cmd":"freeze_opsmode", "frozen":0|1}
                           cmd_freeze_opsmode (obj["frozen"]);
                         }
+                        else if (!strcmp(obj["cmd"], "replay_start")) {
+                          // {"cmd":"replay_start","filename":"xxxxxx.ccsds","speed":0|1|N}
+                          cmd_replay_start (obj["filename"], obj["speed"]);
+                        }
+                        else if (!strcmp(obj["cmd"], "replay_stop")) {
+                          // {"cmd":"replay_stop"}
+                          cmd_replay_stop ();
+                        }
                         else {
                           publish_event (STS_THIS, SS_THIS, EVENT_ERROR, "JSON command to ESP32CAM not understood");
                         }
@@ -2701,8 +4573,7 @@ bool cmd_reboot (uint8_t subsystem) {
     case 0: // this
             sprintf (buffer, "Rebooting %s subsystem", subsystemName[SS_THIS]);
             publish_event (STS_THIS, SS_THIS, EVENT_CMD_RESP, buffer);
-            sync_file_ccsds ();
-            sync_file_json ();
+            close_files (FS_NONE);
             delay (1000);
             ESP.restart();
             break;
@@ -2721,8 +4592,7 @@ bool cmd_reboot (uint8_t subsystem) {
             publish_packet ((ccsds_t*)tc_other);
             sprintf (buffer, "Sending reboot command to %s and rebooting %s subsystem", subsystemName[SS_OTHER], subsystemName[SS_THIS]);
             publish_event (STS_THIS, SS_THIS, EVENT_CMD_RESP, buffer);
-            sync_file_ccsds ();
-            sync_file_json ();
+            close_files (FS_NONE);
             delay (1000);
             ESP.restart();
   }     
@@ -2827,14 +4697,77 @@ bool cmd_freeze_opsmode (bool frozen) {
   return true;
 }
 
-bool cmd_replay_start (char* filename, bool realtime) {
-    // TODO: implement
+bool cmd_replay_start (const char* filename, uint8_t speed) {
+  // speed 0: as fast as the link allows, 1: real time, N: N times real time
+  archive_hdr_t archive_hdr;
+  const char* extension = strrchr (filename, '.');
+  if (replay_file) {
+    replay_close ("Aborted");
+  }
+  if (!config_this->wifi_enable or !config_this->wifi_yamcs_enable) {
+    publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, "Cannot replay an archive while the Yamcs link is disabled");
+    return false;
+  }
+  if (!extension or (strcmp (extension, ".ccsds") and strcmp (extension, ".ccsdx")) or strlen (filename) >= sizeof(replay.path)) {
+    sprintf (buffer, "Cannot replay '%s': not a CCSDS archive", filename);
+    publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, buffer);
+    return false;
+  }
+  replay.fs = FS_NONE;
+  #ifdef PLATFORM_ESP32CAM
+  if (tm_this->sd_enabled and SD_MMC.exists (filename)) {
+    replay.fs = FS_SD_MMC;
+  }
+  #endif
+  if (replay.fs == FS_NONE and tm_this->fs_enabled and get_fs (FS_LITTLEFS)->exists (filename)) {
+    replay.fs = FS_LITTLEFS;
+  }
+  if (replay.fs == FS_NONE or !(replay_file = get_fs (replay.fs)->open (filename, "r"))) {
+    sprintf (buffer, "Cannot replay '%s': file not found", filename);
+    publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, buffer);
     return false;
+  }
+  strcpy (replay.path, filename);
+  replay.size = replay_file.size();
+  replay.offset = 0;
+  replay.compressed = false;
+  replay.framed = false;
+  if (!strcmp (extension, ".ccsdx")) {
+    if (replay_file.read ((uint8_t*)&archive_hdr, sizeof(archive_hdr_t)) != sizeof(archive_hdr_t) or 
+        !archive_hdr_valid ((const uint8_t*)&archive_hdr, sizeof(archive_hdr_t))) {
+      replay_file.close ();
+      sprintf (buffer, "Cannot replay '%s': invalid archive header", filename);
+      publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, buffer);
+      return false;
+    }
+    replay.compressed = archive_hdr.flags & ARCHIVE_FLAG_DELTA;
+    replay.framed = archive_hdr.flags & ARCHIVE_FLAG_FRAMED;
+    replay.offset = sizeof(archive_hdr_t);
+    archive_codec_reset (&replay_codec);
+  }
+  reader_reset (&replay_reader);
+  replay.speed = speed;
+  replay.packets = 0;
+  replay.skipped = 0;
+  replay.pending = false;
+  if (speed) {
+    sprintf (buffer, "Started replay of %s from %s at %ux real time", filename, fsName[replay.fs], speed);
+  }
+  else {
+    sprintf (buffer, "Started replay of %s from %s as fast as the link allows", filename, fsName[replay.fs]);
+  }
+  publish_event (STS_THIS, SS_THIS, EVENT_CMD_RESP, buffer);
+  return true;
 }
 
 bool cmd_replay_stop () {
-    // TODO: implement
+  if (!replay_file) {
+    publish_event (STS_THIS, SS_THIS, EVENT_CMD_FAIL, "No archive replay to stop");
     return false;
+  }
+  replay_close ("Stopped");
+  tm_this->tc_exec_ctr++;
+  return true;
 }
 
 // SUPPORT FUNCTIONS
@@ -16,7 +16,7 @@
 #define PLATFORM_ESP8266_RADIO
 #endif
 
-//#define ASYNCUDP // uncomment to use AsyncUDP for commanding
+//#define ASYNCUDP // uncomment to use AsyncUDP for commanding (received commands are executed by yamcs_tc_check)
 //#define SERIAL_TCTM
 //#define SERIAL_KEEPALIVE_OVERRIDE
 
@@ -25,11 +25,11 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
+#include <freertos/ringbuf.h>
 #ifdef ASYNCUDP
 #include <AsyncUDP.h>
 #endif
 #include <NTPClient.h>
-#include <LinkedList.h>
 #include <ArduinoJson.h>
 #include <ESPFtpServer.h>
 #include <FS.h>
@@ -40,20 +40,53 @@
 #include <LittleFS.h>
 #endif
 #include <UnixTime.h>
+#include <fli3d_archive.h>
+#include <fli3d_packets.h>
 
 //#define SERIAL_TCTM
 
 #define SERIAL_BAUD               115200
 #define BUFFER_MAX_SIZE           512
-#define PARAMETER_MAX_SIZE        128
-#define WIFI_TIMEOUT              30     // s (time-out when initializing)
+#define WIFI_TIMEOUT              30     // s (time-out of a connection attempt after a scan)
+#define WIFI_FAST_TIMEOUT         5      // s (time-out of a reconnection to the last access point, without a scan)
+#define WIFI_BACKOFF_MIN          2      // s (wait before scanning again when no network could be joined, doubled at every failure)
+#define WIFI_BACKOFF_MAX          120    // s
 #define NTP_TIMEOUT               10     // s (time-out when initializing)
 #define WIFI_CHECK                1      // s (check interval to ensure connection, otherwise buffer)
 #define NTP_CHECK                 1      // s (check interval in background after time-out)
 #define RADIO_BAUD                1000   // transmission speed over 433 MHz radio
 #define KEEPALIVE_INTERVAL        200    // ms for loss of connection detection of serial connection between ESP32 and ESP32cam
-#define BUFFER_RELEASE_BATCH_SIZE 3      // TM buffer is released by this number of packets at a time
+#define DRAIN_RATE_MIN            3      // backlog records/s the TM buffer is released by at least
+#define DRAIN_RATE_MAX            250    // backlog records/s the TM buffer is released by at most
+#define DRAIN_BURST               24     // backlog records released at most by one drain (bounds the time taken from the loop)
+#define TX_QUEUE_SIZE             8192   // bytes of datagrams queued for the transmit task
+#define TX_TASK_CORE              0      // core of the transmit task (the Arduino loop runs on core 1)
+#define TX_TASK_STACK             4096
+#define TX_TASK_PRIORITY          1
+#define TX_RESOLVE_INTERVAL       10000  // ms between retries of a failed server name lookup
+#define TC_POOL_SIZE              8      // command slots between the AsyncUDP task and the loop (power of 2)
+#define YAMCS_MTU_MAX             1400   // largest packed Yamcs datagram (stays below the 1500-byte WiFi MTU)
+#define DRAIN_IDLE_SHARE          50     // % of the measured loop idle time the backlog drain may use
 #define MIN_MEM_FREE              70000  // TM buffering stops when memory is below this value 
+#define FS_BLOCK_SIZE             512    // archive writes are aligned to this many bytes
+#define FS_STAGE_SIZE_MAX         4096   // largest archive staging buffer (fs_stage_size)
+#define SYNC_INTERVAL_MIN         100    // ms, shortest sync_interval (every sync writes out the partial block staged)
+#define FS_VFS_LITTLEFS           "/littlefs" // POSIX (VFS) mount point of LittleFS
+#define FS_VFS_SD_MMC             "/sdcard"   // POSIX (VFS) mount point of SD_MMC
+#define FS_EVICT_INTERVAL         1000   // ms between background eviction steps of old archive segments
+#define FS_EVICT_BACKOFF          60000  // ms before looking again for an archive segment to evict, when none was found
+#define FS_SPACE_SYNC_INTERVAL    300000 // ms between background re-syncs of the free space estimate with the file system
+#define STORE_DIR                 "/buffer" // directory holding the persistent TM buffer store
+#define STORE_VERSION             1      // layout of store_state_t, saved with it
+#define STORE_SEGMENTS            8      // number of segment files in the TM buffer store ring
+#define STORE_SEGMENT_SIZE        32768  // bytes per TM buffer store segment
+#define STORE_SYNC_INTERVAL       5000   // ms between saves of the TM buffer store state
+#define STORE_RECORD_OVERHEAD     3      // sink mask byte + CRC-16 per TM buffer store record
+#define STORE_INDEX_SIZE          128    // most recent TM buffer store records indexed in RAM
+#define STORE_PRIORITY_SHIFT      4      // record flags: sink mask in the low bits, priority class from this bit up
+#define READ_AHEAD_SIZE           2048   // bytes fetched per file read when replaying the TM buffer store
+#define REPLAY_SLICE_MAX          20000  // us spent at most on archive replay per loop
+#define REPLAY_GAP_MAX            5000   // ms; longer gaps (or restarts) in a replayed archive are skipped
 
 // Pin assignment for ESP32 MH-ET minikit board
 #define DUMMY_PIN1                12   // IO12; hack: RadioHead needs an RX pin to be set
@@ -91,85 +124,6 @@
 #define STS_OTHER    STS_ESP32      // define counterpart system STS packet
 #endif
 
-// PIDs
-#define STS_ESP32              0
-#define STS_ESP32CAM           1
-#define TM_ESP32               2
-#define TM_ESP32CAM            3
-#define TM_CAMERA              4
-#define TM_GPS                 5
-#define TM_MOTION              6
-#define TM_PRESSURE            7
-#define TM_RADIO               8
-#define TIMER_ESP32            9
-#define TIMER_ESP32CAM         10
-#define TC_ESP32               11
-#define TC_ESP32CAM            12
-#define NUMBER_OF_PID          13
-extern const char pidName[NUMBER_OF_PID][15];
-
-// event_types
-#define EVENT_INIT             0
-#define EVENT_INFO             1
-#define EVENT_WARNING          2
-#define EVENT_ERROR            3
-#define EVENT_CMD              4
-#define EVENT_CMD_ACK          5
-#define EVENT_CMD_RESP         6
-#define EVENT_CMD_FAIL         7
-extern const char eventName[8][9];
-
-// subsystem
-#define SS_ESP32               0
-#define SS_ESP32CAM            1
-#define SS_CAMERA              2
-#define SS_GPS                 3
-#define SS_MOTION              4
-#define SS_PRESSURE            5
-#define SS_RADIO               6
-#define SS_SD                  7
-#define SS_SEPARATION          8
-#define SS_TIMER               9
-#define SS_FLI3D               10
-#define SS_GROUND              11
-#define SS_ANY                 12 
-extern const char subsystemName[13][14];
-
-// opsmode
-#define MODE_INIT              0
-#define MODE_CHECKOUT          1
-#define MODE_NOMINAL           2
-#define MODE_MAINTENANCE       3
-extern const char modeName[4][12];
-
-// state
-#define STATE_STATIC           0
-#define STATE_THRUST           1
-#define STATE_FREEFALL         2
-#define STATE_PARACHUTE        3
-extern const char stateName[4][10];
-
-// cammode
-#define CAM_INIT               0
-#define CAM_IDLE               1
-#define CAM_SINGLE             2
-#define CAM_STREAM             3
-extern const char cameraModeName[4][7];
-
-// cam resolutions
-#define RES_160x120            0
-#define RES_240x176            1
-#define RES_INVALID1           2
-#define RES_INVALID2           3
-#define RES_320x240            4 
-#define RES_400x300            5
-#define RES_640x480            6
-#define RES_800x600            7
-#define RES_1024x768           8
-#define RES_1280x1024          9
-#define RES_1600x1200          10           
-extern const char cameraResolutionName[11][10];
-
 // encoding
 #define ENC_CCSDS              0
 #define ENC_JSON               1
@@ -182,9 +136,12 @@ extern const char dataEncodingName[3][8];
 #define FS_SD_MMC              2
 extern const char fsName[3][5];
 
-// packet types
-#define PKT_TM                 0
-#define PKT_TC                 1
+// archive writers (filesystem/encoding)
+#ifdef PLATFORM_ESP32CAM
+#define NUMBER_OF_WRITERS      3      // FS ccsds, SD ccsds, SD json
+#else
+#define NUMBER_OF_WRITERS      1      // FS ccsds
+#endif
 
 // data channels
 #define COMM_SERIAL            0
@@ -198,14 +155,6 @@ extern const char fsName[3][5];
 #define COMM_RADIO             8
 extern const char commLineName[9][13];
 
-#define TC_REBOOT              42
-#define TC_SET_OPSMODE         43
-#define TC_LOAD_CONFIG         44
-#define TC_LOAD_ROUTING        45
-#define TC_SET_PARAMETER       46
-#define TC_FREEZE_OPSMODE      47
-extern const char tcName[6][20];
-
 // serial buffer status
 #define SERIAL_UNKNOWN         0
 #define SERIAL_CR              1
@@ -216,386 +165,52 @@ extern const char tcName[6][20];
 #define SERIAL_KEEPALIVE       6
 #define SERIAL_COMPLETE        7
 
-extern const char gpsStatusName[9][11]; 
-extern const char dhtName[5][7];
-
-// TM/TC packet definitions
-
-struct __attribute__ ((packed)) ccsds_hdr_t {
-  uint8_t     apid_H:3;                // 0:5
-  bool        sec_hdr:1;               // 0: 4
-  bool        type:1;                  // 0:  3
-  uint8_t     version:3;               // 0:   0
-  uint8_t     apid_L;                  // 1
-  uint8_t     seq_ctr_H:6;             // 2:2
-  uint8_t     seq_flag:2;              // 2: 0
-  uint8_t     seq_ctr_L;               // 3
-  uint8_t     pkt_len_H;               // 4
-  uint8_t     pkt_len_L;               // 5
-}; 
-
-struct __attribute__ ((packed)) ccsds_sec_hdr_t {
-  uint8_t     apidQ_H:1;               // 0:7
-  bool        playback:1;              // 0: 6
-  bool        spare0:1;                // 0:  5
-  bool        crc_flag:1;              // 0:   4
-  uint8_t     version:4;               // 0:    3-0
-  uint32_t    apidQ_L:24;              // 1-3
-  uint8_t     spare1;                  // 4
-  uint8_t     source_id;               // 5
-  uint16_t    timestamp_msw;           // 6-7
-  uint16_t    timestamp_lsw;           // 8-9
-  uint16_t    timestamp_subsec;        // 10-11
-  uint16_t    spare2;                  // 12-13
-}; 
-
-struct __attribute__ ((packed)) ccsds_t {
-  ccsds_hdr_t ccsds_hdr;
-  byte        blob[PARAMETER_MAX_SIZE+6];   // sized for longest possible sts_esp32/sts_esp32cam packet
-};
-
-struct __attribute__ ((packed)) sts_esp32_t { // APID: 42 (2a)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     type:4;                  // 4-7
-  uint8_t     subsystem:4;             //  0-3
-  char        message[PARAMETER_MAX_SIZE];
-};
-
-struct __attribute__ ((packed)) sts_esp32cam_t { // APID: 43 (2b)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     type:4;                  // 4-7
-  uint8_t     subsystem:4;             //  0-3
-  char        message[PARAMETER_MAX_SIZE];
-}; 
-
-struct __attribute__ ((packed)) tm_esp32_t { // APID: 44 (2c)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     opsmode:2;               // 6-7
-  uint8_t     state:2;                 //  4-5
-  uint8_t     buffer_fs:2;             //   2-3 
-  uint8_t     ftp_fs:2;                //    0-1 
-  uint8_t     error_ctr;
-  uint8_t     warning_ctr;
-  uint8_t     tc_exec_ctr;
-  uint8_t     tc_fail_ctr;
-  uint8_t     radio_rate;
-  uint8_t     pressure_rate;
-  uint8_t     motion_rate;
-  uint8_t     gps_rate;
-  uint8_t     camera_rate;
-  uint8_t     udp_rate;
-  uint8_t     yamcs_rate;
-  uint8_t     serial_in_rate;
-  uint8_t     serial_out_rate;
-  uint8_t     fs_rate;                                                          
-  uint8_t     yamcs_buffer;
-  uint8_t     serial_out_buffer;
-  uint16_t    mem_free;
-  uint16_t    fs_free;
-  int16_t     temperature;             // cdegC
-  bool        radio_enabled:1;         // 7
-  bool        pressure_enabled:1;      //  6
-  bool        motion_enabled:1;        //   5
-  bool        gps_enabled:1;           //    4
-  bool        camera_enabled:1;        //     3
-  bool        wifi_enabled:1;          //      2
-  bool        wifi_udp_enabled:1;      //       1
-  bool        wifi_yamcs_enabled:1;    //        0
-  bool        fs_enabled:1;            // 7
-  bool        ftp_enabled:1;           //  6
-  bool        ota_enabled:1;           //   5 
-  bool        temperature_enabled:1;   //    4
-  bool        free_23:1;               //     3 - free to assign
-  bool        free_22:1;               //      2 - free to assign
-  bool        free_21:1;               //       1 - free to assign
-  bool        time_set:1;              //        0
-  bool        serial_connected:1;      // 7
-  bool        wifi_connected:1;        //  6 
-  bool        warn_serial_connloss:1;  //   5        
-  bool        warn_wifi_connloss:1;    //    4       
-  bool        err_serial_dataloss:1;   //     3
-  bool        err_yamcs_dataloss:1;    //      2
-  bool        err_fs_dataloss:1;       //       1
-  bool        separation_sts:1;        //        0  
-  bool        radio_active:1;          // 7
-  bool        pressure_active:1;       //  6
-  bool        motion_active:1;         //   5
-  bool        gps_active:1;            //    4
-  bool        camera_active:1;         //     3
-  bool        fs_active:1;             //      2
-  bool        ftp_active:1;            //       1
-  bool        buffer_active:1;         //        0
-};
-
-struct __attribute__ ((packed)) tm_esp32cam_t { // APID: 45 (2d)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     opsmode:2;               // 6-7
-  uint8_t     buffer_fs:2;             //  4-5
-  uint8_t     ftp_fs:2;                //   2-3
-  bool        free01:1;                //    1 - free to assign
-  bool        free00:1;                //     0 - free to assign
-  uint8_t     error_ctr;
-  uint8_t     warning_ctr;
-  uint8_t     tc_exec_ctr;
-  uint8_t     tc_fail_ctr;
-  uint8_t     camera_rate;
-  uint8_t     udp_rate;
-  uint8_t     yamcs_rate;
-  uint8_t     serial_in_rate;
-  uint8_t     serial_out_rate;
-  uint8_t     fs_rate;
-  uint8_t     sd_json_rate;
-  uint8_t     sd_ccsds_rate;
-  uint8_t     sd_image_rate;
-  uint8_t     yamcs_buffer;
-  uint8_t     serial_out_buffer;
-  uint16_t    mem_free;
-  uint16_t    fs_free;
-  uint16_t    sd_free;
-  bool        camera_enabled:1;        // 7   
-  bool        wifi_enabled:1;          //  6
-  bool        wifi_udp_enabled:1;      //   5
-  bool        wifi_yamcs_enabled:1;    //    4
-  bool        wifi_image_enabled:1;    //     3
-  bool        free_12:1;               //      2 - free to assign
-  bool        free_11:1;               //       1 - free to assign
-  bool        time_set:1;              //        0
-  bool        fs_enabled:1;            // 7 
-  bool        sd_enabled:1;            //  6 
-  bool        ftp_enabled:1;           //   5      
-  bool        ota_enabled:1;           //    4
-  bool        sd_image_enabled:1;      //     3
-  bool        sd_json_enabled:1;       //      2
-  bool        sd_ccsds_enabled:1;      //       1 
-  bool        http_enabled:1;          //        0
-  bool        serial_connected:1;      // 7
-  bool        wifi_connected:1;        //  6 
-  bool        warn_serial_connloss:1;  //   5        
-  bool        warn_wifi_connloss:1;    //    4       
-  bool        err_serial_dataloss:1;   //     3
-  bool        err_yamcs_dataloss:1;    //      2
-  bool        err_fs_dataloss:1;       //       1
-  bool        err_sd_dataloss:1;       //        0           
-  bool        camera_active:1;         // 7
-  bool        fs_active:1;             //  6
-  bool        sd_active:1;             //   5
-  bool        ftp_active:1;            //    4
-  bool        buffer_active:1;         //     3
-  bool        http_active:1;           //      2  
-  bool        free_41:1;               //       1 - free to assign 
-  bool        free_40:1;               //        0 - free to assign 
-};
-
-struct __attribute__ ((packed)) tm_camera_t { // APID: 46 (2e)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     camera_mode:2;           // 6-7
-  uint8_t     resolution:4;            //  2-5
-  bool        auto_res:1;              //   1
-  bool        free_00:1;               //    0 - free to assign
-  uint32_t    filesize:24; 
-  uint8_t     wifi_ms; 
-  uint8_t     sd_ms;
-  uint8_t     exposure_ms;
-  char        filename[36]; 
-};
-
-struct __attribute__ ((packed)) tm_gps_t { // APID: 47 (2f)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     status:4;                // 4-7
-  uint8_t     satellites:4;            //  0-3   *GGA
-  uint8_t     hours;                   //        RMC,*GGA,ZDA
-  uint8_t     minutes;                 //        RMC,*GGA,ZDA
-  uint8_t     seconds;                 //        RMC,*GGA,ZDA
-  uint8_t     centiseconds;            //        *GST
-  int32_t     latitude;                //        RMC,*GGA,GLL
-  int32_t     longitude;               //        RMC,*GGA,GLL
-  int32_t     altitude;                // cm     *GGA
-  int32_t     latitude_zero;
-  int32_t     longitude_zero;
-  int32_t     altitude_zero;           // cm  
-  int16_t     x;                       // cm
-  int16_t     y;                       // cm
-  int16_t     z;                       // cm
-  int16_t     x_err;                   // cm     *GST
-  int16_t     y_err;                   // cm     *GST
-  int16_t     z_err;                   // cm     *GST
-  int32_t     v_north;                 // cm/s   VTG
-  int32_t     v_east;                  // cm/s   VTG
-  int32_t     v_down;                  // cm/s   PUBX_00
-  uint16_t    milli_hdop;              //        *GSA
-  uint16_t    milli_vdop;              //        *GSA
-  uint16_t    milli_pdop;              //        *GSA
-  bool        time_valid:1;            // 7
-  bool        location_valid:1;        //  6
-  bool        altitude_valid:1;        //   5
-  bool        speed_valid:1;           //    4
-  bool        hdop_valid:1;            //     3
-  bool        vdop_valid:1;            //      2
-  bool        pdop_valid:1;            //       1
-  bool        error_valid:1;           //        0
-  bool        offset_valid:1;          // 7
-  bool        free_16:1;               //  6 - free to assign
-  bool        free_15:1;               //   5 - free to assign
-  bool        free_14:1;               //    4 - free to assign
-  bool        free_13:1;               //     3 - free to assign
-  bool        free_12:1;               //      2 - free to assign
-  bool        free_11:1;               //       1 - free to assign
-  bool        free_10:1;               //        0 - free to assign
-};
-
-struct __attribute__ ((packed)) tm_motion_t { // APID: 48 (30)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  int16_t     accel_x;                 // cm/s2
-  int16_t     accel_y;                 // cm/s2
-  int16_t     accel_z;                 // cm/s2
-  int16_t     gyro_x;                  // cdeg/s
-  int16_t     gyro_y;                  // cdeg/s
-  int16_t     gyro_z;                  // cdeg/s
-  int16_t     magn_x;                  // uT
-  int16_t     magn_y;                  // uT
-  int16_t     magn_z;                  // uT
-  int16_t     tilt;                    // cdeg
-  uint16_t    g;                       // mG
-  int16_t     a;                       // cm/s2
-  int16_t     rpm;                     // crpm
-  uint8_t     accel_range:2;           //  6-7
-  uint8_t     gyro_range:2;            //   4-5
-  bool        accel_valid:1;           //    3
-  bool        gyro_valid:1;            //     2
-  bool        free_01:1;               //      1 - free to assign
-  bool        free_00:1;               //       0 - free to assign
-}; 
-
-struct __attribute__ ((packed)) tm_pressure_t { // APID: 49 (31)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint32_t    pressure;                // Pa
-  uint32_t    zero_level_pressure;     // Pa
-  int16_t     height;                  // cm
-  int16_t     velocity_v;              // cm/s
-  int16_t     temperature;             // cdegC
-  bool        height_valid:1;          // 7
-  bool        free_06:1;               //  6 - free to assign
-  bool        free_05:1;               //   5 - free to assign
-  bool        free_04:1;               //    4 - free to assign
-  bool        free_03:1;               //     3 - free to assign
-  bool        free_02:1;               //      2 - free to assign
-  bool        free_01:1;               //       1 - free to assign
-  bool        free_00:1;               //        0 - free to assign
-}; 
-
-struct __attribute__ ((packed)) tm_radio_t { // APID: 50 (32)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint8_t     opsmode:2;               // 6
-  uint8_t     state:2;                 //  4
-  bool        pressure_active:1;       //   3
-  bool        motion_active:1;         //    2
-  bool        gps_active:1;            //     1
-  bool        camera_active:1;         //      0
-  uint8_t     error_ctr;
-  uint8_t     warning_ctr;
-  uint8_t     pressure_height;         // m               (0 - 255 m)
-  int8_t      pressure_velocity_v;     // m/s             (-125 - 126 m/s)
-  int8_t      temperature;             // degC            (-125 - 126 degC)
-  uint8_t     motion_tilt;             // deg             (0 - 180 deg)
-  uint8_t     motion_g;                // G / 10          (0 - 25.5 G)  
-  int8_t      motion_a;                // m/s2            (-125 - 126 m/s2)
-  int8_t      motion_rpm;              //                 (-125 - 126 rpm)  
-  uint8_t     gps_satellites:4;        //   4-7
-  bool        esp32_buffer_active:1;   //    3
-  bool        esp32cam_buffer_active:1; //    2
-  bool        esp32cam_sd_image_enabled:1; //  1
-  bool        esp32cam_wifi_image_enabled:1; // 0
-  int8_t      gps_velocity_v;          // m/s             (-125 - 126 m/s)
-  uint8_t     gps_velocity;            // m/s             (0 - 255 m/s)
-  uint8_t     gps_height;              // m               (0 - 255 m)
-  uint16_t    camera_image_ctr;  
-  bool        esp32_serial_connected:1;        // 7
-  bool        esp32_wifi_connected:1;          //  6 
-  bool        esp32_warn_serial_connloss:1;    //   5        
-  bool        esp32_warn_wifi_connloss:1;      //    4       
-  bool        esp32_err_serial_dataloss:1;     //     3
-  bool        esp32_err_yamcs_dataloss:1;      //      2
-  bool        esp32_err_fs_dataloss:1;         //       1  
-  bool        separation_sts:1;                //        0
-  bool        esp32cam_serial_connected:1;     // 7
-  bool        esp32cam_wifi_connected:1;       //  6
-  bool        esp32cam_warn_serial_connloss:1; //   5        
-  bool        esp32cam_warn_wifi_connloss:1;   //    4       
-  bool        esp32cam_err_serial_dataloss:1;  //     3
-  bool        esp32cam_err_yamcs_dataloss:1;   //      2
-  bool        esp32cam_err_fs_dataloss:1;      //       1
-  bool        esp32cam_err_sd_dataloss:1;      //        0
-}; 
-
-struct __attribute__ ((packed)) timer_esp32_t { // APID: 51 (33)
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint16_t    radio_duration;
-  uint16_t    pressure_duration;
-  uint16_t    motion_duration;
-  uint16_t    gps_duration;
-  uint16_t    esp32cam_duration;
-  uint16_t    serial_duration;
-  uint16_t    ota_duration;
-  uint16_t    ftp_duration;
-  uint16_t    wifi_duration;
-  uint16_t    tc_duration;
-  uint16_t    idle_duration;
-  uint16_t    publish_fs_duration;
-  uint16_t    publish_serial_duration;
-  uint16_t    publish_yamcs_duration;
-  uint16_t    publish_udp_duration;
-};
-
-struct __attribute__ ((packed)) timer_esp32cam_t { // APID: 52 (34)  // TODO: fine-tune packet
-  ccsds_hdr_t ccsds_hdr;
-  uint32_t    millis:24;
-  uint16_t    packet_ctr;
-  uint16_t    camera_duration;
-  uint16_t    serial_duration;
-  uint16_t    tc_duration;
-  uint16_t    sd_duration;
-  uint16_t    ftp_duration;
-  uint16_t    wifi_duration;
-  uint16_t    idle_duration;
-  uint16_t    publish_sd_duration;
-  uint16_t    publish_fs_duration;
-  uint16_t    publish_serial_duration;
-  uint16_t    publish_yamcs_duration;
-  uint16_t    publish_udp_duration;
-  uint16_t    ota_duration;
-};
-
-struct __attribute__ ((packed)) tc_esp32_t { // APID: 53 (35)
-  ccsds_hdr_t ccsds_hdr;
-  uint8_t     cmd_id;
-  char        parameter[PARAMETER_MAX_SIZE];
-}; 
+// archive sync triggers (bitmask)
+#define SYNC_NONE              0
+#define SYNC_BYTES             1      // after sync_bytes have been written
+#define SYNC_TIME              2      // after sync_interval ms
+#define SYNC_EVENT             4      // on opsmode or separation change
+
+// buffering sinks (each has its own cursor in the TM buffer store)
+#define SINK_YAMCS             0
+#define SINK_SERIAL            1
+#define NUMBER_OF_SINKS        2
+extern const char sinkName[NUMBER_OF_SINKS][7];
+
+// downlink shapers (a token bucket per PID on each live sink: the buffered sinks, then UDP)
+#define SHAPE_UDP              NUMBER_OF_SINKS
+#define NUMBER_OF_SHAPERS      (NUMBER_OF_SINKS + 1)
+extern const char shaperName[NUMBER_OF_SHAPERS][7];
+
+// decimation routes (the live sinks as numbered for the shapers, then the archives)
+#define ROUTE_YAMCS            SINK_YAMCS
+#define ROUTE_SERIAL           SINK_SERIAL
+#define ROUTE_UDP              SHAPE_UDP
+#define ROUTE_FS               NUMBER_OF_SHAPERS
+#define ROUTE_SD_JSON          (NUMBER_OF_SHAPERS + 1)
+#define ROUTE_SD_CCSDS         (NUMBER_OF_SHAPERS + 2)
+#define NUMBER_OF_ROUTES       (NUMBER_OF_SHAPERS + 3)
+extern const char routeName[NUMBER_OF_ROUTES][9];
+
+// WiFi station states (driven from the loop by wifi_check)
+#define WIFI_STA_IDLE          0      // station not started
+#define WIFI_STA_SCANNING      1
+#define WIFI_STA_CONNECTING    2
+#define WIFI_STA_CONNECTED     3
+#define WIFI_STA_BACKOFF       4      // waiting to scan again
+
+// transmit queue destinations
+#define TX_YAMCS               0      // CCSDS (packed) datagram to yamcs_server:yamcs_tm_port
+#define TX_UDP                 1      // text line to udp_server:udp_port
+
+// priority classes (each sink has a queue per class in the TM buffer store, drained in this order)
+#define PRIORITY_EVENT         0
+#define PRIORITY_HOUSEKEEPING  1
+#define PRIORITY_SCIENCE       2
+#define NUMBER_OF_PRIORITIES   3
+extern const char priorityName[NUMBER_OF_PRIORITIES][13];
 
-struct __attribute__ ((packed)) tc_esp32cam_t { // APID: 54 (36)
-  ccsds_hdr_t ccsds_hdr;
-  uint8_t     cmd_id;
-  char        parameter[PARAMETER_MAX_SIZE];
-}; 
+extern const char dhtName[5][7];
 
 struct __attribute__ ((packed)) config_network_t {
   char        wifi_ssid[20]; 
@@ -627,6 +242,21 @@ struct __attribute__ ((packed)) config_esp32_t {
   int16_t     mpu_gyro_offset_x;     // y_sensor values
   int16_t     mpu_gyro_offset_y;     // z_sensor values
   int16_t     mpu_gyro_offset_z;     // x_sensor values
+  uint16_t    fs_stage_size;         // bytes staged before a block-aligned archive write
+  uint16_t    sync_bytes;            // archive bytes written before a sync (SYNC_BYTES)
+  uint16_t    sync_interval;         // ms between syncs (SYNC_TIME)
+  uint8_t     sync_policy;           // bitmask of archive sync triggers
+  uint16_t    fs_segment_size;       // kB per archive segment
+  uint16_t    fs_reserve;            // kB kept free by evicting the oldest archive segments
+  uint16_t    fs_prealloc;           // kB reserved up front for each new archive segment on SD (0: off)
+  uint16_t    fs_index_packets;      // archive records per .idx entry (0: no index)
+  uint16_t    fs_index_interval;     // ms after which an .idx entry is closed anyway
+  uint8_t     replay_share;          // % of loop time available to archive replay
+  uint8_t     drain_newest;          // bitmask by priority class of backlogs drained newest segment first
+  uint16_t    yamcs_mtu;             // bytes of CCSDS packets packed per Yamcs datagram (0: one packet per datagram)
+  uint16_t    yamcs_flush;           // ms a packed Yamcs datagram waits for more packets at most
+  uint8_t     tc_batch;              // commands executed at most per yamcs_tc_check call
+  uint16_t    tc_budget;             // ms of commands executed per yamcs_tc_check call, after which the rest waits
   uint8_t     buffer_fs:2;
   uint8_t     ftp_fs:2;
   bool        radio_enable:1;          
@@ -644,6 +274,8 @@ struct __attribute__ ((packed)) config_esp32_t {
   bool        ftp_enable:1;
   bool        serial_format:1;         
   bool        ota_enable:1;
+  bool        fs_compress:1;           // delta-compressed CCSDS archive (.ccsdx)
+  bool        fs_framing:1;            // CRC-framed CCSDS archive records (.ccsdx)
   bool        motion_udp_raw_enable:1;
   bool        gps_udp_raw_enable:1;
 };
@@ -652,6 +284,21 @@ struct __attribute__ ((packed)) config_esp32cam_t {
   uint32_t    boot_epoch;
   char        config_file[20];
   char        routing_file[20];
+  uint16_t    fs_stage_size;         // bytes staged before a block-aligned archive write
+  uint16_t    sync_bytes;            // archive bytes written before a sync (SYNC_BYTES)
+  uint16_t    sync_interval;         // ms between syncs (SYNC_TIME)
+  uint8_t     sync_policy;           // bitmask of archive sync triggers
+  uint16_t    fs_segment_size;       // kB per archive segment
+  uint16_t    fs_reserve;            // kB kept free by evicting the oldest archive segments
+  uint16_t    fs_prealloc;           // kB reserved up front for each new archive segment on SD (0: off)
+  uint16_t    fs_index_packets;      // archive records per .idx entry (0: no index)
+  uint16_t    fs_index_interval;     // ms after which an .idx entry is closed anyway
+  uint8_t     replay_share;          // % of loop time available to archive replay
+  uint8_t     drain_newest;          // bitmask by priority class of backlogs drained newest segment first
+  uint16_t    yamcs_mtu;             // bytes of CCSDS packets packed per Yamcs datagram (0: one packet per datagram)
+  uint16_t    yamcs_flush;           // ms a packed Yamcs datagram waits for more packets at most
+  uint8_t     tc_batch;              // commands executed at most per yamcs_tc_check call
+  uint16_t    tc_budget;             // ms of commands executed per yamcs_tc_check call, after which the rest waits
   uint8_t     buffer_fs:2;
   uint8_t     ftp_fs:2;
   uint8_t     camera_rate:4;
@@ -670,6 +317,8 @@ struct __attribute__ ((packed)) config_esp32cam_t {
   bool        sd_ccsds_enable:1;       
   bool        sd_image_enable:1;  
   bool        serial_format:1;         
+  bool        fs_compress:1;           // delta-compressed CCSDS archive (.ccsdx)
+  bool        fs_framing:1;            // CRC-framed CCSDS archive records (.ccsdx)
 };
 
 struct __attribute__ ((packed)) var_timer_t {
@@ -699,12 +348,185 @@ struct __attribute__ ((packed)) var_timer_t {
   bool        do_ntp:1;
 }; 
 
-struct __attribute__ ((packed)) buffer_t { 
-  uint16_t    packet_len;
-  uint32_t    packet_offset;
-  bool        packet_saved;
+struct __attribute__ ((packed)) stage_t {
+  uint8_t     data[FS_STAGE_SIZE_MAX + FS_BLOCK_SIZE];
+  uint16_t    len;                     // bytes staged, not yet written to file
+  uint32_t    file_size;               // bytes written to file
+  uint8_t     filesystem;              // where the file is, for free space accounting
+  uint32_t    extent;                  // file size reserved up front (0: none), trimmed to file_size at close
+};
+
+struct __attribute__ ((packed)) tx_item_t { // a datagram in the transmit queue, followed by its data
+  uint8_t     destination;
+  uint32_t    ip;                      // resolved in the loop: the transmit task does not read config_network
+  uint16_t    port;
+  uint32_t    enqueue_micros;
 };
 
+struct tx_server_t {                   // server of a transmit destination, looked up from the loop by wifi_check
+  char        name[20];                // as configured when it was looked up
+  uint32_t    ip;
+  bool        resolved;
+  uint32_t    resolve_millis;          // of the last lookup
+};
+
+struct shaper_t {                      // live downlink of one PID on one sink
+  uint16_t    rate;                    // packets/s (0: not shaped)
+  uint16_t    burst;                   // packets sent back to back at most
+  uint32_t    tokens;                  // 1/1000 packets
+  uint32_t    refill_millis;
+  uint16_t    shaped;                  // packets held back since the last timer packet
+};
+
+struct decimation_t {                  // which packets of a PID a route takes
+  uint16_t    factor;                  // every factor-th packet, by sequence counter (0, 1: all)
+  uint16_t    interval;                // ms, the first packet of every interval, by packet millis (0: all)
+  uint32_t    slot;                    // interval of the last packet taken
+};
+
+struct wifi_ap_t {                     // an access point of a known network
+  bool        found;
+  int8_t      rssi;
+  uint8_t     channel;
+  uint8_t     bssid[6];
+};
+
+struct wifi_sta_t {                    // WiFi station connection state
+  uint8_t     state;
+  uint8_t     candidate;               // network tried: 0 is config_network.wifi_ssid, n is default_wifi_ssid[n-1]
+  bool        fast;                    // trying the access point of the last connection, without a scan
+  uint32_t    state_millis;            // when the state was entered
+  uint16_t    timeout;                 // s, of the connection attempt
+  uint16_t    backoff;                 // s, next wait after a failed round
+};
+
+struct wifi_cache_t {                  // access point of the last connection, for a fast reconnection
+  bool        valid;
+  char        ssid[20];
+  wifi_ap_t   ap;
+};
+
+struct tx_stats_t {                    // transmit queue accounting, collected once per timer packet
+  uint16_t    dropped;                 // datagrams not queued: queue full
+  uint16_t    failed;                  // datagrams the WiFi stack did not take
+  uint16_t    throttled;               // backlog drains held back by a filling queue
+  uint32_t    latency_max;             // us from enqueue to handed to the WiFi stack
+  uint32_t    enqueue_max;             // us spent queueing a datagram
+};
+
+struct tc_slot_t {                     // a command received by the AsyncUDP task, waiting for the loop
+  uint16_t    len;
+  uint32_t    received_micros;
+  ccsds_t     ccsds;
+};
+
+struct tc_pool_t {                     // single-producer (AsyncUDP task), single-consumer (loop) command queue
+  tc_slot_t   slot[TC_POOL_SIZE];
+  uint32_t    head;                    // slots filled, written by the AsyncUDP task only
+  uint32_t    tail;                    // slots executed, written by the loop only
+  uint32_t    dropped;                 // commands not queued (pool full, or bad length), written by the AsyncUDP task only
+  uint32_t    dropped_reported;        // dropped at the last timer packet
+  uint8_t     queued_max;              // deepest queue seen by the loop since the last timer packet
+};
+
+struct __attribute__ ((packed)) datagram_t { // CCSDS packets packed back to back into one Yamcs datagram
+  uint8_t     data[YAMCS_MTU_MAX];
+  uint16_t    len;
+  uint32_t    millis;                  // when the first packet was packed
+};
+
+struct writer_t {                      // an archive being written, with its own handle, segment and sync state
+  uint8_t     filesystem;
+  uint8_t     encoding;                // ENC_CCSDS or ENC_JSON
+  char        base[30];                // session path without segment and extension, e.g. /240813AA/240813AA
+  char        path[38];                // current segment
+  uint16_t    segment;
+  File        file;
+  stage_t     stage;
+  uint32_t    unsynced_bytes;          // written since the last sync (SYNC_BYTES)
+  uint32_t    sync_millis;             // last sync (SYNC_TIME)
+  bool        compressed;              // delta coding in the current CCSDS segment
+  bool        framed;                  // CRC framing in the current CCSDS segment
+  codec_t     codec;
+  File        index;                   // .idx sidecar of the current CCSDS segment
+  char        index_path[38];
+  index_entry_t index_entry;
+};
+
+struct __attribute__ ((packed)) fs_space_t {
+  uint64_t    total;                   // bytes
+  uint64_t    used;                    // bytes at the last sync, plus what was written since
+  uint32_t    sync_millis;
+  bool        evict_idle;              // the last eviction step found nothing to evict
+  uint32_t    evict_millis;            // of that step
+};
+
+struct __attribute__ ((packed)) reader_t {
+  uint8_t     data[READ_AHEAD_SIZE];
+  uint32_t    offset;                  // file offset of data[0]
+  uint16_t    len;                     // valid bytes in data
+};
+
+struct __attribute__ ((packed)) store_pos_t {
+  uint8_t     segment;
+  uint32_t    offset;
+};
+
+struct __attribute__ ((packed)) store_state_t { // saved alternately to STORE_DIR/state0 and STORE_DIR/state1
+  uint32_t    sequence;                // highest valid sequence wins at mount
+  uint8_t     version;                 // STORE_VERSION at time of writing
+  uint8_t     segments;                // STORE_SEGMENTS at time of writing
+  store_pos_t head;                    // next record is appended here
+  store_pos_t tail;                    // oldest record still in the ring
+  uint16_t    offset[STORE_SEGMENTS][NUMBER_OF_PRIORITIES][NUMBER_OF_SINKS]; // next record to examine per segment, for each queue
+  uint16_t    pending[STORE_SEGMENTS][NUMBER_OF_PRIORITIES][NUMBER_OF_SINKS]; // records per segment still to be sent, for each queue
+  uint16_t    crc;
+};
+
+struct __attribute__ ((packed)) store_entry_t { // a TM buffer store record, as indexed in RAM
+  uint8_t     segment;
+  uint16_t    offset;                  // (STORE_SEGMENT_SIZE fits in 16 bits)
+  uint16_t    len;                     // including STORE_RECORD_OVERHEAD
+  uint8_t     flags;                   // sink mask and priority class
+};
+
+struct __attribute__ ((packed)) store_index_t { // fixed-size ring: older records are only found in the segment files
+  store_entry_t entry[STORE_INDEX_SIZE];
+  uint32_t    first;                   // sequence number of the oldest valid entry
+  uint32_t    next;                    // sequence number of the next entry to be added
+  uint32_t    hint[NUMBER_OF_PRIORITIES][NUMBER_OF_SINKS]; // sequence number of the entry last examined for each queue (verified before use)
+};
+
+struct __attribute__ ((packed)) store_last_t { // the record last read from the TM buffer store, for the next sink that wants it
+  store_pos_t pos;
+  uint16_t    len;                     // including STORE_RECORD_OVERHEAD; 0: none
+  uint8_t     flags;
+  ccsds_t     packet;
+};
+
+struct __attribute__ ((packed)) drain_t { // token bucket pacing the TM buffer store backlog drain
+  float       tokens;                  // backlog records that may be released now
+  uint16_t    rate;                    // backlog records/s, adapted once per timer packet
+  uint32_t    refill_millis;
+  uint32_t    busy_micros;             // time spent draining since the last adaptation
+  uint16_t    sent;                    // backlog records released since the last adaptation
+};
+
+struct __attribute__ ((packed)) replay_t {
+  char        path[38];
+  uint32_t    size;
+  uint32_t    offset;                  // file offset of the next record
+  uint32_t    skipped;                 // bytes skipped over corrupt records
+  uint32_t    packets;                 // packets sent
+  uint32_t    start_millis;            // local millis() the replay timeline is anchored at
+  uint32_t    first_millis;            // packet millis at the anchor
+  uint32_t    last_millis;             // packet millis of the packet read last
+  uint8_t     speed;                   // 0: as fast as the link allows, 1: real time, N: N times real time
+  uint8_t     fs;
+  bool        compressed:1;
+  bool        framed:1;
+  bool        pending:1;               // packet read, waiting until it is due or the link takes it
+};
 
 extern sts_esp32_t         sts_esp32;
 extern sts_esp32cam_t      sts_esp32cam;
@@ -749,14 +571,24 @@ extern config_esp32cam_t*  config_this;
 #endif
 
 extern char buffer[BUFFER_MAX_SIZE];
-extern File file_ccsds, file_json;
+extern writer_t writers[NUMBER_OF_WRITERS];
 extern UnixTime datetime;
 
 // FS FUNCTIONALITY
 extern bool fs_setup ();
 extern bool fs_flush_data ();
 extern uint16_t fs_free ();
+extern void fs_space_sync (uint8_t filesystem);
+extern void fs_space_add (uint8_t filesystem, int32_t bytes);
+extern uint64_t fs_space_free (uint8_t filesystem);
+extern FS* get_fs (uint8_t filesystem);
+extern uint32_t fs_file_size (uint8_t filesystem, const char* path);
 void create_today_dir (uint8_t filesystem);
+extern void archive_path (char* path, const char* base, uint16_t segment, const char* extension);
+extern void archive_rename (uint8_t filesystem, const char* new_base);
+extern const char* ccsds_extension ();
+extern bool fs_evict (uint8_t filesystem);
+extern void fs_check ();
 #ifdef PLATFORM_ESP32CAM
 extern bool sd_setup ();
 extern uint16_t sd_free ();
@@ -770,6 +602,11 @@ extern bool file_load_settings (uint8_t filesystem);
 extern bool file_load_config (uint8_t filesystem, const char* filename);
 extern bool file_load_routing (uint8_t filesystem, const char* filename);
 extern String set_routing (char* routing_table, const char* routing_string);
+extern String set_priority (char* priority_table, const char* priority_string);
+extern String set_shaping (shaper_t* shaper_table, const char* shaping_string);
+extern String set_decimation (decimation_t* decimation_table, const char* decimation_string);
+extern const char* parse_decimation (decimation_t* decimation, const char* entry);
+extern bool decimation_select (decimation_t* decimation, ccsds_t* ccsds_ptr);
 extern bool set_parameter (const char* parameter, const char* value);
 extern void set_opsmode (uint8_t default_opsmode);
 
@@ -778,40 +615,104 @@ extern bool wifi_setup ();
 extern bool wifi_ap_setup ();
 extern bool wifi_sta_setup ();
 extern bool wifi_check ();
+extern const char* wifi_candidate_ssid (uint8_t candidate);
+extern const char* wifi_candidate_password (uint8_t candidate);
+extern void wifi_sta_begin (uint8_t candidate, const wifi_ap_t* ap, uint16_t timeout);
+extern bool wifi_sta_fast ();
+extern void wifi_sta_scan ();
+extern void wifi_sta_next (uint8_t candidate);
+extern void wifi_sta_backoff ();
+extern void wifi_sta_connected ();
 extern bool ntp_check ();
 
 // TM/TC FUNCTIONALITY
 extern void publish_event (uint16_t PID, uint8_t subsystem, uint8_t event_type, const char* event_message);
 extern void publish_packet (ccsds_t* ccsds_ptr);
 extern bool publish_file (uint8_t filesystem, uint8_t encoding, ccsds_t* ccsds_ptr);
+extern void send_serial (ccsds_t* ccsds_ptr);
 extern bool publish_serial (ccsds_t* ccsds_ptr);
+extern bool tx_setup ();
+extern bool tx_room (uint16_t len);
+extern void tx_resolve (uint8_t destination);
+extern bool tx_send (uint8_t destination, const uint8_t* data, uint16_t len);
+extern void tx_collect ();
+extern void send_yamcs (ccsds_t* ccsds_ptr);
+extern void yamcs_flush ();
+extern void yamcs_flush_check ();
 extern bool publish_yamcs (ccsds_t* ccsds_ptr);
 extern bool publish_udp (ccsds_t* ccsds_ptr);
 extern bool publish_udp_text (const char* message);
 extern bool yamcs_tc_setup ();
-#ifndef ASYNCUDP
 extern bool yamcs_tc_check ();
-#endif
+extern void tc_collect ();
+extern bool shape_pass (uint8_t shaper_id, uint16_t PID);
+extern void shape_collect ();
 extern uint16_t update_packet (ccsds_t* ccsds_ptr);
 extern void reset_packet (ccsds_t* ccsds_ptr);
-extern bool sync_file_ccsds ();
-extern bool sync_file_json ();
+extern writer_t* get_writer (uint8_t filesystem, uint8_t encoding);
+extern bool open_file (writer_t* writer);
+extern bool open_file_ccsds (writer_t* writer);
+extern bool open_file_json (writer_t* writer);
+extern bool sync_file (writer_t* writer);
+extern void sync_file_done (uint8_t filesystem, uint16_t sync_duration);
+extern bool close_file (writer_t* writer);
+extern void close_files (uint8_t filesystem);
+extern bool rotate_file (writer_t* writer);
+extern bool write_file_ccsds (writer_t* writer, ccsds_t* ccsds_ptr);
+extern bool archive_recover (writer_t* writer);
+extern bool archive_recover_file (uint8_t filesystem, const char* path, File* file, uint32_t* file_size, uint8_t* flags);
+extern bool json_recover_file (uint8_t filesystem, const char* path, File* file, uint32_t* file_size);
+extern void archive_recover_mount (uint8_t filesystem);
+extern void index_begin (writer_t* writer, uint32_t offset);
+extern void index_add (writer_t* writer, ccsds_t* ccsds_ptr);
+extern void index_flush (writer_t* writer);
+extern void index_trim (uint8_t filesystem, const char* path, uint32_t end);
+extern bool index_lookup (uint8_t filesystem, const char* index_path, uint32_t millis, index_entry_t* entry);
+extern void sync_check ();
+extern bool stage_write (File* file, stage_t* stage, const uint8_t* data, uint16_t len);
+extern bool stage_flush (File* file, stage_t* stage, bool flush_all);
+extern bool stage_prealloc (File* file, stage_t* stage, const char* path);
+extern void stage_trim (stage_t* stage, const char* path);
+extern uint32_t fs_data_end (File* file, uint32_t size);
+extern bool fs_truncate (uint8_t filesystem, const char* path, uint32_t size);
+
+// TM BUFFER STORE FUNCTIONALITY
+extern void reader_reset (reader_t* reader);
+extern bool reader_cached (reader_t* reader, uint32_t offset, uint16_t len);
+extern bool reader_read (File* file, reader_t* reader, uint32_t offset, uint8_t* data, uint16_t len);
+extern void store_index_reset ();
+extern void store_index_add (uint32_t offset, uint16_t len, uint8_t flags);
+extern void store_index_drop (uint8_t segment);
+extern bool store_index_find (uint8_t priority, uint8_t sink, store_pos_t* pos, uint32_t* sequence);
+extern void store_index_skip (uint8_t priority, uint8_t sink, store_pos_t* pos);
+extern bool store_setup (uint8_t filesystem);
+extern void store_defer (uint8_t sink);
+extern bool store_commit (ccsds_t* ccsds_ptr);
+extern bool store_read (uint8_t priority, uint8_t sink, ccsds_t* ccsds_ptr);
+extern void store_ready (uint8_t sink);
+extern void store_drain ();
+extern void drain_adapt ();
+extern uint32_t store_pending (uint8_t sink);
+extern uint32_t store_queued (uint8_t priority, uint8_t sink);
+extern bool store_sync ();
+
+// ARCHIVE REPLAY FUNCTIONALITY
+extern bool replay_next ();
+extern bool publish_replay (ccsds_t* ccsds_ptr);
+extern void replay_close (const char* reason);
+extern void replay_check ();
 
 // CCSDS FUNCTIONALITY
 extern void ccsds_init ();
 extern void ccsds_hdr_init (ccsds_t* ccsds_ptr, uint16_t PID, uint8_t pkt_type, uint16_t pkt_len);
 extern bool valid_ccsds_hdr (ccsds_t* ccsds_ptr, bool pkt_type);
 extern void update_ccsds_hdr (ccsds_t* ccsds_ptr, bool pkt_type, uint16_t pkt_len);
-extern uint16_t get_ccsds_apid (ccsds_t* ccsds_ptr);
 extern uint32_t get_ccsds_ctr (ccsds_t* ccsds_ptr);
-extern uint16_t get_ccsds_packet_len (ccsds_t* ccsds_ptr);
 extern void set_ccsds_payload_len (ccsds_t* ccsds_ptr, uint16_t len);
 extern uint16_t get_ccsds_packet_ctr (ccsds_t* ccsds_ptr);
-extern uint32_t get_ccsds_millis (ccsds_t* ccsds_ptr);
 extern void parse_ccsds (ccsds_t* ccsds_ptr);
 
 // JSON FUNCTIONALITY
-extern void build_json_str (char* json_buffer, ccsds_t* ccsds_ptr);
 extern bool parse_json (const char* json_string);
 
 // SERIAL FUNCTIONALITY
@@ -828,6 +729,8 @@ extern bool cmd_load_routing (const char* filename);
 extern bool cmd_set_parameter (const char* parameter, const char* value);
 extern bool cmd_toggle_routing (uint16_t PID, const char interface);
 extern bool cmd_freeze_opsmode (bool frozen);
+extern bool cmd_replay_start (const char* filename, uint8_t speed);
+extern bool cmd_replay_stop ();
 
 // SUPPORT FUNCTIONS
 extern uint8_t id_of (const char* string, uint8_t string_len, const char* array_of_strings, uint16_t array_len);
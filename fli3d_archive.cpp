@@ -0,0 +1,221 @@
+/*
+ * Fli3d - Library (archive codec, portable: also used by the ground tools)
+ *
+ * Each packet is stored either raw or as the XOR against the previous packet with the same APID and 
+ * length. The XOR is packed per group of 8 bytes as a bitmap byte (bit set: byte is non-zero) followed 
+ * by the non-zero bytes, so unchanged fields cost one bit. The encoder falls back to a raw record for 
+ * the first packet of an APID after a reset, so a reader can start at any segment start or index entry.
+ */
+
+#ifndef ARDUINO_ESP8266_NODEMCU
+
+#include <fli3d_archive.h>
+#include <string.h>
+
+uint16_t crc16 (const uint8_t* data, uint16_t length, uint16_t crc) { // CRC-16/CCITT-FALSE; pass crc to continue a previous one
+  while (length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return (crc);
+}
+
+void archive_hdr_init (archive_hdr_t* hdr, uint8_t flags) {
+  memcpy (hdr->magic, ARCHIVE_MAGIC, 4);
+  hdr->version = ARCHIVE_VERSION;
+  hdr->flags = flags;
+}
+
+bool archive_hdr_valid (const uint8_t* data, uint16_t len) {
+  return (len >= sizeof(archive_hdr_t) and !memcmp (data, ARCHIVE_MAGIC, 4) and ((archive_hdr_t*)data)->version == ARCHIVE_VERSION);
+}
+
+void archive_codec_reset (codec_t* codec) {
+  memset (codec->ref_len, 0, sizeof(codec->ref_len));
+}
+
+uint16_t archive_packet_len (const uint8_t* packet) {
+  return (6 + 256*packet[4] + packet[5] + 1);
+}
+
+uint16_t archive_encode (codec_t* codec, const uint8_t* packet, uint8_t* record) {
+  // returns record length, or 0 if the packet cannot be archived
+  uint16_t packet_len = archive_packet_len (packet);
+  uint16_t apid = 256*(packet[0] & 0x07) + packet[1];
+  uint16_t index = apid - ARCHIVE_APID_BASE;
+  uint16_t record_len;
+  uint8_t* bitmap = NULL;
+  uint8_t delta;
+  if (packet_len > ARCHIVE_PACKET_MAX_SIZE) {
+    return 0;
+  }
+  if (apid >= ARCHIVE_APID_BASE and index < ARCHIVE_APIDS and codec->ref_len[index] == packet_len) {
+    record[0] = ARCHIVE_TAG_DELTA | index;
+    record_len = 1;
+    for (uint16_t i = 0; i < packet_len; i++) {
+      if (!(i % 8)) {
+        bitmap = &record[record_len++];
+        *bitmap = 0;
+      }
+      delta = packet[i] ^ codec->ref[index][i];
+      if (delta) {
+        *bitmap |= (1 << (i % 8));
+        record[record_len++] = delta;
+      }
+    }
+    if (record_len > packet_len + 1) {
+      // nothing gained: store raw
+      record[0] = ARCHIVE_TAG_RAW;
+      memcpy (record + 1, packet, packet_len);
+      record_len = packet_len + 1;
+    }
+  }
+  else {
+    record[0] = ARCHIVE_TAG_RAW;
+    memcpy (record + 1, packet, packet_len);
+    record_len = packet_len + 1;
+  }
+  if (apid >= ARCHIVE_APID_BASE and index < ARCHIVE_APIDS) {
+    memcpy (codec->ref[index], packet, packet_len);
+    codec->ref_len[index] = packet_len;
+  }
+  return (record_len);
+}
+
+int16_t archive_decode (codec_t* codec, const uint8_t* record, uint16_t len, uint8_t* packet) {
+  // returns bytes consumed, 0 if the record is incomplete, -1 if it is corrupt
+  uint16_t packet_len;
+  uint16_t apid;
+  uint16_t index;
+  uint16_t pos = 1;
+  uint8_t bitmap = 0;
+  if (len < 1) {
+    return 0;
+  }
+  if (record[0] == ARCHIVE_TAG_RAW) {
+    if (len < 1 + 6) {
+      return 0;
+    }
+    packet_len = archive_packet_len (record + 1);
+    if (packet_len > ARCHIVE_PACKET_MAX_SIZE) {
+      return -1;
+    }
+    if (len < 1 + packet_len) {
+      return 0;
+    }
+    memcpy (packet, record + 1, packet_len);
+    pos = 1 + packet_len;
+  }
+  else if (record[0] & ARCHIVE_TAG_DELTA) {
+    index = record[0] & ~ARCHIVE_TAG_DELTA;
+    if (index >= ARCHIVE_APIDS or !codec->ref_len[index]) {
+      return -1;
+    }
+    packet_len = codec->ref_len[index];
+    for (uint16_t i = 0; i < packet_len; i++) {
+      if (!(i % 8)) {
+        if (pos >= len) {
+          return 0;
+        }
+        bitmap = record[pos++];
+      }
+      if (bitmap & (1 << (i % 8))) {
+        if (pos >= len) {
+          return 0;
+        }
+        packet[i] = codec->ref[index][i] ^ record[pos++];
+      }
+      else {
+        packet[i] = codec->ref[index][i];
+      }
+    }
+  }
+  else {
+    return -1;
+  }
+  apid = 256*(packet[0] & 0x07) + packet[1];
+  index = apid - ARCHIVE_APID_BASE;
+  if (apid >= ARCHIVE_APID_BASE and index < ARCHIVE_APIDS) {
+    memcpy (codec->ref[index], packet, packet_len);
+    codec->ref_len[index] = packet_len;
+  }
+  return (pos);
+}
+
+uint32_t index_search (const index_entry_t* entries, uint32_t count, uint32_t millis) {
+  // binary search: last entry started at or before millis (0 if none)
+  uint32_t low = 0;
+  uint32_t high = count;
+  uint32_t mid;
+  while (high - low > 1) {
+    mid = low + (high - low) / 2;
+    if (entries[mid].millis <= millis) {
+      low = mid;
+    }
+    else {
+      high = mid;
+    }
+  }
+  return (low);
+}
+
+void archive_frame_hdr (uint8_t* frame_hdr, uint16_t record_len) {
+  frame_hdr[0] = ARCHIVE_SYNC_H;
+  frame_hdr[1] = ARCHIVE_SYNC_L;
+  frame_hdr[2] = record_len >> 8;
+  frame_hdr[3] = record_len & 0xFF;
+}
+
+uint16_t archive_frame_crc (const uint8_t* record, uint16_t record_len) {
+  uint8_t len[2] = { (uint8_t)(record_len >> 8), (uint8_t)(record_len & 0xFF) };
+  return (crc16 (record, record_len, crc16 (len, 2)));
+}
+
+int16_t archive_unframe (const uint8_t* data, uint16_t len, uint16_t* record_len) {
+  // returns frame length (record at data + 4), 0 if the frame is incomplete, -1 if there is no valid frame here
+  uint16_t crc;
+  if (len >= 1 and data[0] != ARCHIVE_SYNC_H) {
+    return -1;
+  }
+  if (len >= 2 and data[1] != ARCHIVE_SYNC_L) {
+    return -1;
+  }
+  if (len < 4) {
+    return 0;
+  }
+  *record_len = 256*data[2] + data[3];
+  if (*record_len > ARCHIVE_RECORD_MAX_SIZE) {
+    return -1;
+  }
+  if (len < *record_len + ARCHIVE_FRAME_OVERHEAD) {
+    return 0;
+  }
+  crc = 256*data[4 + *record_len] + data[5 + *record_len];
+  if (crc != archive_frame_crc (data + 4, *record_len)) {
+    return -1;
+  }
+  return (*record_len + ARCHIVE_FRAME_OVERHEAD);
+}
+
+uint32_t archive_valid_end (const uint8_t* data, uint16_t len, uint32_t offset) {
+  // scan a tail window (starting at file offset) for the end of the last complete frame; offset if there is none
+  uint32_t valid_end = offset;
+  uint16_t record_len;
+  int16_t frame_len;
+  uint16_t pos = 0;
+  while (pos < len) {
+    frame_len = archive_unframe (data + pos, len - pos, &record_len);
+    if (frame_len > 0) {
+      pos += frame_len;
+      valid_end = offset + pos;
+    }
+    else {
+      pos++;
+    }
+  }
+  return (valid_end);
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Fli3d - Library (archive codec, portable: also used by the ground tools)
+ */
+
+#ifndef _FLI3D_ARCHIVE_H_
+#define _FLI3D_ARCHIVE_H_
+
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC             "FLI3"
+#define ARCHIVE_VERSION           1
+#define ARCHIVE_FLAG_DELTA        0x01   // records are delta-coded against the previous packet of the same APID
+#define ARCHIVE_FLAG_FRAMED       0x02   // records are framed with a sync marker, length and CRC-16
+#define ARCHIVE_APID_BASE         42     // first APID used by Fli3d
+#define ARCHIVE_APIDS             16     // APIDs ARCHIVE_APID_BASE.. that get a reference packet
+#define ARCHIVE_PACKET_MAX_SIZE   256    // largest CCSDS packet the codec handles
+#define ARCHIVE_RECORD_MAX_SIZE   (1 + ARCHIVE_PACKET_MAX_SIZE + ARCHIVE_PACKET_MAX_SIZE/8)
+
+// record framing: sync marker (2) + record length (2) + record + CRC-16 over length and record (2)
+#define ARCHIVE_SYNC_H            0x1A
+#define ARCHIVE_SYNC_L            0xCF
+#define ARCHIVE_FRAME_OVERHEAD    6
+#define ARCHIVE_FRAME_MAX_SIZE    (ARCHIVE_RECORD_MAX_SIZE + ARCHIVE_FRAME_OVERHEAD)
+
+// record tags
+#define ARCHIVE_TAG_RAW           0x00   // followed by the full CCSDS packet
+#define ARCHIVE_TAG_DELTA         0x80   // | APID index; followed by bitmap-coded XOR against the reference packet
+
+struct __attribute__ ((packed)) archive_hdr_t { // start of every compressed archive segment
+  char        magic[4];
+  uint8_t     version;
+  uint8_t     flags;
+};
+
+struct __attribute__ ((packed)) index_entry_t { // one per block of records, in the .idx sidecar of a segment
+  uint32_t    offset;                  // file offset of the first record of the block
+  uint32_t    millis;                  // local millis() when the block was started
+  uint16_t    apids;                   // bit (APID - ARCHIVE_APID_BASE) set: block holds packets of that APID
+  uint16_t    packets;                 // number of records in the block
+};
+
+struct __attribute__ ((packed)) codec_t {
+  uint8_t     ref[ARCHIVE_APIDS][ARCHIVE_PACKET_MAX_SIZE]; // previous packet per APID
+  uint16_t    ref_len[ARCHIVE_APIDS];                      // 0: no reference yet
+};
+
+extern uint16_t crc16 (const uint8_t* data, uint16_t length, uint16_t crc = 0xFFFF);
+extern void archive_hdr_init (archive_hdr_t* hdr, uint8_t flags);
+extern bool archive_hdr_valid (const uint8_t* data, uint16_t len);
+extern void archive_codec_reset (codec_t* codec);
+extern uint16_t archive_packet_len (const uint8_t* packet);
+extern uint16_t archive_encode (codec_t* codec, const uint8_t* packet, uint8_t* record);
+extern int16_t archive_decode (codec_t* codec, const uint8_t* record, uint16_t len, uint8_t* packet);
+extern uint32_t index_search (const index_entry_t* entries, uint32_t count, uint32_t millis);
+extern void archive_frame_hdr (uint8_t* frame_hdr, uint16_t record_len);
+extern uint16_t archive_frame_crc (const uint8_t* record, uint16_t record_len);
+extern int16_t archive_unframe (const uint8_t* data, uint16_t len, uint16_t* record_len);
+extern uint32_t archive_valid_end (const uint8_t* data, uint16_t len, uint32_t offset);
+
+#endif // _FLI3D_ARCHIVE_H_
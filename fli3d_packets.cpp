@@ -0,0 +1,250 @@
+/*
+ * Fli3d - Library (TM/TC packet definitions, portable: also used by the ground tools)
+ */
+
+#ifndef ARDUINO_ESP8266_NODEMCU
+
+#include <fli3d_packets.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+static unsigned long millis () { return 0; } // ground tools: TC packets do not carry the time they were sent
+#endif
+
+const char pidName[NUMBER_OF_PID][15] =   { "sts_esp32", "sts_esp32cam", "tm_esp32", "tm_esp32cam", "tm_camera", "tm_gps", "tm_motion", "tm_pressure", "tm_radio", "timer_esp32", "timer_esp32cam", "tc_esp32", "tc_esp32cam" };
+const char eventName[8][9] =              { "init", "info", "warning", "error", "cmd", "cmd_ack", "cmd_resp", "cmd_fail" };
+const char subsystemName[13][14] =        { "esp32", "esp32cam", "ov2640", "neo6mv2", "mpuXX50", "bmp280", "radio", "sd", "separation", "timer", "fli3d", "ground", "any" };
+const char modeName[4][12] =              { "init", "checkout", "nominal", "maintenance" };
+const char stateName[4][10] =             { "static", "thrust", "freefall", "parachute" };
+const char cameraModeName[4][7] =         { "init", "idle", "single", "stream" };
+const char cameraResolutionName[11][10] = { "160x120", "invalid1", "invalid2", "240x176", "320x240", "400x300", "640x480", "800x600", "1024x768", "1280x1024", "1600x1200" };
+const char tcName[8][20] =                { "reboot", "set_opsmode", "load_config", "load_routing", "set_parameter", "freeze_opsmode", "replay_start", "replay_stop" };
+const char gpsStatusName[9][11] =         { "none", "est", "time_only", "std", "dgps", "rtk_float", "rtk_fixed", "status_pps", "waiting" };
+
+uint16_t get_ccsds_apid (ccsds_t* ccsds_ptr) {
+  return (256*((ccsds_hdr_t*)ccsds_ptr)->apid_H + ((ccsds_hdr_t*)ccsds_ptr)->apid_L);
+}
+
+uint16_t get_ccsds_packet_len (ccsds_t* ccsds_ptr) {
+  return (sizeof (ccsds_hdr_t) + 256*((ccsds_hdr_t*)ccsds_ptr)->pkt_len_H + ((ccsds_hdr_t*)ccsds_ptr)->pkt_len_L + 1);
+}
+
+uint32_t get_ccsds_millis (ccsds_t* ccsds_ptr) {
+  return (65536*(uint8_t)*((uint8_t*)ccsds_ptr+8)+256*(uint8_t)*((uint8_t*)ccsds_ptr+7)+(uint8_t)*((uint8_t*)ccsds_ptr+6));
+}
+
+uint16_t get_ccsds_seq_ctr (ccsds_t* ccsds_ptr) {
+  return (256*((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_H + ((ccsds_hdr_t*)ccsds_ptr)->seq_ctr_L);
+}
+
+void build_json_str (char* json_buffer, ccsds_t* ccsds_ptr) {
+  uint16_t PID = get_ccsds_apid (ccsds_ptr) - 42;
+  switch (PID) {
+    case STS_ESP32:      { 
+                           sts_esp32_t* sts_esp32_ptr = (sts_esp32_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"type\":\"%s\",\"ss\":\"%s\",\"msg\":\"%s\"}", 
+                                    pidName[PID], sts_esp32_ptr->packet_ctr, sts_esp32_ptr->millis, 
+                                    eventName[sts_esp32_ptr->type], subsystemName[sts_esp32_ptr->subsystem], sts_esp32_ptr->message);
+                         }
+                         break;
+    case STS_ESP32CAM:   { 
+                           sts_esp32cam_t* sts_esp32cam_ptr = (sts_esp32cam_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"type\":\"%s\",\"ss\":\"%s\",\"msg\":\"%s\"}", 
+                                    pidName[PID], sts_esp32cam_ptr->packet_ctr, sts_esp32cam_ptr->millis, 
+                                    eventName[sts_esp32cam_ptr->type], subsystemName[sts_esp32cam_ptr->subsystem], sts_esp32cam_ptr->message);
+                         }
+                         break;                  
+    case TM_ESP32:       {
+                           tm_esp32_t* esp32_ptr = (tm_esp32_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"state\":\"%s\",\"err\":%u,\"warn\":%u,\"tc\":{\"exec\":%u,\"fail\":%u},\"mem\":[%u,%u],\"buf\":[%u,%u],\"fs\":[%u,%u],\"ntp\":%u,\"inst_rate\":[%u,%u,%u,%u,%u],\"comm_rate\":[%u,%u,%u,%u,%u],\"sep\":%d,\"ena\":\"%d%d%d%d%d%d%d%d%d%d%d\",\"act\":\"%d%d%d%d%d%d%d%d\",\"conn\":{\"up\":\"%d%d\",\"warn\":\"%d%d\",\"err\":\"%d%d%d\"}}", 
+                                    pidName[PID], esp32_ptr->packet_ctr, esp32_ptr->millis,  
+                                    modeName[esp32_ptr->opsmode], stateName[esp32_ptr->state], esp32_ptr->error_ctr, esp32_ptr->warning_ctr, 
+                                    esp32_ptr->tc_exec_ctr, esp32_ptr->tc_fail_ctr,
+                                    esp32_ptr->mem_free, esp32_ptr->fs_free, 
+                                    esp32_ptr->yamcs_buffer, esp32_ptr->serial_out_buffer, 
+                                    esp32_ptr->ftp_fs, esp32_ptr->buffer_fs,
+                                    esp32_ptr->time_set, 
+                                    esp32_ptr->radio_rate, esp32_ptr->pressure_rate, esp32_ptr->motion_rate, esp32_ptr->gps_rate, esp32_ptr->camera_rate, esp32_ptr->udp_rate, esp32_ptr->yamcs_rate, esp32_ptr->serial_in_rate, esp32_ptr->serial_out_rate, esp32_ptr->fs_rate, 
+                                    esp32_ptr->separation_sts,
+                                    esp32_ptr->radio_enabled, esp32_ptr->pressure_enabled, esp32_ptr->motion_enabled, esp32_ptr->gps_enabled, esp32_ptr->camera_enabled, esp32_ptr->wifi_enabled, esp32_ptr->wifi_udp_enabled, esp32_ptr->wifi_yamcs_enabled, esp32_ptr->fs_enabled, esp32_ptr->ftp_enabled, esp32_ptr->time_set,
+                                    esp32_ptr->radio_active, esp32_ptr->pressure_active, esp32_ptr->motion_active, esp32_ptr->gps_active, esp32_ptr->camera_active, esp32_ptr->fs_active, esp32_ptr->ftp_active, esp32_ptr->ota_enabled,
+                                    esp32_ptr->serial_connected, esp32_ptr->wifi_connected, esp32_ptr->warn_serial_connloss, esp32_ptr->warn_wifi_connloss, esp32_ptr->err_serial_dataloss, esp32_ptr->err_yamcs_dataloss, esp32_ptr->err_fs_dataloss); 
+                         }
+                         break;
+    case TM_ESP32CAM:    { // TODO: ota_enabled missing
+                           tm_esp32cam_t* esp32cam_ptr = (tm_esp32cam_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"err\":%u,\"warn\":%u,\"tc\":{\"exec\":%u,\"fail\":%u},\"mem\":[%u,%u,%u],\"buf\":[%u,%u],\"fs\":[%u,%u],\"ntp\":%u,\"rate\":[%u,%u,%u,%u,%u,%u,%u,%u,%u],\"ena\":\"%d%d%d%d%d%d%d%d%d%d%d\",\"act\":\"%d%d%d%d\",\"conn\":{\"up\":\"%d%d\",\"warn\":\"%d%d\",\"err\":\"%d%d%d%d\"}}",
+                                    pidName[PID], esp32cam_ptr->packet_ctr, esp32cam_ptr->millis,  
+                                    cameraModeName[esp32cam_ptr->opsmode], esp32cam_ptr->error_ctr, esp32cam_ptr->warning_ctr, 
+                                    esp32cam_ptr->tc_exec_ctr, esp32cam_ptr->tc_fail_ctr,
+                                    esp32cam_ptr->mem_free, esp32cam_ptr->fs_free, esp32cam_ptr->sd_free, 
+                                    esp32cam_ptr->yamcs_buffer, esp32cam_ptr->serial_out_buffer, 
+                                    esp32cam_ptr->ftp_fs, esp32cam_ptr->buffer_fs, 
+                                    esp32cam_ptr->time_set, 
+                                    esp32cam_ptr->camera_rate, esp32cam_ptr->udp_rate, esp32cam_ptr->yamcs_rate, esp32cam_ptr->serial_in_rate, esp32cam_ptr->serial_out_rate, esp32cam_ptr->fs_rate, esp32cam_ptr->sd_json_rate, esp32cam_ptr->sd_ccsds_rate, esp32cam_ptr->sd_image_rate,  
+                                    esp32cam_ptr->camera_enabled, esp32cam_ptr->wifi_enabled, esp32cam_ptr->wifi_udp_enabled, esp32cam_ptr->wifi_yamcs_enabled, esp32cam_ptr->wifi_image_enabled, esp32cam_ptr->fs_enabled, esp32cam_ptr->sd_enabled, esp32cam_ptr->ftp_enabled, esp32cam_ptr->sd_json_enabled, esp32cam_ptr->sd_ccsds_enabled, esp32cam_ptr->sd_image_enabled, 
+                                    esp32cam_ptr->camera_active, esp32cam_ptr->fs_active, esp32cam_ptr->sd_active, esp32cam_ptr->ftp_active, 
+                                    esp32cam_ptr->serial_connected, esp32cam_ptr->wifi_connected, esp32cam_ptr->warn_serial_connloss, esp32cam_ptr->warn_wifi_connloss, esp32cam_ptr->err_serial_dataloss, esp32cam_ptr->err_yamcs_dataloss, esp32cam_ptr->err_fs_dataloss, esp32cam_ptr->err_sd_dataloss); 
+                         }
+                         break;
+    case TM_CAMERA:      {
+                           tm_camera_t* ov2640_ptr = (tm_camera_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"mode\":\"%s\",\"res\":\"%s\",\"auto_res\":%d,\"file\":\"%s\",\"size\":%u,\"ms\":{\"exp\":%u,\"sd\":%u,\"wifi\":%u}}", 
+                                    pidName[PID], ov2640_ptr->packet_ctr, ov2640_ptr->millis, 
+                                    cameraModeName[ov2640_ptr->camera_mode], cameraResolutionName[ov2640_ptr->resolution], ov2640_ptr->auto_res, ov2640_ptr->filename, ov2640_ptr->filesize, ov2640_ptr->exposure_ms, ov2640_ptr->sd_ms, ov2640_ptr->wifi_ms);
+                         }
+                         break;
+    case TM_GPS:         { 
+                           tm_gps_t* neo6mv2_ptr = (tm_gps_t*)ccsds_ptr;
+                           *json_buffer++ = '{';
+                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"sts\":\"%s\",\"sats\":%d", pidName[PID], neo6mv2_ptr->packet_ctr, neo6mv2_ptr->millis, gpsStatusName[neo6mv2_ptr->status], neo6mv2_ptr->satellites);
+                           if (neo6mv2_ptr->time_valid) {
+                             json_buffer += sprintf (json_buffer, ",\"time\":\"%02d:%02d:%02d.%02d\"", neo6mv2_ptr->hours, neo6mv2_ptr->minutes, neo6mv2_ptr->seconds, neo6mv2_ptr->centiseconds);
+                           }
+                           if (neo6mv2_ptr->location_valid) {
+                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
+                             json_buffer += sprintf (json_buffer, ",\"loc\":[%d,%d]", neo6mv2_ptr->latitude, neo6mv2_ptr->longitude);
+                             #else
+                             json_buffer += sprintf (json_buffer, ",\"loc\":[%ld,%ld]", neo6mv2_ptr->latitude, neo6mv2_ptr->longitude);
+                             #endif
+                           }
+                           if (neo6mv2_ptr->altitude_valid) {
+                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
+                             json_buffer += sprintf (json_buffer, ",\"alt\":%d", neo6mv2_ptr->altitude);
+                             #else
+                             json_buffer += sprintf (json_buffer, ",\"alt\":%ld", neo6mv2_ptr->altitude);
+                             #endif
+                           }  
+                           if (neo6mv2_ptr->location_valid and neo6mv2_ptr->altitude_valid) {
+                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x  
+                             json_buffer += sprintf (json_buffer, ",\"zero\":[%d,%d,%d]", neo6mv2_ptr->latitude_zero, neo6mv2_ptr->longitude_zero, neo6mv2_ptr->altitude_zero);
+                             #else
+                             json_buffer += sprintf (json_buffer, ",\"zero\":[%ld,%ld,%ld]", neo6mv2_ptr->latitude_zero, neo6mv2_ptr->longitude_zero, neo6mv2_ptr->altitude_zero);
+                             #endif
+                           }
+                           if (neo6mv2_ptr->offset_valid) {
+                             json_buffer += sprintf (json_buffer, ",\"xyz\":[%d,%d,%d]", neo6mv2_ptr->x, neo6mv2_ptr->y, neo6mv2_ptr->z);
+                           }
+                           if (neo6mv2_ptr->speed_valid) {
+                           	 #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
+                             json_buffer += sprintf (json_buffer, ",\"v\":[%d,%d,%d]", neo6mv2_ptr->v_north, neo6mv2_ptr->v_east, neo6mv2_ptr->v_down);
+                             #else
+                             json_buffer += sprintf (json_buffer, ",\"v\":[%ld,%ld,%ld]", neo6mv2_ptr->v_north, neo6mv2_ptr->v_east, neo6mv2_ptr->v_down);
+                             #endif
+                           }
+                           if (neo6mv2_ptr->hdop_valid and neo6mv2_ptr->vdop_valid and neo6mv2_ptr->pdop_valid) {
+                             json_buffer += sprintf (json_buffer, ",\"dop\":[%u,%u,%u]", neo6mv2_ptr->milli_hdop, neo6mv2_ptr->milli_vdop, neo6mv2_ptr->milli_pdop);
+                           }
+                           if (neo6mv2_ptr->error_valid) {
+                             json_buffer += sprintf (json_buffer, ",\"err\":[%d,%d,%d]", neo6mv2_ptr->x_err, neo6mv2_ptr->y_err, neo6mv2_ptr->z_err);
+                           }
+                           json_buffer += sprintf (json_buffer, ",\"valid\":\"%d%d%d%d%d%d%d%d%d\"", neo6mv2_ptr->time_valid, neo6mv2_ptr->location_valid, neo6mv2_ptr->altitude_valid, neo6mv2_ptr->speed_valid, neo6mv2_ptr->hdop_valid, neo6mv2_ptr->vdop_valid, neo6mv2_ptr->pdop_valid, neo6mv2_ptr->error_valid, neo6mv2_ptr->offset_valid);
+                           *json_buffer++ = '}';
+                           *json_buffer++ = 0;
+                         }
+                         break;
+    case TM_MOTION:      {
+                           tm_motion_t* motion_ptr = (tm_motion_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"accel\":[%d,%d,%d],\"gyro\":[%d,%d,%d],\"tilt\":%d,\"g\":%d,\"a\":%d,\"rpm\":%d,\"range\":[%u,%u],\"valid\":\"%d%d\"}", 
+                                    pidName[PID], motion_ptr->packet_ctr, motion_ptr->millis, 
+                                    motion_ptr->accel_x, motion_ptr->accel_y, motion_ptr->accel_z, 
+                                    motion_ptr->gyro_x, motion_ptr->gyro_y, motion_ptr->gyro_z, 
+                                    motion_ptr->tilt, motion_ptr->g, motion_ptr->a, motion_ptr->rpm,
+                                    motion_ptr->accel_range, motion_ptr->gyro_range, motion_ptr->accel_valid, motion_ptr->gyro_valid); 
+                         }
+                         break;
+    case TM_PRESSURE:    {
+                           tm_pressure_t* bmp280_ptr = (tm_pressure_t*)ccsds_ptr;
+                           #ifndef ESP_ARDUINO_VERSION_MAJOR // ESP32 core v1.0.x
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"p\":%u,\"p0\":%u,\"T\":%d,\"h\":%d,\"v_v\":%d,\"valid\":%u}", 
+                                    pidName[PID], bmp280_ptr->packet_ctr, bmp280_ptr->millis, 
+                                    bmp280_ptr->pressure, bmp280_ptr->zero_level_pressure, bmp280_ptr->temperature, bmp280_ptr->height, bmp280_ptr->velocity_v, bmp280_ptr->height_valid);
+                           #else
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"p\":%lu,\"p0\":%lu,\"T\":%d,\"h\":%d,\"v_v\":%d,\"valid\":%u}", 
+                                    pidName[PID], bmp280_ptr->packet_ctr, bmp280_ptr->millis, 
+                                    bmp280_ptr->pressure, bmp280_ptr->zero_level_pressure, bmp280_ptr->temperature, bmp280_ptr->height, bmp280_ptr->velocity_v, bmp280_ptr->height_valid);
+                           #endif
+                         }
+                         break;
+    case TM_RADIO:       {
+                           tm_radio_t* radio_ptr = (tm_radio_t*)ccsds_ptr;
+                           json_buffer += sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"data\":\"", 
+                                    pidName[PID], radio_ptr->packet_ctr, radio_ptr->millis);
+                           for (uint16_t i = 0; i < sizeof(tm_radio_t); i++) {
+                             json_buffer += sprintf (json_buffer, "%02X", ((uint8_t*)radio_ptr)[i]);
+                           }
+                           sprintf (json_buffer, "\"}");
+                         }
+                         break;
+    case TIMER_ESP32:    {
+                           timer_esp32_t* timer_esp32_ptr = (timer_esp32_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"idle\":%u,\"instr\":[%u,%u,%u,%u,%u],\"fun\":[%u,%u,%u,%u,%u],\"pub\":[%u,%u,%u,%u],\"arch\":[%u,%u,%u],\"sync\":[%u,%u,%u],\"drain\":[%u,%u],\"tx\":[%u,%u,%u,%u,%u],\"tcq\":[%u,%u,%u],\"shape\":[%u,%u,%u,%u]}", 
+                                    pidName[PID], timer_esp32_ptr->packet_ctr, timer_esp32_ptr->millis,  
+                                    timer_esp32_ptr->idle_duration,
+                                    timer_esp32_ptr->radio_duration, timer_esp32_ptr->pressure_duration, timer_esp32_ptr->motion_duration, timer_esp32_ptr->gps_duration, timer_esp32_ptr->esp32cam_duration,
+                                    timer_esp32_ptr->serial_duration, timer_esp32_ptr->ota_duration, timer_esp32_ptr->ftp_duration, timer_esp32_ptr->wifi_duration, timer_esp32_ptr->tc_duration,
+                                    timer_esp32_ptr->publish_fs_duration, timer_esp32_ptr->publish_serial_duration, timer_esp32_ptr->publish_yamcs_duration, timer_esp32_ptr->publish_udp_duration,
+                                    timer_esp32_ptr->archive_staged, timer_esp32_ptr->archive_flushed, timer_esp32_ptr->archive_writes,
+                                    timer_esp32_ptr->sync_policy, timer_esp32_ptr->sync_count, timer_esp32_ptr->sync_latency,
+                                    timer_esp32_ptr->drain_rate, timer_esp32_ptr->drain_eta,
+                                    timer_esp32_ptr->tx_dropped, timer_esp32_ptr->tx_failed, timer_esp32_ptr->tx_throttled, timer_esp32_ptr->tx_latency, timer_esp32_ptr->tx_enqueue,
+                                    timer_esp32_ptr->tc_queued, timer_esp32_ptr->tc_dropped, timer_esp32_ptr->tc_latency,
+                                    timer_esp32_ptr->shape_yamcs, timer_esp32_ptr->shape_serial, timer_esp32_ptr->shape_udp, timer_esp32_ptr->shape_pid);
+                         }
+                         break;
+    case TIMER_ESP32CAM: { // TODO: fine-tune packet
+                           timer_esp32cam_t* timer_esp32cam_ptr = (timer_esp32cam_t*)ccsds_ptr;
+                           sprintf (json_buffer, "{\"id\":\"%s\",\"ctr\":%u,\"millis\":%u,\"idle\":%u,\"cam\":%u,\"fun\":[%u,%u,%u,%u,%u],\"pub\":[%u,%u,%u,%u,%u],\"arch\":[%u,%u,%u],\"sync\":[%u,%u,%u],\"drain\":[%u,%u],\"tx\":[%u,%u,%u,%u,%u],\"tcq\":[%u,%u,%u],\"shape\":[%u,%u,%u,%u]}", 
+                                    pidName[PID], timer_esp32cam_ptr->packet_ctr, timer_esp32cam_ptr->millis, 
+                                    timer_esp32cam_ptr->idle_duration,
+                                    timer_esp32cam_ptr->camera_duration,
+                                    timer_esp32cam_ptr->serial_duration, timer_esp32cam_ptr->tc_duration, timer_esp32cam_ptr->sd_duration, timer_esp32cam_ptr->ftp_duration, timer_esp32cam_ptr->wifi_duration, 
+                                    timer_esp32cam_ptr->publish_sd_duration, timer_esp32cam_ptr->publish_fs_duration, timer_esp32cam_ptr->publish_serial_duration, timer_esp32cam_ptr->publish_yamcs_duration, timer_esp32cam_ptr->publish_udp_duration,
+                                    timer_esp32cam_ptr->archive_staged, timer_esp32cam_ptr->archive_flushed, timer_esp32cam_ptr->archive_writes,
+                                    timer_esp32cam_ptr->sync_policy, timer_esp32cam_ptr->sync_count, timer_esp32cam_ptr->sync_latency,
+                                    timer_esp32cam_ptr->drain_rate, timer_esp32cam_ptr->drain_eta,
+                                    timer_esp32cam_ptr->tx_dropped, timer_esp32cam_ptr->tx_failed, timer_esp32cam_ptr->tx_throttled, timer_esp32cam_ptr->tx_latency, timer_esp32cam_ptr->tx_enqueue,
+                                    timer_esp32cam_ptr->tc_queued, timer_esp32cam_ptr->tc_dropped, timer_esp32cam_ptr->tc_latency,
+                                    timer_esp32cam_ptr->shape_yamcs, timer_esp32cam_ptr->shape_serial, timer_esp32cam_ptr->shape_udp, timer_esp32cam_ptr->shape_pid);
+                         }
+                         break;
+    case TC_ESP32:       { 
+                           tc_esp32_t* tc_esp32_ptr = (tc_esp32_t*)ccsds_ptr;
+                           *json_buffer++ = '{';
+                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"millis\":%lu,\"cmd\":\"%s\"", pidName[PID], millis(), tcName[tc_esp32_ptr->cmd_id-42]);
+                           if (tc_esp32_ptr->cmd_id-42 == TC_REBOOT or tc_esp32_ptr->cmd_id-42 == TC_SET_OPSMODE) {
+                             json_buffer += sprintf (json_buffer, ",\"int_val\":\"%u\"", (uint8_t)tc_esp32_ptr->parameter[0]);
+                           }
+                           if (tc_esp32_ptr->cmd_id-42 == TC_LOAD_CONFIG or tc_esp32_ptr->cmd_id-42 == TC_LOAD_ROUTING) {
+                             json_buffer += sprintf (json_buffer, ",\"str_val\":\"%s\"", tc_esp32_ptr->parameter);
+                           }
+                           if (tc_esp32_ptr->cmd_id-42 == TC_SET_PARAMETER) {
+                             json_buffer += sprintf (json_buffer, ",\"param\":\"%s\",\"value\":\"%s\"", tc_esp32_ptr->parameter, (char*)(&tc_esp32_ptr->parameter+strlen(tc_esp32_ptr->parameter)+1)); // TODO: value
+                           }
+                           *json_buffer++ = '}';
+                           *json_buffer++ = 0;
+                         }
+                         break;
+    case TC_ESP32CAM:    { 
+                           tc_esp32cam_t* tc_esp32cam_ptr = (tc_esp32cam_t*)ccsds_ptr;
+                           *json_buffer++ = '{';
+                           json_buffer += sprintf (json_buffer, "\"id\":\"%s\",\"millis\":%lu,\"cmd\":\"%s\"", pidName[PID], millis(), tcName[tc_esp32cam_ptr->cmd_id-42]);
+                           if (tc_esp32cam_ptr->cmd_id-42 == TC_REBOOT or tc_esp32cam_ptr->cmd_id-42 == TC_SET_OPSMODE) {
+                             json_buffer += sprintf (json_buffer, ",\"int_val\":\"%u\"", (uint8_t)tc_esp32cam_ptr->parameter[0]);
+                           }
+                           if (tc_esp32cam_ptr->cmd_id-42 == TC_LOAD_CONFIG or tc_esp32cam_ptr->cmd_id-42 == TC_LOAD_ROUTING) {
+                             json_buffer += sprintf (json_buffer, ",\"str_val\":\"%s\"", tc_esp32cam_ptr->parameter);
+                           }
+                           if (tc_esp32cam_ptr->cmd_id-42 == TC_SET_PARAMETER) {
+                             json_buffer += sprintf (json_buffer, ",\"param\":\"%s\",\"value\":\"%s\"", tc_esp32cam_ptr->parameter, tc_esp32cam_ptr->parameter); // TODO: value
+                           }
+                           *json_buffer++ = '}';
+                           *json_buffer++ = 0;
+                         } 
+                         break;   
+  } 
+}
+
+#endif
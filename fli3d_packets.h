@@ -0,0 +1,533 @@
+/*
+ * Fli3d - Library (TM/TC packet definitions, portable: also used by the ground tools)
+ */
+
+#ifndef _FLI3D_PACKETS_H_
+#define _FLI3D_PACKETS_H_
+
+#include <stdint.h>
+
+#define PARAMETER_MAX_SIZE        128
+
+// PIDs
+#define STS_ESP32              0
+#define STS_ESP32CAM           1
+#define TM_ESP32               2
+#define TM_ESP32CAM            3
+#define TM_CAMERA              4
+#define TM_GPS                 5
+#define TM_MOTION              6
+#define TM_PRESSURE            7
+#define TM_RADIO               8
+#define TIMER_ESP32            9
+#define TIMER_ESP32CAM         10
+#define TC_ESP32               11
+#define TC_ESP32CAM            12
+#define NUMBER_OF_PID          13
+extern const char pidName[NUMBER_OF_PID][15];
+
+// event_types
+#define EVENT_INIT             0
+#define EVENT_INFO             1
+#define EVENT_WARNING          2
+#define EVENT_ERROR            3
+#define EVENT_CMD              4
+#define EVENT_CMD_ACK          5
+#define EVENT_CMD_RESP         6
+#define EVENT_CMD_FAIL         7
+extern const char eventName[8][9];
+
+// subsystem
+#define SS_ESP32               0
+#define SS_ESP32CAM            1
+#define SS_CAMERA              2
+#define SS_GPS                 3
+#define SS_MOTION              4
+#define SS_PRESSURE            5
+#define SS_RADIO               6
+#define SS_SD                  7
+#define SS_SEPARATION          8
+#define SS_TIMER               9
+#define SS_FLI3D               10
+#define SS_GROUND              11
+#define SS_ANY                 12 
+extern const char subsystemName[13][14];
+
+// opsmode
+#define MODE_INIT              0
+#define MODE_CHECKOUT          1
+#define MODE_NOMINAL           2
+#define MODE_MAINTENANCE       3
+extern const char modeName[4][12];
+
+// state
+#define STATE_STATIC           0
+#define STATE_THRUST           1
+#define STATE_FREEFALL         2
+#define STATE_PARACHUTE        3
+extern const char stateName[4][10];
+
+// cammode
+#define CAM_INIT               0
+#define CAM_IDLE               1
+#define CAM_SINGLE             2
+#define CAM_STREAM             3
+extern const char cameraModeName[4][7];
+
+// cam resolutions
+#define RES_160x120            0
+#define RES_240x176            1
+#define RES_INVALID1           2
+#define RES_INVALID2           3
+#define RES_320x240            4 
+#define RES_400x300            5
+#define RES_640x480            6
+#define RES_800x600            7
+#define RES_1024x768           8
+#define RES_1280x1024          9
+#define RES_1600x1200          10           
+extern const char cameraResolutionName[11][10];
+
+// packet types
+#define PKT_TM                 0
+#define PKT_TC                 1
+
+// commands
+#define TC_REBOOT              42
+#define TC_SET_OPSMODE         43
+#define TC_LOAD_CONFIG         44
+#define TC_LOAD_ROUTING        45
+#define TC_SET_PARAMETER       46
+#define TC_FREEZE_OPSMODE      47
+#define TC_REPLAY_START        48
+#define TC_REPLAY_STOP         49
+extern const char tcName[8][20];
+
+// GPS status
+extern const char gpsStatusName[9][11];
+
+// TM/TC packet definitions
+
+struct __attribute__ ((packed)) ccsds_hdr_t {
+  uint8_t     apid_H:3;                // 0:5
+  bool        sec_hdr:1;               // 0: 4
+  bool        type:1;                  // 0:  3
+  uint8_t     version:3;               // 0:   0
+  uint8_t     apid_L;                  // 1
+  uint8_t     seq_ctr_H:6;             // 2:2
+  uint8_t     seq_flag:2;              // 2: 0
+  uint8_t     seq_ctr_L;               // 3
+  uint8_t     pkt_len_H;               // 4
+  uint8_t     pkt_len_L;               // 5
+}; 
+
+struct __attribute__ ((packed)) ccsds_sec_hdr_t {
+  uint8_t     apidQ_H:1;               // 0:7
+  bool        playback:1;              // 0: 6
+  bool        spare0:1;                // 0:  5
+  bool        crc_flag:1;              // 0:   4
+  uint8_t     version:4;               // 0:    3-0
+  uint32_t    apidQ_L:24;              // 1-3
+  uint8_t     spare1;                  // 4
+  uint8_t     source_id;               // 5
+  uint16_t    timestamp_msw;           // 6-7
+  uint16_t    timestamp_lsw;           // 8-9
+  uint16_t    timestamp_subsec;        // 10-11
+  uint16_t    spare2;                  // 12-13
+}; 
+
+struct __attribute__ ((packed)) ccsds_t {
+  ccsds_hdr_t ccsds_hdr;
+  uint8_t     blob[PARAMETER_MAX_SIZE+6];   // sized for longest possible sts_esp32/sts_esp32cam packet
+};
+
+struct __attribute__ ((packed)) sts_esp32_t { // APID: 42 (2a)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     type:4;                  // 4-7
+  uint8_t     subsystem:4;             //  0-3
+  char        message[PARAMETER_MAX_SIZE];
+};
+
+struct __attribute__ ((packed)) sts_esp32cam_t { // APID: 43 (2b)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     type:4;                  // 4-7
+  uint8_t     subsystem:4;             //  0-3
+  char        message[PARAMETER_MAX_SIZE];
+}; 
+
+struct __attribute__ ((packed)) tm_esp32_t { // APID: 44 (2c)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     opsmode:2;               // 6-7
+  uint8_t     state:2;                 //  4-5
+  uint8_t     buffer_fs:2;             //   2-3 
+  uint8_t     ftp_fs:2;                //    0-1 
+  uint8_t     error_ctr;
+  uint8_t     warning_ctr;
+  uint8_t     tc_exec_ctr;
+  uint8_t     tc_fail_ctr;
+  uint8_t     radio_rate;
+  uint8_t     pressure_rate;
+  uint8_t     motion_rate;
+  uint8_t     gps_rate;
+  uint8_t     camera_rate;
+  uint8_t     udp_rate;
+  uint8_t     yamcs_rate;
+  uint8_t     serial_in_rate;
+  uint8_t     serial_out_rate;
+  uint8_t     fs_rate;                                                          
+  uint8_t     yamcs_buffer;
+  uint8_t     serial_out_buffer;
+  uint16_t    mem_free;
+  uint16_t    fs_free;
+  int16_t     temperature;             // cdegC
+  bool        radio_enabled:1;         // 7
+  bool        pressure_enabled:1;      //  6
+  bool        motion_enabled:1;        //   5
+  bool        gps_enabled:1;           //    4
+  bool        camera_enabled:1;        //     3
+  bool        wifi_enabled:1;          //      2
+  bool        wifi_udp_enabled:1;      //       1
+  bool        wifi_yamcs_enabled:1;    //        0
+  bool        fs_enabled:1;            // 7
+  bool        ftp_enabled:1;           //  6
+  bool        ota_enabled:1;           //   5 
+  bool        temperature_enabled:1;   //    4
+  bool        free_23:1;               //     3 - free to assign
+  bool        free_22:1;               //      2 - free to assign
+  bool        free_21:1;               //       1 - free to assign
+  bool        time_set:1;              //        0
+  bool        serial_connected:1;      // 7
+  bool        wifi_connected:1;        //  6 
+  bool        warn_serial_connloss:1;  //   5        
+  bool        warn_wifi_connloss:1;    //    4       
+  bool        err_serial_dataloss:1;   //     3
+  bool        err_yamcs_dataloss:1;    //      2
+  bool        err_fs_dataloss:1;       //       1
+  bool        separation_sts:1;        //        0  
+  bool        radio_active:1;          // 7
+  bool        pressure_active:1;       //  6
+  bool        motion_active:1;         //   5
+  bool        gps_active:1;            //    4
+  bool        camera_active:1;         //     3
+  bool        fs_active:1;             //      2
+  bool        ftp_active:1;            //       1
+  bool        buffer_active:1;         //        0
+};
+
+struct __attribute__ ((packed)) tm_esp32cam_t { // APID: 45 (2d)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     opsmode:2;               // 6-7
+  uint8_t     buffer_fs:2;             //  4-5
+  uint8_t     ftp_fs:2;                //   2-3
+  bool        free01:1;                //    1 - free to assign
+  bool        free00:1;                //     0 - free to assign
+  uint8_t     error_ctr;
+  uint8_t     warning_ctr;
+  uint8_t     tc_exec_ctr;
+  uint8_t     tc_fail_ctr;
+  uint8_t     camera_rate;
+  uint8_t     udp_rate;
+  uint8_t     yamcs_rate;
+  uint8_t     serial_in_rate;
+  uint8_t     serial_out_rate;
+  uint8_t     fs_rate;
+  uint8_t     sd_json_rate;
+  uint8_t     sd_ccsds_rate;
+  uint8_t     sd_image_rate;
+  uint8_t     yamcs_buffer;
+  uint8_t     serial_out_buffer;
+  uint16_t    mem_free;
+  uint16_t    fs_free;
+  uint16_t    sd_free;
+  bool        camera_enabled:1;        // 7   
+  bool        wifi_enabled:1;          //  6
+  bool        wifi_udp_enabled:1;      //   5
+  bool        wifi_yamcs_enabled:1;    //    4
+  bool        wifi_image_enabled:1;    //     3
+  bool        free_12:1;               //      2 - free to assign
+  bool        free_11:1;               //       1 - free to assign
+  bool        time_set:1;              //        0
+  bool        fs_enabled:1;            // 7 
+  bool        sd_enabled:1;            //  6 
+  bool        ftp_enabled:1;           //   5      
+  bool        ota_enabled:1;           //    4
+  bool        sd_image_enabled:1;      //     3
+  bool        sd_json_enabled:1;       //      2
+  bool        sd_ccsds_enabled:1;      //       1 
+  bool        http_enabled:1;          //        0
+  bool        serial_connected:1;      // 7
+  bool        wifi_connected:1;        //  6 
+  bool        warn_serial_connloss:1;  //   5        
+  bool        warn_wifi_connloss:1;    //    4       
+  bool        err_serial_dataloss:1;   //     3
+  bool        err_yamcs_dataloss:1;    //      2
+  bool        err_fs_dataloss:1;       //       1
+  bool        err_sd_dataloss:1;       //        0           
+  bool        camera_active:1;         // 7
+  bool        fs_active:1;             //  6
+  bool        sd_active:1;             //   5
+  bool        ftp_active:1;            //    4
+  bool        buffer_active:1;         //     3
+  bool        http_active:1;           //      2  
+  bool        free_41:1;               //       1 - free to assign 
+  bool        free_40:1;               //        0 - free to assign 
+};
+
+struct __attribute__ ((packed)) tm_camera_t { // APID: 46 (2e)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     camera_mode:2;           // 6-7
+  uint8_t     resolution:4;            //  2-5
+  bool        auto_res:1;              //   1
+  bool        free_00:1;               //    0 - free to assign
+  uint32_t    filesize:24; 
+  uint8_t     wifi_ms; 
+  uint8_t     sd_ms;
+  uint8_t     exposure_ms;
+  char        filename[36]; 
+};
+
+struct __attribute__ ((packed)) tm_gps_t { // APID: 47 (2f)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     status:4;                // 4-7
+  uint8_t     satellites:4;            //  0-3   *GGA
+  uint8_t     hours;                   //        RMC,*GGA,ZDA
+  uint8_t     minutes;                 //        RMC,*GGA,ZDA
+  uint8_t     seconds;                 //        RMC,*GGA,ZDA
+  uint8_t     centiseconds;            //        *GST
+  int32_t     latitude;                //        RMC,*GGA,GLL
+  int32_t     longitude;               //        RMC,*GGA,GLL
+  int32_t     altitude;                // cm     *GGA
+  int32_t     latitude_zero;
+  int32_t     longitude_zero;
+  int32_t     altitude_zero;           // cm  
+  int16_t     x;                       // cm
+  int16_t     y;                       // cm
+  int16_t     z;                       // cm
+  int16_t     x_err;                   // cm     *GST
+  int16_t     y_err;                   // cm     *GST
+  int16_t     z_err;                   // cm     *GST
+  int32_t     v_north;                 // cm/s   VTG
+  int32_t     v_east;                  // cm/s   VTG
+  int32_t     v_down;                  // cm/s   PUBX_00
+  uint16_t    milli_hdop;              //        *GSA
+  uint16_t    milli_vdop;              //        *GSA
+  uint16_t    milli_pdop;              //        *GSA
+  bool        time_valid:1;            // 7
+  bool        location_valid:1;        //  6
+  bool        altitude_valid:1;        //   5
+  bool        speed_valid:1;           //    4
+  bool        hdop_valid:1;            //     3
+  bool        vdop_valid:1;            //      2
+  bool        pdop_valid:1;            //       1
+  bool        error_valid:1;           //        0
+  bool        offset_valid:1;          // 7
+  bool        free_16:1;               //  6 - free to assign
+  bool        free_15:1;               //   5 - free to assign
+  bool        free_14:1;               //    4 - free to assign
+  bool        free_13:1;               //     3 - free to assign
+  bool        free_12:1;               //      2 - free to assign
+  bool        free_11:1;               //       1 - free to assign
+  bool        free_10:1;               //        0 - free to assign
+};
+
+struct __attribute__ ((packed)) tm_motion_t { // APID: 48 (30)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  int16_t     accel_x;                 // cm/s2
+  int16_t     accel_y;                 // cm/s2
+  int16_t     accel_z;                 // cm/s2
+  int16_t     gyro_x;                  // cdeg/s
+  int16_t     gyro_y;                  // cdeg/s
+  int16_t     gyro_z;                  // cdeg/s
+  int16_t     magn_x;                  // uT
+  int16_t     magn_y;                  // uT
+  int16_t     magn_z;                  // uT
+  int16_t     tilt;                    // cdeg
+  uint16_t    g;                       // mG
+  int16_t     a;                       // cm/s2
+  int16_t     rpm;                     // crpm
+  uint8_t     accel_range:2;           //  6-7
+  uint8_t     gyro_range:2;            //   4-5
+  bool        accel_valid:1;           //    3
+  bool        gyro_valid:1;            //     2
+  bool        free_01:1;               //      1 - free to assign
+  bool        free_00:1;               //       0 - free to assign
+}; 
+
+struct __attribute__ ((packed)) tm_pressure_t { // APID: 49 (31)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint32_t    pressure;                // Pa
+  uint32_t    zero_level_pressure;     // Pa
+  int16_t     height;                  // cm
+  int16_t     velocity_v;              // cm/s
+  int16_t     temperature;             // cdegC
+  bool        height_valid:1;          // 7
+  bool        free_06:1;               //  6 - free to assign
+  bool        free_05:1;               //   5 - free to assign
+  bool        free_04:1;               //    4 - free to assign
+  bool        free_03:1;               //     3 - free to assign
+  bool        free_02:1;               //      2 - free to assign
+  bool        free_01:1;               //       1 - free to assign
+  bool        free_00:1;               //        0 - free to assign
+}; 
+
+struct __attribute__ ((packed)) tm_radio_t { // APID: 50 (32)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint8_t     opsmode:2;               // 6
+  uint8_t     state:2;                 //  4
+  bool        pressure_active:1;       //   3
+  bool        motion_active:1;         //    2
+  bool        gps_active:1;            //     1
+  bool        camera_active:1;         //      0
+  uint8_t     error_ctr;
+  uint8_t     warning_ctr;
+  uint8_t     pressure_height;         // m               (0 - 255 m)
+  int8_t      pressure_velocity_v;     // m/s             (-125 - 126 m/s)
+  int8_t      temperature;             // degC            (-125 - 126 degC)
+  uint8_t     motion_tilt;             // deg             (0 - 180 deg)
+  uint8_t     motion_g;                // G / 10          (0 - 25.5 G)  
+  int8_t      motion_a;                // m/s2            (-125 - 126 m/s2)
+  int8_t      motion_rpm;              //                 (-125 - 126 rpm)  
+  uint8_t     gps_satellites:4;        //   4-7
+  bool        esp32_buffer_active:1;   //    3
+  bool        esp32cam_buffer_active:1; //    2
+  bool        esp32cam_sd_image_enabled:1; //  1
+  bool        esp32cam_wifi_image_enabled:1; // 0
+  int8_t      gps_velocity_v;          // m/s             (-125 - 126 m/s)
+  uint8_t     gps_velocity;            // m/s             (0 - 255 m/s)
+  uint8_t     gps_height;              // m               (0 - 255 m)
+  uint16_t    camera_image_ctr;  
+  bool        esp32_serial_connected:1;        // 7
+  bool        esp32_wifi_connected:1;          //  6 
+  bool        esp32_warn_serial_connloss:1;    //   5        
+  bool        esp32_warn_wifi_connloss:1;      //    4       
+  bool        esp32_err_serial_dataloss:1;     //     3
+  bool        esp32_err_yamcs_dataloss:1;      //      2
+  bool        esp32_err_fs_dataloss:1;         //       1  
+  bool        separation_sts:1;                //        0
+  bool        esp32cam_serial_connected:1;     // 7
+  bool        esp32cam_wifi_connected:1;       //  6
+  bool        esp32cam_warn_serial_connloss:1; //   5        
+  bool        esp32cam_warn_wifi_connloss:1;   //    4       
+  bool        esp32cam_err_serial_dataloss:1;  //     3
+  bool        esp32cam_err_yamcs_dataloss:1;   //      2
+  bool        esp32cam_err_fs_dataloss:1;      //       1
+  bool        esp32cam_err_sd_dataloss:1;      //        0
+}; 
+
+struct __attribute__ ((packed)) timer_esp32_t { // APID: 51 (33)
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint16_t    radio_duration;
+  uint16_t    pressure_duration;
+  uint16_t    motion_duration;
+  uint16_t    gps_duration;
+  uint16_t    esp32cam_duration;
+  uint16_t    serial_duration;
+  uint16_t    ota_duration;
+  uint16_t    ftp_duration;
+  uint16_t    wifi_duration;
+  uint16_t    tc_duration;
+  uint16_t    idle_duration;
+  uint16_t    publish_fs_duration;
+  uint16_t    publish_serial_duration;
+  uint16_t    publish_yamcs_duration;
+  uint16_t    publish_udp_duration;
+  uint32_t    archive_staged;
+  uint32_t    archive_flushed;
+  uint16_t    archive_writes;
+  uint8_t     sync_policy;
+  uint16_t    sync_count;
+  uint16_t    sync_latency;
+  uint16_t    drain_rate;              // backlog records/s
+  uint16_t    drain_eta;               // s until the backlog is empty at drain_rate
+  uint16_t    tx_dropped;              // datagrams dropped at a full transmit queue
+  uint16_t    tx_failed;               // datagrams the WiFi stack did not take
+  uint16_t    tx_throttled;            // backlog drains held back by the transmit queue
+  uint16_t    tx_latency;              // ms, longest from transmit queue to WiFi stack
+  uint16_t    tx_enqueue;              // us, longest to put a datagram in the transmit queue
+  uint8_t     tc_queued;               // deepest command queue (AsyncUDP)
+  uint16_t    tc_dropped;              // commands dropped: command queue full or bad length (AsyncUDP)
+  uint16_t    tc_latency;              // ms, longest from receipt to execution of a command
+  uint16_t    shape_yamcs;             // live packets held back by the Yamcs shapers (left to the archive)
+  uint16_t    shape_serial;            // live packets held back by the serial shapers
+  uint16_t    shape_udp;               // live packets held back by the UDP shapers
+  uint8_t     shape_pid;               // PID with the most packets held back (255: none)
+};
+
+struct __attribute__ ((packed)) timer_esp32cam_t { // APID: 52 (34)  // TODO: fine-tune packet
+  ccsds_hdr_t ccsds_hdr;
+  uint32_t    millis:24;
+  uint16_t    packet_ctr;
+  uint16_t    camera_duration;
+  uint16_t    serial_duration;
+  uint16_t    tc_duration;
+  uint16_t    sd_duration;
+  uint16_t    ftp_duration;
+  uint16_t    wifi_duration;
+  uint16_t    idle_duration;
+  uint16_t    publish_sd_duration;
+  uint16_t    publish_fs_duration;
+  uint16_t    publish_serial_duration;
+  uint16_t    publish_yamcs_duration;
+  uint16_t    publish_udp_duration;
+  uint16_t    ota_duration;
+  uint32_t    archive_staged;
+  uint32_t    archive_flushed;
+  uint16_t    archive_writes;
+  uint8_t     sync_policy;
+  uint16_t    sync_count;
+  uint16_t    sync_latency;
+  uint16_t    drain_rate;              // backlog records/s
+  uint16_t    drain_eta;               // s until the backlog is empty at drain_rate
+  uint16_t    tx_dropped;              // datagrams dropped at a full transmit queue
+  uint16_t    tx_failed;               // datagrams the WiFi stack did not take
+  uint16_t    tx_throttled;            // backlog drains held back by the transmit queue
+  uint16_t    tx_latency;              // ms, longest from transmit queue to WiFi stack
+  uint16_t    tx_enqueue;              // us, longest to put a datagram in the transmit queue
+  uint8_t     tc_queued;               // deepest command queue (AsyncUDP)
+  uint16_t    tc_dropped;              // commands dropped: command queue full or bad length (AsyncUDP)
+  uint16_t    tc_latency;              // ms, longest from receipt to execution of a command
+  uint16_t    shape_yamcs;             // live packets held back by the Yamcs shapers (left to the archive)
+  uint16_t    shape_serial;            // live packets held back by the serial shapers
+  uint16_t    shape_udp;               // live packets held back by the UDP shapers
+  uint8_t     shape_pid;               // PID with the most packets held back (255: none)
+};
+
+struct __attribute__ ((packed)) tc_esp32_t { // APID: 53 (35)
+  ccsds_hdr_t ccsds_hdr;
+  uint8_t     cmd_id;
+  char        parameter[PARAMETER_MAX_SIZE];
+}; 
+
+struct __attribute__ ((packed)) tc_esp32cam_t { // APID: 54 (36)
+  ccsds_hdr_t ccsds_hdr;
+  uint8_t     cmd_id;
+  char        parameter[PARAMETER_MAX_SIZE];
+};
+
+extern uint16_t get_ccsds_apid (ccsds_t* ccsds_ptr);
+extern uint16_t get_ccsds_packet_len (ccsds_t* ccsds_ptr);
+extern uint32_t get_ccsds_millis (ccsds_t* ccsds_ptr);
+extern uint16_t get_ccsds_seq_ctr (ccsds_t* ccsds_ptr);
+extern void build_json_str (char* json_buffer, ccsds_t* ccsds_ptr);
+
+#endif // _FLI3D_PACKETS_H_